@@ -0,0 +1,110 @@
+/*
+ * Fair access to the shared codec accelerators
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <pthread.h>
+
+#include "accel_sched.h"
+#include "timeutil.h"
+
+/* ticket lock: requests are served strictly in arrival order */
+typedef struct AccelGroup {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned next_ticket;
+    unsigned now_serving;
+    AccelGroupStats stats;
+} AccelGroup;
+
+static AccelGroup groups[ACCEL_MAX_GROUPS] = {
+    [0 ... ACCEL_MAX_GROUPS - 1] = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+    },
+};
+
+static AccelGroup *get_group(int group)
+{
+    if (group < 0 || group >= ACCEL_MAX_GROUPS)
+        group = 0;
+    return &groups[group];
+}
+
+int64_t accel_acquire(int group)
+{
+    AccelGroup *g = get_group(group);
+    int64_t t0, now;
+    unsigned ticket;
+
+    t0 = time_now_us();
+    pthread_mutex_lock(&g->lock);
+    ticket = g->next_ticket++;
+    while (g->now_serving != ticket)
+        pthread_cond_wait(&g->cond, &g->lock);
+
+    now = time_now_us();
+    g->stats.nb_grants++;
+    g->stats.wait_us += now - t0;
+    if (now - t0 > g->stats.wait_max_us)
+        g->stats.wait_max_us = now - t0;
+    pthread_mutex_unlock(&g->lock);
+
+    return now;
+}
+
+void accel_release(int group, int64_t acquired)
+{
+    AccelGroup *g = get_group(group);
+
+    pthread_mutex_lock(&g->lock);
+    g->stats.hold_us += time_now_us() - acquired;
+    g->now_serving++;
+    pthread_cond_broadcast(&g->cond);
+    pthread_mutex_unlock(&g->lock);
+}
+
+void accel_get_stats(int group, AccelGroupStats *stats)
+{
+    AccelGroup *g = get_group(group);
+
+    pthread_mutex_lock(&g->lock);
+    *stats = g->stats;
+    pthread_mutex_unlock(&g->lock);
+}
+
+void accel_print_stats(void)
+{
+    int i;
+
+    for (i = 0; i < ACCEL_MAX_GROUPS; i++) {
+        AccelGroupStats s;
+
+        accel_get_stats(i, &s);
+        if (!s.nb_grants)
+            continue;
+        printf("accelerator group %d: %u grants, held %lld us, "
+                "wait %lld us avg / %lld us max\n", i, s.nb_grants,
+                (long long)s.hold_us, (long long)(s.wait_us / s.nb_grants),
+                (long long)s.wait_max_us);
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ * Fair access to the shared codec accelerators
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ACCEL_SCHED_H
+#define ACCEL_SCHED_H
+
+#include <stdint.h>
+
+/*
+ * Codecs configured with the same groupId in xdc.cfg share a hardware
+ * resource (groupId 1: h264enc, mpeg4enc, jpegenc1 on the HDVICP and
+ * decoders; groupId 2: iprun and ktnf). Calls into codecs of one group are
+ * serialized here in FIFO order, so channels sharing the accelerator take
+ * turns instead of one of them starving the others.
+ */
+
+#define ACCEL_MAX_GROUPS 4
+
+typedef struct AccelGroupStats {
+    unsigned nb_grants;
+    int64_t hold_us;        /* total time the accelerator was held */
+    int64_t wait_us;        /* total time spent queueing for it */
+    int64_t wait_max_us;
+} AccelGroupStats;
+
+/**
+ * Wait for our turn on the accelerator group. Groups are served in
+ * the order the requests arrived.
+ *
+ * @return a timestamp to pass to accel_release()
+ */
+int64_t accel_acquire(int group);
+
+void accel_release(int group, int64_t acquired);
+
+void accel_get_stats(int group, AccelGroupStats *stats);
+void accel_print_stats(void);
+
+#endif /* ACCEL_SCHED_H */
@@ -0,0 +1,364 @@
+/*
+ * Buffered muxer output drained by a writer thread
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#define _GNU_SOURCE     /* O_DIRECT */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "async_io.h"
+#include "timeutil.h"
+
+/* O_DIRECT wants offsets, sizes and buffers aligned to the block size */
+#define ASYNC_IO_ALIGN          4096
+/* the writer waits for this much data, flash likes big writes */
+#define ASYNC_IO_CHUNK          (256 * 1024)
+#define ASYNC_IO_AVIO_BUFFER    (64 * 1024)
+
+typedef struct AsyncIO {
+    int fd;
+    int own_fd;
+    uint8_t *ring;
+    int size;
+    int head;                   /* oldest byte not written yet */
+    int fill;
+    int64_t pos;                /* file offset of head */
+    int flush;                  /* write everything, tail included */
+    int stop;
+    int error;
+    pthread_mutex_t lock;
+    pthread_cond_t space;       /* writer -> muxer */
+    pthread_cond_t data;        /* muxer -> writer */
+    pthread_cond_t idle;        /* flush done */
+    pthread_t thread;
+    AsyncIOStats stats;
+} AsyncIO;
+
+static int write_full(int fd, const uint8_t *buf, int len)
+{
+    while (len > 0) {
+        ssize_t ret = write(fd, buf, len);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static void set_direct(AsyncIO *s, int on)
+{
+    int fl = fcntl(s->fd, F_GETFL);
+
+    if (fl < 0 || fcntl(s->fd, F_SETFL, on ? fl | O_DIRECT : fl & ~O_DIRECT) < 0)
+        on = 0;
+    s->stats.direct = on;
+}
+
+static void *writer_thread(void *arg)
+{
+    AsyncIO *s = arg;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        int len, flushing, ret;
+        int64_t t0, dt;
+
+        while (!s->stop && !s->flush && s->fill < ASYNC_IO_CHUNK)
+            pthread_cond_wait(&s->data, &s->lock);
+        flushing = s->flush || s->stop;
+
+        if (!s->fill || s->error) {
+            if (s->flush) {
+                s->flush = 0;
+                pthread_cond_broadcast(&s->idle);
+            }
+            if (s->stop)
+                break;
+            continue;
+        }
+
+        len = s->fill;
+        if (len > s->size - s->head)
+            len = s->size - s->head;
+        if (s->stats.direct && !flushing)
+            len -= len % ASYNC_IO_ALIGN;
+        if (!len)
+            continue;
+        /* an unaligned tail or seek ends direct I/O for good */
+        if (s->stats.direct && (len % ASYNC_IO_ALIGN ||
+                    s->pos % ASYNC_IO_ALIGN || s->head % ASYNC_IO_ALIGN))
+            set_direct(s, 0);
+        pthread_mutex_unlock(&s->lock);
+
+        /* the muxer never touches the filled part, write without the lock */
+        t0 = time_now_us();
+        ret = write_full(s->fd, s->ring + s->head, len);
+        dt = time_now_us() - t0;
+
+        pthread_mutex_lock(&s->lock);
+        if (ret < 0) {
+            fprintf(stderr, "async io: write failed: %s\n", strerror(errno));
+            s->error = errno;
+            s->fill = 0;
+        } else {
+            s->head = (s->head + len) % s->size;
+            s->fill -= len;
+            s->pos += len;
+            s->stats.bytes += len;
+            s->stats.nb_writes++;
+            if (dt > s->stats.write_max_us)
+                s->stats.write_max_us = dt;
+        }
+        pthread_cond_broadcast(&s->space);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+static int write_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    AsyncIO *s = opaque;
+    int left = buf_size;
+    int64_t t0;
+    int stalled = 0;
+
+    pthread_mutex_lock(&s->lock);
+    while (left > 0) {
+        int tail, n;
+
+        if (s->fill == s->size && !s->error) {
+            /* backpressure, the medium is slower than the stream */
+            if (!stalled) {
+                stalled = 1;
+                s->stats.nb_stalls++;
+            }
+            t0 = time_now_us();
+            pthread_cond_signal(&s->data);
+            while (s->fill == s->size && !s->error)
+                pthread_cond_wait(&s->space, &s->lock);
+            s->stats.stall_us += time_now_us() - t0;
+        }
+        if (s->error) {
+            pthread_mutex_unlock(&s->lock);
+            return AVERROR(EIO);
+        }
+
+        tail = (s->head + s->fill) % s->size;
+        n = s->size - s->fill;
+        if (n > s->size - tail)
+            n = s->size - tail;
+        if (n > left)
+            n = left;
+        pthread_mutex_unlock(&s->lock);
+
+        memcpy(s->ring + tail, buf, n);
+        buf += n;
+        left -= n;
+
+        pthread_mutex_lock(&s->lock);
+        s->fill += n;
+        if (s->fill > s->stats.fill_max)
+            s->stats.fill_max = s->fill;
+        if (s->fill >= ASYNC_IO_CHUNK)
+            pthread_cond_signal(&s->data);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return buf_size;
+}
+
+static int drain(AsyncIO *s)
+{
+    int ret;
+
+    pthread_mutex_lock(&s->lock);
+    s->flush = 1;
+    pthread_cond_signal(&s->data);
+    while (s->flush && !s->error)
+        pthread_cond_wait(&s->idle, &s->lock);
+    s->flush = 0;
+    ret = s->error ? -1 : 0;
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+static int64_t seek(void *opaque, int64_t offset, int whence)
+{
+    AsyncIO *s = opaque;
+    struct stat st;
+    off_t ret;
+
+    if (drain(s) < 0)
+        return -1;
+    if (whence == AVSEEK_SIZE)
+        return fstat(s->fd, &st) < 0 ? -1 : st.st_size;
+
+    ret = lseek(s->fd, offset, whence);
+    if (ret < 0)
+        return -1;
+    pthread_mutex_lock(&s->lock);
+    s->pos = ret;
+    s->stats.nb_seeks++;
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+AVIOContext *async_io_open_fd(int fd, int ring_size, int flags)
+{
+    AVIOContext *pb;
+    AsyncIO *s;
+    uint8_t *buffer;
+
+    s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+    s->fd = fd;
+    s->size = (ring_size + ASYNC_IO_CHUNK - 1) / ASYNC_IO_CHUNK * ASYNC_IO_CHUNK;
+    if (s->size < 2 * ASYNC_IO_CHUNK)
+        s->size = 2 * ASYNC_IO_CHUNK;
+    if (posix_memalign((void **)&s->ring, ASYNC_IO_ALIGN, s->size)) {
+        free(s);
+        return NULL;
+    }
+    if (flags & ASYNC_IO_DIRECT) {
+        set_direct(s, 1);
+        if (!s->stats.direct)
+            fprintf(stderr, "async io: no O_DIRECT here, using buffered "
+                    "writes\n");
+    }
+    s->pos = lseek(fd, 0, SEEK_CUR);
+    if (s->pos < 0)
+        s->pos = 0;
+
+    buffer = av_malloc(ASYNC_IO_AVIO_BUFFER);
+    pb = buffer ? avio_alloc_context(buffer, ASYNC_IO_AVIO_BUFFER, 1, s,
+            NULL, write_packet, seek) : NULL;
+    if (!pb) {
+        av_free(buffer);
+        free(s->ring);
+        free(s);
+        return NULL;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->space, NULL);
+    pthread_cond_init(&s->data, NULL);
+    pthread_cond_init(&s->idle, NULL);
+    if (pthread_create(&s->thread, NULL, writer_thread, s)) {
+        pthread_cond_destroy(&s->idle);
+        pthread_cond_destroy(&s->data);
+        pthread_cond_destroy(&s->space);
+        pthread_mutex_destroy(&s->lock);
+        av_free(pb->buffer);
+        av_free(pb);
+        free(s->ring);
+        free(s);
+        return NULL;
+    }
+
+    return pb;
+}
+
+AVIOContext *async_io_open(const char *filename, int ring_size, int flags)
+{
+    AVIOContext *pb;
+    int fd;
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+    pb = async_io_open_fd(fd, ring_size, flags);
+    if (!pb) {
+        close(fd);
+        return NULL;
+    }
+    ((AsyncIO *)pb->opaque)->own_fd = 1;
+    return pb;
+}
+
+int async_io_drain(AVIOContext *pb)
+{
+    avio_flush(pb);
+    return drain(pb->opaque);
+}
+
+void async_io_get_stats(AVIOContext *pb, AsyncIOStats *stats)
+{
+    AsyncIO *s = pb->opaque;
+
+    pthread_mutex_lock(&s->lock);
+    *stats = s->stats;
+    stats->fill = s->fill;
+    stats->ring_size = s->size;
+    pthread_mutex_unlock(&s->lock);
+}
+
+int async_io_close(AVIOContext *pb)
+{
+    AsyncIO *s;
+    int ret;
+
+    if (!pb)
+        return 0;
+    s = pb->opaque;
+    avio_flush(pb);
+
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_signal(&s->data);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    ret = s->error ? -1 : 0;
+
+    if (s->own_fd && close(s->fd) < 0)
+        ret = -1;
+
+    printf("async io: %llu bytes in %u writes (max %lld us), %s, "
+            "ring %d/%d KiB max, %u stalls (%lld us), %u seeks\n",
+            (unsigned long long)s->stats.bytes, s->stats.nb_writes,
+            (long long)s->stats.write_max_us,
+            s->stats.direct ? "O_DIRECT" : "buffered",
+            s->stats.fill_max >> 10, s->size >> 10, s->stats.nb_stalls,
+            (long long)s->stats.stall_us, s->stats.nb_seeks);
+
+    pthread_cond_destroy(&s->idle);
+    pthread_cond_destroy(&s->data);
+    pthread_cond_destroy(&s->space);
+    pthread_mutex_destroy(&s->lock);
+    free(s->ring);
+    free(s);
+    av_free(pb->buffer);
+    av_free(pb);
+    return ret;
+}
@@ -0,0 +1,67 @@
+/*
+ * Buffered muxer output drained by a writer thread
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+/* open with O_DIRECT, falling back to buffered writes where refused */
+#define ASYNC_IO_DIRECT     1
+
+#define ASYNC_IO_DEFAULT_RING   (4 * 1024 * 1024)
+
+typedef struct AsyncIOStats {
+    uint64_t bytes;             /* written to the file */
+    unsigned nb_writes;
+    int64_t write_max_us;       /* slowest single write() */
+    unsigned nb_stalls;         /* muxer writes that waited for space */
+    int64_t stall_us;           /* total time the muxer waited */
+    int fill;                   /* bytes in the ring right now */
+    int fill_max;               /* ring high-water mark in bytes */
+    int ring_size;
+    unsigned nb_seeks;
+    int direct;                 /* still writing with O_DIRECT */
+} AsyncIOStats;
+
+/**
+ * Create an AVIOContext for the muxer that copies everything into a ring
+ * of ring_size bytes. A writer thread drains the ring to the file in large
+ * aligned writes, so the muxing thread only blocks when the ring is full
+ * (counted as a stall). Seeks wait for the ring to drain first.
+ */
+AVIOContext *async_io_open(const char *filename, int ring_size, int flags);
+
+/* the same on an already open file descriptor, which stays open at close */
+AVIOContext *async_io_open_fd(int fd, int ring_size, int flags);
+
+/* wait until everything the muxer wrote so far is in the file */
+int async_io_drain(AVIOContext *pb);
+
+void async_io_get_stats(AVIOContext *pb, AsyncIOStats *stats);
+
+/* flush, stop the writer, print the stats and free pb */
+int async_io_close(AVIOContext *pb);
+
+#endif /* ASYNC_IO_H */
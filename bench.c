@@ -0,0 +1,286 @@
+/*
+ * Encoder benchmark sweep over a configuration matrix
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "channel.h"
+#include "cmem_acct.h"
+#include "frame_pool.h"
+#include "stats.h"
+#include "timeutil.h"
+
+#define BENCH_GOP_SIZE 12
+#define BENCH_FPS 25
+
+/* split the next comma separated item off *list into buf */
+static int next_item(const char **list, char *buf, int size)
+{
+    const char *p = *list;
+    int len = strcspn(p, ",");
+
+    if (!*p || len >= size)
+        return 0;
+    memcpy(buf, p, len);
+    buf[len] = 0;
+    *list = p[len] ? p + len + 1 : p + len;
+    return 1;
+}
+
+int bench_parse_matrix(const char *spec, BenchConfig *cfgs, int max_cfgs)
+{
+    char codecs[128], sizes[128], rates[128], item[32];
+    const char *c, *s, *r;
+    int n = 0;
+
+    if (sscanf(spec, "%127[^:]:%127[^:]:%127s", codecs, sizes, rates) != 3)
+        return -1;
+
+    for (c = codecs; next_item(&c, item, sizeof(item)); ) {
+        enum CodecID id = channel_codec_from_name(item);
+        char name[16];
+
+        if (id == CODEC_ID_NONE)
+            return -1;
+        snprintf(name, sizeof(name), "%.15s", item);
+        for (s = sizes; next_item(&s, item, sizeof(item)); ) {
+            int w, h;
+
+            if (sscanf(item, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0 ||
+                    (w | h) & 1)
+                return -1;
+            for (r = rates; next_item(&r, item, sizeof(item)); ) {
+                if (n == max_cfgs)
+                    return -1;
+                cfgs[n].codec_id = id;
+                memcpy(cfgs[n].codec_name, name, sizeof(name));
+                cfgs[n].width = w;
+                cfgs[n].height = h;
+                cfgs[n].bit_rate = atoi(item);
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+/* live CMEM bytes over all blocks, or their high-water marks */
+static size_t cmem_total(int peak)
+{
+    CmemAcctStats s;
+    size_t total = 0;
+    int i;
+
+    for (i = 0; cmem_acct_get_stats(i, &s) == 0; i++)
+        total += peak ? s.max_bytes : s.live_bytes;
+    return total;
+}
+
+static int bench_one(const BenchConfig *cfg, int warmup, int frames,
+        enum PatternType pattern, CMEM_AllocParams *outbuf_params,
+        BenchResult *res)
+{
+    AVCodecContext *c;
+    AVCodec *codec;
+    FramePool *pool = NULL;
+    AVFrame *picture = NULL;
+    uint8_t *outbuf = NULL;
+    int outbuf_size = 0;
+    StatsHistogram encode_hist;
+    StatsSummary s;
+    int64_t start = 0, t0;
+    size_t cmem_base;
+    int i, ret = -1;
+
+    memset(res, 0, sizeof(*res));
+    stats_histogram_init(&encode_hist);
+    /* the peak of this configuration alone, over what was held before */
+    cmem_acct_reset_peak();
+    cmem_base = cmem_total(0);
+
+    c = avcodec_alloc_context();
+    if (!c)
+        return -1;
+    c->codec_id = cfg->codec_id;
+    c->codec_type = AVMEDIA_TYPE_VIDEO;
+    c->bit_rate = cfg->bit_rate;
+    c->width = cfg->width;
+    c->height = cfg->height;
+    c->time_base.num = 1;
+    c->time_base.den = BENCH_FPS;
+    c->gop_size = BENCH_GOP_SIZE;
+
+    codec = avcodec_find_encoder(cfg->codec_id);
+    if (!codec) {
+        fprintf(stderr, "bench: %s encoder not found\n", cfg->codec_name);
+        goto out;
+    }
+    c->pix_fmt = PIX_FMT_NV12;
+    if (codec->pix_fmts && codec->pix_fmts[0] != -1)
+        c->pix_fmt = codec->pix_fmts[0];
+    if (!pattern_supported(c->pix_fmt) || avcodec_open(c, codec) < 0) {
+        fprintf(stderr, "bench: could not open %s at %dx%d\n",
+                cfg->codec_name, cfg->width, cfg->height);
+        goto out;
+    }
+
+    /* a pool of its own, freed again so configurations don't add up */
+    pool = frame_pool_create(c->pix_fmt, c->width, c->height, 1);
+    if (pool)
+        picture = frame_pool_get(pool);
+    outbuf_size = avpicture_get_size(c->pix_fmt, c->width, c->height);
+    outbuf = cmem_acct_alloc("bench outbuf", outbuf_size,
+            outbuf_params);
+    if (!picture || !outbuf) {
+        fprintf(stderr, "bench: could not allocate buffers\n");
+        goto out;
+    }
+
+    for (i = 0; i < warmup + frames; i++) {
+        int out_size;
+
+        if (i == warmup)
+            start = time_now_us();
+
+        pattern_fill(picture, c->pix_fmt, c->width, c->height, i, pattern);
+        frame_pool_sync_for_device(picture, FRAME_PLANES_ALL);
+
+        picture->pts = i;
+        t0 = time_now_us();
+        out_size = avcodec_encode_video(c, outbuf, outbuf_size, picture);
+        if (i >= warmup)
+            stats_histogram_record(&encode_hist, time_now_us() - t0);
+        if (out_size < 0) {
+            fprintf(stderr, "bench: encoding failed\n");
+            goto out;
+        }
+        if (i >= warmup)
+            res->bytes += out_size;
+    }
+
+    res->frames = frames;
+    t0 = time_now_us() - start;
+    if (t0 > 0) {
+        res->fps = frames * 1000000.0 / t0;
+        res->mpix_s = res->fps * cfg->width * cfg->height / 1000000.0;
+    }
+    stats_histogram_summary(&encode_hist, &s);
+    res->encode_mean_us = s.mean_us;
+    res->encode_p50_us = s.p50_us;
+    res->encode_p95_us = s.p95_us;
+    res->encode_p99_us = s.p99_us;
+    res->encode_max_us = s.max_us;
+    res->cmem_hwm = cmem_total(1) - cmem_base;
+    ret = 0;
+
+out:
+    if (c->codec)
+        avcodec_close(c);
+    av_free(c);
+    frame_pool_unref(picture);
+    frame_pool_destroy(pool);
+    cmem_acct_free(outbuf);
+    stats_histogram_destroy(&encode_hist);
+    res->failed = ret < 0;
+    return ret;
+}
+
+static void write_report(FILE *f, const BenchConfig *cfgs,
+        const BenchResult *res, int nb_cfgs, int warmup, int frames)
+{
+    int i;
+
+    fprintf(f, "{\n  \"warmup_frames\": %d,\n  \"frames\": %d,\n"
+            "  \"results\": [", warmup, frames);
+    for (i = 0; i < nb_cfgs; i++) {
+        const BenchConfig *cfg = &cfgs[i];
+        const BenchResult *r = &res[i];
+
+        fprintf(f, "%s\n    { \"codec\": \"%s\", \"width\": %d, "
+                "\"height\": %d, \"bit_rate\": %d, \"failed\": %s,\n"
+                "      \"fps\": %.2f, \"mpix_s\": %.2f, \"bytes\": %lld, "
+                "\"cmem_hwm\": %llu,\n"
+                "      \"encode_us\": { \"mean\": %lld, \"p50\": %lld, "
+                "\"p95\": %lld, \"p99\": %lld, \"max\": %lld } }",
+                i ? "," : "", cfg->codec_name, cfg->width, cfg->height,
+                cfg->bit_rate, r->failed ? "true" : "false", r->fps,
+                r->mpix_s, (long long)r->bytes,
+                (unsigned long long)r->cmem_hwm,
+                (long long)r->encode_mean_us, (long long)r->encode_p50_us,
+                (long long)r->encode_p95_us, (long long)r->encode_p99_us,
+                (long long)r->encode_max_us);
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+int bench_run(const BenchConfig *cfgs, int nb_cfgs, int warmup, int frames,
+        enum PatternType pattern, CMEM_AllocParams *outbuf_params,
+        const char *report_path)
+{
+    BenchResult *res;
+    FILE *f = stdout;
+    int i, failed = 0;
+
+    res = calloc(nb_cfgs, sizeof(*res));
+    if (!res)
+        return -1;
+
+    printf("%-6s %10s %9s %8s %8s %8s %8s %8s %10s %10s\n", "codec", "size",
+            "bitrate", "fps", "Mpix/s", "p50 us", "p99 us", "max us",
+            "bytes", "cmem");
+    for (i = 0; i < nb_cfgs; i++) {
+        const BenchConfig *cfg = &cfgs[i];
+        BenchResult *r = &res[i];
+        char size[16];
+
+        snprintf(size, sizeof(size), "%dx%d", cfg->width, cfg->height);
+        if (bench_one(cfg, warmup, frames, pattern, outbuf_params, r) < 0) {
+            printf("%-6s %10s %9d failed\n", cfg->codec_name, size,
+                    cfg->bit_rate);
+            failed++;
+            continue;
+        }
+        printf("%-6s %10s %9d %8.2f %8.2f %8lld %8lld %8lld %10lld %10llu\n",
+                cfg->codec_name, size, cfg->bit_rate, r->fps, r->mpix_s,
+                (long long)r->encode_p50_us, (long long)r->encode_p99_us,
+                (long long)r->encode_max_us, (long long)r->bytes,
+                (unsigned long long)r->cmem_hwm);
+    }
+
+    if (report_path) {
+        f = fopen(report_path, "w");
+        if (!f) {
+            fprintf(stderr, "bench: could not open '%s'\n", report_path);
+            free(res);
+            return -1;
+        }
+    }
+    write_report(f, cfgs, res, nb_cfgs, warmup, frames);
+    if (f != stdout)
+        fclose(f);
+
+    free(res);
+    return failed ? -1 : 0;
+}
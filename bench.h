@@ -0,0 +1,70 @@
+/*
+ * Encoder benchmark sweep over a configuration matrix
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <libavcodec/avcodec.h>
+
+#include "cmem.h"
+#include "pattern.h"
+
+#define BENCH_MAX_CONFIGS       64
+#define BENCH_WARMUP_FRAMES     10
+#define BENCH_FRAMES            100
+
+typedef struct BenchConfig {
+    enum CodecID codec_id;
+    char codec_name[16];
+    int width, height;
+    int bit_rate;
+} BenchConfig;
+
+typedef struct BenchResult {
+    int frames;
+    double fps;             /* picture preparation and encoding */
+    double mpix_s;
+    int64_t encode_mean_us;
+    int64_t encode_p50_us, encode_p95_us, encode_p99_us, encode_max_us;
+    int64_t bytes;
+    uint64_t cmem_hwm;      /* peak CMEM this configuration allocated */
+    int failed;
+} BenchResult;
+
+/**
+ * Expand "codecs:sizes:bitrates", each a comma separated list, into the
+ * cross product, e.g. "h264,mpeg4:640x480,1280x720:1000000,4000000" gives
+ * eight configurations. Returns their number or -1 on a parse error.
+ */
+int bench_parse_matrix(const char *spec, BenchConfig *cfgs, int max_cfgs);
+
+/**
+ * Encode warmup and then frames pictures for every configuration without
+ * writing a file, and write a JSON report to report_path (stdout if NULL).
+ * A table is printed to stdout in any case.
+ */
+int bench_run(const BenchConfig *cfgs, int nb_cfgs, int warmup, int frames,
+        enum PatternType pattern, CMEM_AllocParams *outbuf_params,
+        const char *report_path);
+
+#endif /* BENCH_H */
@@ -0,0 +1,196 @@
+/*
+ * Process wide Codec Engine and CMEM session
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifndef HOST_BUILD
+#include <xdc/std.h>
+#include <ti/sdo/ce/CERuntime.h>
+#include <ti/sdo/ce/Engine.h>
+#endif
+
+#include "cmem.h"
+#include "cmem_acct.h"
+#include "ce_session.h"
+#include "timeutil.h"
+
+#define MAX_ENGINES 4
+
+typedef struct SessionEngine {
+    char name[32];
+    void *handle;
+    int64_t open_us;
+} SessionEngine;
+
+static struct {
+    int initialized;
+    int result;
+    int64_t ce_init_us;
+    int64_t cmem_init_us;
+    SessionEngine engines[MAX_ENGINES];
+    int nb_engines;
+} session;
+
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int ce_session_init(void)
+{
+    int64_t t0;
+
+    pthread_mutex_lock(&session_lock);
+    if (session.initialized) {
+        pthread_mutex_unlock(&session_lock);
+        return session.result;
+    }
+    session.initialized = 1;
+
+    t0 = time_now_us();
+#ifndef HOST_BUILD
+    CERuntime_init();
+#endif
+    session.ce_init_us = time_now_us() - t0;
+
+    t0 = time_now_us();
+    session.result = CMEM_init();
+    session.cmem_init_us = time_now_us() - t0;
+    if (session.result < 0)
+        fprintf(stderr, "CMEM_init failed, is cmemk loaded?\n");
+
+    pthread_mutex_unlock(&session_lock);
+
+    /* whatever path the process takes out, tear down exactly once */
+    atexit(ce_session_exit);
+
+    return session.result;
+}
+
+static SessionEngine *find_engine(const char *name)
+{
+    int i;
+
+    for (i = 0; i < session.nb_engines; i++) {
+        if (!strcmp(session.engines[i].name, name))
+            return &session.engines[i];
+    }
+    return NULL;
+}
+
+int ce_session_open_engine(const char *name)
+{
+    SessionEngine *e;
+    int64_t t0;
+    int ret = 0;
+
+    if (ce_session_init() < 0)
+        return -1;
+
+    pthread_mutex_lock(&session_lock);
+    if (find_engine(name))
+        goto out;
+    if (session.nb_engines == MAX_ENGINES) {
+        ret = -1;
+        goto out;
+    }
+
+    e = &session.engines[session.nb_engines];
+    snprintf(e->name, sizeof(e->name), "%s", name);
+
+    t0 = time_now_us();
+#ifndef HOST_BUILD
+    {
+        Engine_Error ec;
+
+        e->handle = Engine_open(e->name, NULL, &ec);
+        if (!e->handle) {
+            fprintf(stderr, "could not open engine '%s' (%d)\n", name, ec);
+            ret = -1;
+            goto out;
+        }
+    }
+#endif
+    e->open_us = time_now_us() - t0;
+    session.nb_engines++;
+
+out:
+    pthread_mutex_unlock(&session_lock);
+    return ret;
+}
+
+void *ce_session_engine(const char *name)
+{
+    SessionEngine *e;
+    void *handle;
+
+    pthread_mutex_lock(&session_lock);
+    e = find_engine(name);
+    handle = e ? e->handle : NULL;
+    pthread_mutex_unlock(&session_lock);
+
+    return handle;
+}
+
+void ce_session_print_stats(void)
+{
+    int i;
+
+    pthread_mutex_lock(&session_lock);
+    printf("session init: CERuntime %lld us, CMEM %lld us\n",
+            (long long)session.ce_init_us, (long long)session.cmem_init_us);
+    for (i = 0; i < session.nb_engines; i++)
+        printf("session engine '%s': opened in %lld us\n",
+                session.engines[i].name,
+                (long long)session.engines[i].open_us);
+    pthread_mutex_unlock(&session_lock);
+}
+
+void ce_session_exit(void)
+{
+    int i;
+
+    pthread_mutex_lock(&session_lock);
+    if (!session.initialized) {
+        pthread_mutex_unlock(&session_lock);
+        return;
+    }
+
+    for (i = session.nb_engines - 1; i >= 0; i--) {
+#ifndef HOST_BUILD
+        Engine_close(session.engines[i].handle);
+#endif
+        session.engines[i].handle = NULL;
+    }
+    session.nb_engines = 0;
+
+    if (session.result == 0) {
+        cmem_acct_exit();
+        CMEM_exit();
+    }
+#ifndef HOST_BUILD
+    CERuntime_exit();
+#endif
+    session.initialized = 0;
+    pthread_mutex_unlock(&session_lock);
+}
@@ -0,0 +1,53 @@
+/*
+ * Process wide Codec Engine and CMEM session
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CE_SESSION_H
+#define CE_SESSION_H
+
+/*
+ * CERuntime and CMEM are initialized once per process and the engines
+ * from xdc.cfg are opened on first use and kept open until the session
+ * ends. Codecs opened through libavcodec then find their engine already
+ * running, so encode and decode jobs can follow each other (or run side
+ * by side) without tearing Codec Engine down in between.
+ */
+
+/* initialize CERuntime and CMEM, later calls only return the result */
+int ce_session_init(void);
+
+/**
+ * Open the named engine ("encode", "decode") once and keep the handle.
+ *
+ * @return 0 if the engine is open, -1 on failure
+ */
+int ce_session_open_engine(const char *name);
+
+/* opaque Engine_Handle of an open engine, NULL if not open */
+void *ce_session_engine(const char *name);
+
+/* close the engines, CMEM and CERuntime, safe to call more than once */
+void ce_session_exit(void);
+
+void ce_session_print_stats(void);
+
+#endif /* CE_SESSION_H */
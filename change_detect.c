@@ -0,0 +1,203 @@
+/*
+ * Static scene detection on the luma plane
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "change_detect.h"
+#include "swar.h"
+#include "timeutil.h"
+
+struct ChangeDetector {
+    ChangeConfig cfg;
+    int bw, bh;                 /* blocks per row and column */
+    int rows;                   /* rows compared per block */
+    int block_limit;            /* block SAD above which it changed */
+    uint8_t *ref;               /* the compared rows of the reference */
+    int ref_stride;
+    int have_ref;
+    int skipped;                /* frames skipped since the last change */
+    ChangeStats stats;
+};
+
+int change_parse(const char *spec, ChangeConfig *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->min_blocks = 1;
+    cfg->step = 2;
+    if (sscanf(spec, "%d:%d:%d:%d", &cfg->threshold, &cfg->min_blocks,
+                &cfg->step, &cfg->max_skip) < 1)
+        return -1;
+    if (cfg->threshold <= 0 || cfg->min_blocks <= 0 || cfg->step <= 0 ||
+            cfg->step > CHANGE_BLOCK || cfg->max_skip < 0)
+        return -1;
+    return 0;
+}
+
+ChangeDetector *change_open(const ChangeConfig *cfg, int width, int height)
+{
+    ChangeDetector *cd;
+
+    cd = calloc(1, sizeof(*cd));
+    if (!cd)
+        return NULL;
+    cd->cfg = *cfg;
+    cd->bw = width / CHANGE_BLOCK;
+    cd->bh = height / CHANGE_BLOCK;
+    cd->rows = (CHANGE_BLOCK + cfg->step - 1) / cfg->step;
+    cd->block_limit = cfg->threshold * cd->rows * CHANGE_BLOCK;
+    cd->ref_stride = cd->bw * CHANGE_BLOCK;
+    cd->ref = malloc(cd->ref_stride * cd->rows * cd->bh);
+    if (!cd->bw || !cd->bh || !cd->ref) {
+        free(cd->ref);
+        free(cd);
+        return NULL;
+    }
+    return cd;
+}
+
+/*
+ * Sum of |a - b| over the four lanes, accumulated as two 16 bit lanes.
+ * Even and odd bytes are spread to 16 bits so the subtraction can't borrow
+ * across lanes; the 0x0100 bias makes every difference positive and leaves
+ * bit 8 set where a >= b.
+ */
+static inline uint32_t sad_word(uint32_t a, uint32_t b)
+{
+    uint32_t de = ((a & 0x00ff00ffu) | 0x01000100u) - (b & 0x00ff00ffu);
+    uint32_t dd = (((a >> 8) & 0x00ff00ffu) | 0x01000100u) -
+        ((b >> 8) & 0x00ff00ffu);
+    uint32_t ne = ~de >> 8 & 0x00010001u;    /* 1 where a < b */
+    uint32_t nd = ~dd >> 8 & 0x00010001u;
+
+    return (((de ^ ne * 0xff) & 0x00ff00ffu) + ne) +
+        (((dd ^ nd * 0xff) & 0x00ff00ffu) + nd);
+}
+
+/*
+ * SAD of one block against the reference. 16 compared rows of 4 words add
+ * at most 16 * 4 * 2 * 255 to a 16 bit lane, no overflow.
+ */
+static int block_sad(ChangeDetector *cd, const uint8_t *y, int linesize,
+        uint8_t *ref)
+{
+    uint32_t acc = 0;
+    int r, x;
+
+    for (r = 0; r < cd->rows; r++) {
+        const uint8_t *src = y + r * cd->cfg.step * linesize;
+        int aligned = swar_aligned(src);
+
+        for (x = 0; x < CHANGE_BLOCK; x += 4)
+            acc += sad_word(swar_load(src + x, aligned),
+                    swar_load(ref + x, 1));
+        ref += cd->ref_stride;
+    }
+    return (acc & 0xffff) + (acc >> 16);
+}
+
+static void copy_ref(ChangeDetector *cd, const uint8_t *y, int linesize)
+{
+    int by, r;
+
+    for (by = 0; by < cd->bh; by++) {
+        for (r = 0; r < cd->rows; r++) {
+            memcpy(cd->ref + (by * cd->rows + r) * cd->ref_stride,
+                    y + (by * CHANGE_BLOCK + r * cd->cfg.step) * linesize,
+                    cd->ref_stride);
+        }
+    }
+    cd->have_ref = 1;
+}
+
+int change_detect(ChangeDetector *cd, const uint8_t *y, int linesize)
+{
+    int64_t t0, dt;
+    int bx, by, changed = 0;
+
+    t0 = time_now_us();
+    cd->stats.nb_frames++;
+    if (!cd->have_ref) {
+        changed = cd->cfg.min_blocks;
+    } else {
+        /* blocks are visited on a grid step blocks apart horizontally,
+           shifted every frame so that each block is looked at in turn */
+        for (by = 0; by < cd->bh && changed < cd->cfg.min_blocks; by++) {
+            const uint8_t *row = y + by * CHANGE_BLOCK * linesize;
+            uint8_t *ref = cd->ref + by * cd->rows * cd->ref_stride;
+
+            for (bx = (by + cd->stats.nb_frames) % cd->cfg.step; bx < cd->bw;
+                    bx += cd->cfg.step) {
+                if (block_sad(cd, row + bx * CHANGE_BLOCK, linesize,
+                            ref + bx * CHANGE_BLOCK) > cd->block_limit &&
+                        ++changed >= cd->cfg.min_blocks)
+                    break;
+            }
+        }
+    }
+
+    if (changed < cd->cfg.min_blocks) {
+        cd->stats.nb_unchanged++;
+        if (!cd->cfg.max_skip || cd->skipped < cd->cfg.max_skip) {
+            cd->skipped++;
+            changed = 0;
+        } else {
+            cd->stats.nb_forced++;
+            changed = 1;
+        }
+    }
+    if (changed) {
+        copy_ref(cd, y, linesize);
+        cd->skipped = 0;
+    }
+
+    dt = time_now_us() - t0;
+    cd->stats.detect_total_us += dt;
+    if (dt > cd->stats.detect_max_us)
+        cd->stats.detect_max_us = dt;
+
+    return changed != 0;
+}
+
+void change_get_stats(ChangeDetector *cd, ChangeStats *stats)
+{
+    *stats = cd->stats;
+}
+
+void change_close(ChangeDetector *cd)
+{
+    ChangeStats s;
+
+    if (!cd)
+        return;
+    s = cd->stats;
+    printf("change detection: %u of %u frames unchanged, %u skipped, "
+            "%u forced, detect %lld us avg / %lld us max\n",
+            s.nb_unchanged, s.nb_frames, s.nb_unchanged - s.nb_forced,
+            s.nb_forced,
+            (long long)(s.nb_frames ? s.detect_total_us / s.nb_frames : 0),
+            (long long)s.detect_max_us);
+    free(cd->ref);
+    free(cd);
+}
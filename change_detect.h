@@ -0,0 +1,69 @@
+/*
+ * Static scene detection on the luma plane
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CHANGE_DETECT_H
+#define CHANGE_DETECT_H
+
+#include <stdint.h>
+
+/* side of the square blocks compared */
+#define CHANGE_BLOCK 16
+
+typedef struct ChangeConfig {
+    int threshold;              /* mean absolute difference per pixel */
+    int min_blocks;             /* changed blocks that make a changed frame */
+    int step;                   /* compare every step-th row and block column */
+    int max_skip;               /* frames skipped in a row at most, 0 no limit */
+} ChangeConfig;
+
+typedef struct ChangeStats {
+    unsigned nb_frames;
+    unsigned nb_unchanged;
+    unsigned nb_forced;         /* unchanged, but max_skip was reached */
+    int64_t detect_total_us;
+    int64_t detect_max_us;
+} ChangeStats;
+
+typedef struct ChangeDetector ChangeDetector;
+
+/* parse "threshold[:min_blocks[:step[:max_skip]]]" */
+int change_parse(const char *spec, ChangeConfig *cfg);
+
+/* width and height are multiples of CHANGE_BLOCK, the rest is ignored */
+ChangeDetector *change_open(const ChangeConfig *cfg, int width, int height);
+
+/**
+ * Compare the luma plane with the last frame that was reported changed.
+ * The comparison is a per block sum of absolute differences, four pixels
+ * at a time. A changed frame becomes the new reference.
+ *
+ * @return 1 if the frame should be encoded, 0 if it can be skipped
+ */
+int change_detect(ChangeDetector *cd, const uint8_t *y, int linesize);
+
+void change_get_stats(ChangeDetector *cd, ChangeStats *stats);
+
+/* print the stats and free cd */
+void change_close(ChangeDetector *cd);
+
+#endif /* CHANGE_DETECT_H */
@@ -0,0 +1,361 @@
+/*
+ * Concurrent encoding of independent channels
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <libavformat/avformat.h>
+
+#include "accel_sched.h"
+#include "channel.h"
+#include "cmem_acct.h"
+#include "frame_pool.h"
+#include "stats.h"
+#include "timeutil.h"
+
+/* accelerator group of each encoder, as registered in xdc.cfg */
+static const struct {
+    const char *name;
+    enum CodecID id;
+    int group;
+} channel_codecs[] = {
+    { "h264",  CODEC_ID_H264,  1 },     /* h264enc */
+    { "mpeg4", CODEC_ID_MPEG4, 1 },     /* mpeg4enc */
+    { "mjpeg", CODEC_ID_MJPEG, 1 },     /* jpegenc1 */
+};
+
+#define NB_CODECS (sizeof(channel_codecs) / sizeof(channel_codecs[0]))
+
+typedef struct Channel {
+    int index;
+    const ChannelConfig *cfg;
+    int group;
+    AVFormatContext *oc;
+    int header_written;         /* a trailer is owed */
+    AVStream *st;
+    AVFrame *picture;
+    uint8_t *outbuf;
+    int outbuf_size;
+    CMEM_AllocParams *outbuf_params;
+    enum PatternType pattern;
+    int nb_frames;
+    pthread_t thread;
+    int failed;
+    /* stats */
+    int frames_done;
+    int frames_late;        /* started more than a frame period late */
+    int64_t elapsed_us;
+    int64_t encode_us;
+    int64_t accel_wait_us;
+    int64_t bytes;
+} Channel;
+
+enum CodecID channel_codec_from_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NB_CODECS; i++) {
+        if (!strcmp(name, channel_codecs[i].name))
+            return channel_codecs[i].id;
+    }
+    return CODEC_ID_NONE;
+}
+
+int channel_parse(const char *spec, ChannelConfig *cfg)
+{
+    char codec[16];
+    int n = -1;
+
+    memset(cfg, 0, sizeof(*cfg));
+    if (sscanf(spec, "%15[^:]:%dx%d:%d:%d:%n", codec, &cfg->width,
+                &cfg->height, &cfg->fps, &cfg->bit_rate, &n) < 5 || n < 0 ||
+            !spec[n])
+        return -1;
+    snprintf(cfg->filename, sizeof(cfg->filename), "%s", spec + n);
+
+    cfg->codec_id = channel_codec_from_name(codec);
+    if (cfg->codec_id == CODEC_ID_NONE || cfg->width <= 0 ||
+            cfg->height <= 0 || (cfg->width | cfg->height) & 1 ||
+            cfg->fps <= 0)
+        return -1;
+
+    cfg->gop_size = cfg->fps;
+    return 0;
+}
+
+static int codec_group(enum CodecID id)
+{
+    int i;
+
+    for (i = 0; i < NB_CODECS; i++) {
+        if (channel_codecs[i].id == id)
+            return channel_codecs[i].group;
+    }
+    return 0;
+}
+
+static int channel_open(Channel *ch)
+{
+    const ChannelConfig *cfg = ch->cfg;
+    AVOutputFormat *fmt;
+    AVCodecContext *c;
+    AVCodec *codec;
+
+    fmt = av_guess_format(NULL, cfg->filename, NULL);
+    if (!fmt) {
+        fprintf(stderr, "channel %d: no format for '%s'\n", ch->index,
+                cfg->filename);
+        return -1;
+    }
+    ch->oc = avformat_alloc_context();
+    if (!ch->oc)
+        return -1;
+    ch->oc->oformat = fmt;
+    snprintf(ch->oc->filename, sizeof(ch->oc->filename), "%s", cfg->filename);
+
+    ch->st = av_new_stream(ch->oc, 0);
+    if (!ch->st)
+        return -1;
+
+    c = ch->st->codec;
+    c->codec_id = cfg->codec_id;
+    c->codec_type = AVMEDIA_TYPE_VIDEO;
+    c->bit_rate = cfg->bit_rate;
+    c->width = cfg->width;
+    c->height = cfg->height;
+    c->time_base.num = 1;
+    c->time_base.den = cfg->fps;
+    c->gop_size = cfg->gop_size;
+    if (fmt->flags & AVFMT_GLOBALHEADER)
+        c->flags |= CODEC_FLAG_GLOBAL_HEADER;
+
+    codec = avcodec_find_encoder(c->codec_id);
+    if (!codec) {
+        fprintf(stderr, "channel %d: codec not found\n", ch->index);
+        return -1;
+    }
+    c->pix_fmt = PIX_FMT_NV12;
+    if (codec->pix_fmts && codec->pix_fmts[0] != -1)
+        c->pix_fmt = codec->pix_fmts[0];
+    if (!pattern_supported(c->pix_fmt)) {
+        fprintf(stderr, "channel %d: can't draw pixel format %d\n",
+                ch->index, c->pix_fmt);
+        return -1;
+    }
+
+    if (avcodec_open(c, codec) < 0) {
+        fprintf(stderr, "channel %d: could not open codec\n", ch->index);
+        return -1;
+    }
+    ch->group = codec_group(c->codec_id);
+
+    /* channels of the same size share a pool with a frame for each */
+    if (!frame_pool_find(c->pix_fmt, c->width, c->height))
+        frame_pool_create(c->pix_fmt, c->width, c->height, CHANNEL_MAX);
+    ch->picture = frame_pool_alloc(c->pix_fmt, c->width, c->height);
+    ch->outbuf_size = avpicture_get_size(c->pix_fmt, c->width, c->height);
+    ch->outbuf = cmem_acct_alloc("channel outbuf", ch->outbuf_size,
+            ch->outbuf_params);
+    if (!ch->picture || !ch->outbuf) {
+        fprintf(stderr, "channel %d: could not allocate buffers\n", ch->index);
+        return -1;
+    }
+
+    av_dump_format(ch->oc, ch->index, cfg->filename, 1);
+
+    if (!(fmt->flags & AVFMT_NOFILE) &&
+            avio_open(&ch->oc->pb, cfg->filename, URL_WRONLY) < 0) {
+        fprintf(stderr, "channel %d: could not open '%s'\n", ch->index,
+                cfg->filename);
+        return -1;
+    }
+    if (avformat_write_header(ch->oc, NULL) < 0) {
+        fprintf(stderr, "channel %d: could not write the header\n", ch->index);
+        return -1;
+    }
+    ch->header_written = 1;
+
+    return 0;
+}
+
+static void channel_close(Channel *ch)
+{
+    unsigned i;
+
+    if (!ch->oc)
+        return;
+    /* AVFMT_NOFILE muxers have no pb but still want their trailer */
+    if (ch->header_written)
+        av_write_trailer(ch->oc);
+    if (ch->oc->pb && !(ch->oc->oformat->flags & AVFMT_NOFILE))
+        avio_close(ch->oc->pb);
+    if (ch->st && ch->st->codec->codec)
+        avcodec_close(ch->st->codec);
+    frame_pool_unref(ch->picture);
+    cmem_acct_free(ch->outbuf);
+
+    for (i = 0; i < ch->oc->nb_streams; i++) {
+        av_freep(&ch->oc->streams[i]->codec);
+        av_freep(&ch->oc->streams[i]);
+    }
+    av_free(ch->oc);
+    ch->oc = NULL;
+}
+
+static void *channel_thread(void *arg)
+{
+    Channel *ch = arg;
+    AVCodecContext *c = ch->st->codec;
+    int64_t period = 1000000 / ch->cfg->fps;
+    int64_t start = time_now_us();
+    int n;
+
+    for (n = 0; n < ch->nb_frames; n++) {
+        int64_t due = start + n * period;
+        int64_t now = time_now_us();
+        int64_t t0, acquired;
+        int out_size;
+
+        /* pace to the target rate, never sleep to catch up */
+        if (now < due)
+            usleep(due - now);
+        else if (now - due > period)
+            ch->frames_late++;
+
+        pattern_fill(ch->picture, c->pix_fmt, c->width, c->height, n,
+                ch->pattern);
+        frame_pool_sync_for_device(ch->picture, FRAME_PLANES_ALL);
+
+        t0 = time_now_us();
+        acquired = accel_acquire(ch->group);
+        ch->accel_wait_us += acquired - t0;
+        ch->picture->pts = n;
+        out_size = avcodec_encode_video(c, ch->outbuf, ch->outbuf_size,
+                ch->picture);
+        accel_release(ch->group, acquired);
+        ch->encode_us += stats_lap(STATS_ENCODE, acquired) - acquired;
+
+        if (out_size < 0) {
+            fprintf(stderr, "channel %d: encoding failed\n", ch->index);
+            ch->failed = 1;
+            break;
+        }
+        if (out_size > 0) {
+            AVPacket pkt;
+
+            if (ch->outbuf_params->flags == CMEM_CACHED)
+                CMEM_cacheInv(ch->outbuf, out_size);
+
+            av_init_packet(&pkt);
+            if (c->coded_frame->pts != AV_NOPTS_VALUE)
+                pkt.pts = av_rescale_q(c->coded_frame->pts, c->time_base,
+                        ch->st->time_base);
+            if (c->coded_frame->key_frame)
+                pkt.flags |= AV_PKT_FLAG_KEY;
+            pkt.stream_index = ch->st->index;
+            pkt.data = ch->outbuf;
+            pkt.size = out_size;
+
+            if (av_interleaved_write_frame(ch->oc, &pkt) != 0) {
+                fprintf(stderr, "channel %d: write failed\n", ch->index);
+                ch->failed = 1;
+                break;
+            }
+            ch->bytes += out_size;
+        }
+        ch->frames_done++;
+    }
+
+    ch->elapsed_us = time_now_us() - start;
+    return NULL;
+}
+
+static void channel_print_stats(const Channel *ch)
+{
+    const ChannelConfig *cfg = ch->cfg;
+    double fps = ch->elapsed_us ?
+            ch->frames_done * 1000000.0 / ch->elapsed_us : 0;
+    int n = ch->frames_done ? ch->frames_done : 1;
+
+    printf("channel %d %dx%d -> %s: %d frames, %.2f fps (target %d, %d%%), "
+            "%d late, encode %lld us avg, accelerator wait %lld us avg, "
+            "%lld kbit/s\n", ch->index, cfg->width, cfg->height,
+            cfg->filename, ch->frames_done, fps, cfg->fps,
+            (int)(fps * 100 / cfg->fps), ch->frames_late,
+            (long long)(ch->encode_us / n), (long long)(ch->accel_wait_us / n),
+            (long long)(ch->elapsed_us ?
+                    ch->bytes * 8000 / ch->elapsed_us : 0));
+}
+
+int channels_run(const ChannelConfig *cfgs, int nb_channels, double duration,
+        enum PatternType pattern, CMEM_AllocParams *outbuf_params)
+{
+    Channel channels[CHANNEL_MAX];
+    int i, started = 0, ret = 0;
+
+    if (nb_channels > CHANNEL_MAX)
+        nb_channels = CHANNEL_MAX;
+    memset(channels, 0, sizeof(channels));
+
+    /* codecs are opened one by one, only encoding runs concurrently */
+    for (i = 0; i < nb_channels; i++) {
+        Channel *ch = &channels[i];
+
+        ch->index = i;
+        ch->cfg = &cfgs[i];
+        ch->outbuf_params = outbuf_params;
+        ch->pattern = pattern;
+        ch->nb_frames = (int)(duration * cfgs[i].fps);
+        if (channel_open(ch) < 0) {
+            ret = -1;
+            goto out;
+        }
+    }
+
+    for (i = 0; i < nb_channels; i++) {
+        if (pthread_create(&channels[i].thread, NULL, channel_thread,
+                    &channels[i])) {
+            fprintf(stderr, "channel %d: could not start thread\n", i);
+            ret = -1;
+            break;
+        }
+        started++;
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(channels[i].thread, NULL);
+        if (channels[i].failed)
+            ret = -1;
+    }
+
+    for (i = 0; i < started; i++)
+        channel_print_stats(&channels[i]);
+    accel_print_stats();
+
+out:
+    for (i = 0; i < nb_channels; i++)
+        channel_close(&channels[i]);
+    return ret;
+}
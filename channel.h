@@ -0,0 +1,62 @@
+/*
+ * Concurrent encoding of independent channels
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <libavcodec/avcodec.h>
+
+#include "cmem.h"
+#include "pattern.h"
+
+#define CHANNEL_MAX 4
+
+typedef struct ChannelConfig {
+    enum CodecID codec_id;
+    int width, height;
+    int fps;                /* target frame rate */
+    int bit_rate;
+    int gop_size;
+    char filename[256];     /* container is guessed from the name */
+} ChannelConfig;
+
+/**
+ * Parse "codec:WIDTHxHEIGHT:fps:bitrate:file", codec being h264, mpeg4
+ * or mjpeg, e.g. "h264:1280x720:25:2000000:main.avi" or, for periodic
+ * stills through the image2 muxer, "mjpeg:640x480:1:0:still%04d.jpg".
+ */
+int channel_parse(const char *spec, ChannelConfig *cfg);
+
+/* CODEC_ID_NONE unless name is one of the dm365 encoders above */
+enum CodecID channel_codec_from_name(const char *name);
+
+/**
+ * Encode all channels concurrently for duration seconds, one thread per
+ * channel paced to its frame rate. Encoder calls are serialized per
+ * accelerator group (accel_sched.h). Prints achieved against target fps
+ * for every channel.
+ */
+int channels_run(const ChannelConfig *cfgs, int nb_channels, double duration,
+        enum PatternType pattern, CMEM_AllocParams *outbuf_params);
+
+#endif /* CHANNEL_H */
@@ -0,0 +1,219 @@
+/*
+ * Accounting of CMEM allocations
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "cmem_acct.h"
+
+typedef struct CmemAlloc {
+    void *ptr;
+    size_t size;
+    int blockid;
+    int poolid;                 /* -1 for the heap */
+    CMEM_AllocParams params;    /* as allocated, CMEM_free() wants them */
+    const char *owner;
+    const char *file;
+    int line;
+    struct CmemAlloc *next;
+} CmemAlloc;
+
+static CmemAlloc *allocs;
+static CmemAcctStats blocks[CMEM_ACCT_MAX_BLOCKS];
+static int have_attrs[CMEM_ACCT_MAX_BLOCKS];
+static pthread_mutex_t acct_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static CmemAcctStats *get_block_locked(int blockid)
+{
+    CMEM_BlockAttrs attrs;
+
+    if (blockid < 0 || blockid >= CMEM_ACCT_MAX_BLOCKS)
+        return NULL;
+    /* CMEM is initialized by the time anything is allocated */
+    if (!have_attrs[blockid]) {
+        if (CMEM_getBlockAttrs(blockid, &attrs) == 0)
+            blocks[blockid].block_size = attrs.size;
+        have_attrs[blockid] = 1;
+    }
+    return &blocks[blockid];
+}
+
+void *cmem_acct_alloc_at(const char *owner, int blockid, int poolid,
+        size_t size, CMEM_AllocParams *params, const char *file, int line)
+{
+    CmemAcctStats *b;
+    CmemAlloc *a;
+    void *ptr;
+
+    a = malloc(sizeof(*a));
+    if (!a)
+        return NULL;
+
+    if (poolid >= 0)
+        ptr = CMEM_allocPool2(blockid, poolid, params);
+    else
+        ptr = CMEM_alloc2(blockid, size, params);
+
+    pthread_mutex_lock(&acct_lock);
+    b = get_block_locked(blockid);
+    if (!ptr) {
+        if (b)
+            b->nb_alloc_failed++;
+        pthread_mutex_unlock(&acct_lock);
+        free(a);
+        return NULL;
+    }
+
+    a->ptr = ptr;
+    a->size = size;
+    a->blockid = blockid;
+    a->poolid = poolid;
+    a->params = params ? *params : CMEM_DEFAULTPARAMS;
+    a->owner = owner;
+    a->file = file;
+    a->line = line;
+    a->next = allocs;
+    allocs = a;
+
+    if (b) {
+        b->nb_alloc++;
+        b->live_bytes += size;
+        if (b->live_bytes > b->max_bytes)
+            b->max_bytes = b->live_bytes;
+        if (++b->live_allocs > b->max_allocs)
+            b->max_allocs = b->live_allocs;
+    }
+    pthread_mutex_unlock(&acct_lock);
+
+    return ptr;
+}
+
+int cmem_acct_free(void *ptr)
+{
+    CmemAlloc **pa, *a;
+    CmemAcctStats *b;
+    int ret;
+
+    if (!ptr)
+        return 0;
+
+    pthread_mutex_lock(&acct_lock);
+    for (pa = &allocs; *pa && (*pa)->ptr != ptr; pa = &(*pa)->next)
+        ;
+    a = *pa;
+    if (!a) {
+        blocks[0].nb_unknown_free++;
+        pthread_mutex_unlock(&acct_lock);
+        fprintf(stderr, "cmem: free of unknown buffer %p\n", ptr);
+        return -1;
+    }
+    *pa = a->next;
+    b = get_block_locked(a->blockid);
+    if (b) {
+        b->nb_free++;
+        b->live_bytes -= a->size;
+        b->live_allocs--;
+    }
+    pthread_mutex_unlock(&acct_lock);
+
+    ret = CMEM_free(ptr, &a->params);
+    free(a);
+    return ret;
+}
+
+int cmem_acct_get_stats(int blockid, CmemAcctStats *stats)
+{
+    CmemAcctStats *b;
+
+    pthread_mutex_lock(&acct_lock);
+    b = get_block_locked(blockid);
+    if (b)
+        *stats = *b;
+    pthread_mutex_unlock(&acct_lock);
+
+    return b ? 0 : -1;
+}
+
+void cmem_acct_reset_peak(void)
+{
+    int i;
+
+    pthread_mutex_lock(&acct_lock);
+    for (i = 0; i < CMEM_ACCT_MAX_BLOCKS; i++) {
+        blocks[i].max_bytes = blocks[i].live_bytes;
+        blocks[i].max_allocs = blocks[i].live_allocs;
+    }
+    pthread_mutex_unlock(&acct_lock);
+}
+
+void cmem_acct_print_stats(void)
+{
+    CmemAcctStats s;
+    int i;
+
+    for (i = 0; i < CMEM_ACCT_MAX_BLOCKS; i++) {
+        if (cmem_acct_get_stats(i, &s) < 0 || (!s.nb_alloc && !s.block_size))
+            continue;
+        printf("cmem block %d: %zu bytes, live %zu in %d buffers, "
+                "max %zu in %d buffers (%d%% of the block), "
+                "%u allocs (%u failed), %u frees\n", i, s.block_size,
+                s.live_bytes, s.live_allocs, s.max_bytes, s.max_allocs,
+                s.block_size ? (int)((uint64_t)s.max_bytes * 100 /
+                        s.block_size) : 0,
+                s.nb_alloc, s.nb_alloc_failed, s.nb_free);
+        if (s.nb_unknown_free)
+            printf("    %u frees of unknown buffers\n", s.nb_unknown_free);
+    }
+}
+
+void cmem_acct_dump(void)
+{
+    CmemAlloc *a;
+
+    pthread_mutex_lock(&acct_lock);
+    for (a = allocs; a; a = a->next) {
+        char where[16] = "heap";
+
+        if (a->poolid >= 0)
+            snprintf(where, sizeof(where), "pool %d", a->poolid);
+        fprintf(stderr, "cmem: %zu bytes in block %d %s still held by %s, "
+                "allocated at %s:%d\n", a->size, a->blockid, where,
+                a->owner, a->file, a->line);
+    }
+    pthread_mutex_unlock(&acct_lock);
+}
+
+void cmem_acct_exit(void)
+{
+    CmemAlloc *a;
+
+    pthread_mutex_lock(&acct_lock);
+    a = allocs;
+    pthread_mutex_unlock(&acct_lock);
+    if (!a)
+        return;
+
+    fprintf(stderr, "cmem: buffers outstanding at exit\n");
+    cmem_acct_dump();
+}
@@ -0,0 +1,80 @@
+/*
+ * Accounting of CMEM allocations
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CMEM_ACCT_H
+#define CMEM_ACCT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cmem.h"
+
+/* blocks accounted separately, cmemk has block 0 and 1 on the dm365 */
+#define CMEM_ACCT_MAX_BLOCKS    2
+
+typedef struct CmemAcctStats {
+    size_t block_size;          /* from CMEM_getBlockAttrs(), 0 if unknown */
+    size_t live_bytes;
+    size_t max_bytes;           /* high-water mark of live_bytes */
+    int live_allocs;
+    int max_allocs;
+    unsigned nb_alloc;
+    unsigned nb_alloc_failed;
+    unsigned nb_free;
+    unsigned nb_unknown_free;   /* pointers this module never handed out */
+} CmemAcctStats;
+
+/*
+ * Every CMEM buffer of the application is allocated and freed through
+ * these. The owner tag, size, block, parameters and call site are kept
+ * with the buffer, so freeing needs nothing but the pointer.
+ */
+#define cmem_acct_alloc(owner, size, params) \
+    cmem_acct_alloc_at(owner, 0, -1, size, params, __FILE__, __LINE__)
+
+/* a buffer of poolid in blockid, size is what the caller needs of it */
+#define cmem_acct_alloc_pool(owner, blockid, poolid, size, params) \
+    cmem_acct_alloc_at(owner, blockid, poolid, size, params, \
+            __FILE__, __LINE__)
+
+void *cmem_acct_alloc_at(const char *owner, int blockid, int poolid,
+        size_t size, CMEM_AllocParams *params, const char *file, int line);
+
+/* free a buffer from cmem_acct_alloc*(), NULL is ignored */
+int cmem_acct_free(void *ptr);
+
+/* -1 for a block that does not exist */
+int cmem_acct_get_stats(int blockid, CmemAcctStats *stats);
+
+void cmem_acct_print_stats(void);
+
+/* restart the high-water marks of all blocks from the live figures */
+void cmem_acct_reset_peak(void);
+
+/* print every buffer not freed yet with its owner and call site */
+void cmem_acct_dump(void);
+
+/* called before CMEM_exit(): dump what is still allocated */
+void cmem_acct_exit(void);
+
+#endif /* CMEM_ACCT_H */
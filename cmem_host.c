@@ -0,0 +1,774 @@
+/*
+ * CMEM emulation for host builds
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "cmem.h"
+#include "cmem_host.h"
+
+#define HOST_PAGE_SIZE      4096
+#define HOST_MAX_POOLS      32
+
+/* default layout when CMEM_HOST_ARGS is not set: a 64 MB heap */
+#define HOST_DEFAULT_ARGS   "phys_start=0x84000000 phys_end=0x88000000"
+
+typedef struct HostBuf {
+    size_t offset;              /* from the start of the block */
+    size_t size;
+    int pool;                   /* -1 for heap buffers */
+    int refcount;               /* allocation plus registrations */
+    int allocated;
+    struct HostBuf *next;       /* pool free list or heap allocation list */
+} HostBuf;
+
+typedef struct HostPool {
+    size_t size;                /* buffer size rounded up to a page */
+    int count;
+    size_t offset;              /* first buffer */
+    HostBuf *bufs;
+    HostBuf *free_list;
+} HostPool;
+
+typedef struct HeapChunk {
+    size_t offset;
+    size_t size;
+    struct HeapChunk *next;
+} HeapChunk;
+
+typedef struct HostBlock {
+    unsigned long phys_start;
+    unsigned long phys_end;
+    uint8_t *base;
+    size_t size;
+    HostPool pools[HOST_MAX_POOLS];
+    int nb_pools;
+    size_t heap_offset;
+    HeapChunk *heap_free;       /* sorted by offset, neighbours coalesced */
+    HostBuf *heap_allocs;
+    CMEM_HostStats stats;
+} HostBlock;
+
+CMEM_AllocParams CMEM_DEFAULTPARAMS = {
+    CMEM_POOL,
+    CMEM_NONCACHED,
+    1,
+};
+
+static HostBlock blocks[CMEM_HOST_MAX_BLOCKS];
+static int nb_blocks;
+static int init_count;
+static pthread_mutex_t host_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t page_align(size_t size)
+{
+    return (size + HOST_PAGE_SIZE - 1) & ~(size_t)(HOST_PAGE_SIZE - 1);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void account_alloc(HostBlock *b, uint64_t t0, int ok)
+{
+    uint64_t dt = now_ns() - t0;
+
+    if (!ok) {
+        b->stats.nb_alloc_failed++;
+        return;
+    }
+    b->stats.nb_alloc++;
+    b->stats.alloc_ns_total += dt;
+    if (dt > b->stats.alloc_ns_max)
+        b->stats.alloc_ns_max = dt;
+}
+
+/*
+ * Parse "pools=NxSIZE,..." "phys_start=0x..." "phys_end=0x..." and their
+ * _1 variants for the second block.
+ */
+static int parse_args(const char *args, const char *pools[CMEM_HOST_MAX_BLOCKS])
+{
+    char *copy, *tok, *save;
+    int ret = 0;
+
+    copy = strdup(args);
+    if (!copy)
+        return -1;
+
+    for (tok = strtok_r(copy, " \t\n", &save); tok;
+            tok = strtok_r(NULL, " \t\n", &save)) {
+        char *val = strchr(tok, '=');
+        int id = 0;
+        size_t klen;
+
+        if (!val) {
+            ret = -1;
+            break;
+        }
+        klen = val - tok;
+        val++;
+        if (klen > 2 && !strncmp(tok + klen - 2, "_1", 2)) {
+            id = 1;
+            klen -= 2;
+        }
+
+        if (klen == 5 && !strncmp(tok, "pools", 5)) {
+            pools[id] = args + (val - copy);
+        } else if (klen == 10 && !strncmp(tok, "phys_start", 10)) {
+            blocks[id].phys_start = strtoul(val, NULL, 16);
+        } else if (klen == 8 && !strncmp(tok, "phys_end", 8)) {
+            blocks[id].phys_end = strtoul(val, NULL, 16);
+        } else {
+            ret = -1;
+            break;
+        }
+        if (id + 1 > nb_blocks)
+            nb_blocks = id + 1;
+    }
+    if (ret < 0)
+        fprintf(stderr, "CMEM host: bad argument '%s'\n", tok);
+
+    free(copy);
+    return ret;
+}
+
+static int setup_pools(HostBlock *b, const char *spec)
+{
+    size_t offset = 0;
+
+    while (spec && *spec && *spec != ' ' && *spec != '\t' && *spec != '\n') {
+        HostPool *p;
+        char *end;
+        int count, i;
+        size_t size;
+
+        count = strtol(spec, &end, 10);
+        if (*end != 'x' || count <= 0 || b->nb_pools == HOST_MAX_POOLS)
+            return -1;
+        size = strtoul(end + 1, &end, 10);
+        if (!size)
+            return -1;
+
+        p = &b->pools[b->nb_pools++];
+        p->size = page_align(size);
+        p->count = count;
+        p->offset = offset;
+        p->bufs = calloc(count, sizeof(*p->bufs));
+        if (!p->bufs)
+            return -1;
+        for (i = count - 1; i >= 0; i--) {
+            p->bufs[i].offset = offset + i * p->size;
+            p->bufs[i].size = p->size;
+            p->bufs[i].pool = b->nb_pools - 1;
+            p->bufs[i].next = p->free_list;
+            p->free_list = &p->bufs[i];
+        }
+        offset += count * p->size;
+        b->stats.pool_buffers += count;
+
+        spec = *end == ',' ? end + 1 : end;
+    }
+
+    if (offset > b->size) {
+        fprintf(stderr, "CMEM host: pools need %zu bytes, block has %zu\n",
+                offset, b->size);
+        return -1;
+    }
+
+    /* the heap is whatever is left after the pools */
+    b->heap_offset = offset;
+    b->stats.heap_size = b->size - offset;
+    if (b->stats.heap_size) {
+        b->heap_free = calloc(1, sizeof(*b->heap_free));
+        if (!b->heap_free)
+            return -1;
+        b->heap_free->offset = offset;
+        b->heap_free->size = b->stats.heap_size;
+    }
+
+    return 0;
+}
+
+static void free_block(HostBlock *b)
+{
+    int i;
+
+    for (i = 0; i < b->nb_pools; i++)
+        free(b->pools[i].bufs);
+    while (b->heap_free) {
+        HeapChunk *c = b->heap_free;
+        b->heap_free = c->next;
+        free(c);
+    }
+    while (b->heap_allocs) {
+        HostBuf *h = b->heap_allocs;
+        b->heap_allocs = h->next;
+        free(h);
+    }
+    if (b->base)
+        munmap(b->base, b->size);
+    memset(b, 0, sizeof(*b));
+}
+
+int CMEM_init(void)
+{
+    const char *pools[CMEM_HOST_MAX_BLOCKS] = { NULL };
+    const char *args;
+    int i;
+
+    pthread_mutex_lock(&host_lock);
+    if (init_count++) {
+        pthread_mutex_unlock(&host_lock);
+        return 0;
+    }
+
+    args = getenv("CMEM_HOST_ARGS");
+    if (!args)
+        args = HOST_DEFAULT_ARGS;
+    if (parse_args(args, pools) < 0)
+        goto fail;
+
+    for (i = 0; i < nb_blocks; i++) {
+        HostBlock *b = &blocks[i];
+
+        if (b->phys_end <= b->phys_start || b->phys_start % HOST_PAGE_SIZE) {
+            fprintf(stderr, "CMEM host: bad phys range for block %d\n", i);
+            goto fail;
+        }
+        b->size = b->phys_end - b->phys_start;
+        b->base = mmap(NULL, b->size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (b->base == MAP_FAILED) {
+            b->base = NULL;
+            goto fail;
+        }
+        if (setup_pools(b, pools[i]) < 0) {
+            fprintf(stderr, "CMEM host: bad pools for block %d\n", i);
+            goto fail;
+        }
+    }
+
+    pthread_mutex_unlock(&host_lock);
+    return 0;
+
+fail:
+    for (i = 0; i < CMEM_HOST_MAX_BLOCKS; i++)
+        free_block(&blocks[i]);
+    nb_blocks = 0;
+    init_count = 0;
+    pthread_mutex_unlock(&host_lock);
+    return -1;
+}
+
+static HostBlock *get_block(int blockid)
+{
+    if (blockid < 0 || blockid >= nb_blocks)
+        return NULL;
+    return &blocks[blockid];
+}
+
+/* best fitting pool that still has a free buffer */
+static int find_pool(HostBlock *b, size_t size)
+{
+    int i, best = -1;
+
+    for (i = 0; i < b->nb_pools; i++) {
+        HostPool *p = &b->pools[i];
+
+        if (p->size < size || !p->free_list)
+            continue;
+        if (best < 0 || p->size < b->pools[best].size)
+            best = i;
+    }
+    return best;
+}
+
+int CMEM_getPool2(int blockid, size_t size)
+{
+    HostBlock *b;
+    int poolid;
+
+    pthread_mutex_lock(&host_lock);
+    b = get_block(blockid);
+    poolid = b ? find_pool(b, size) : -1;
+    pthread_mutex_unlock(&host_lock);
+
+    return poolid;
+}
+
+int CMEM_getPool(size_t size)
+{
+    return CMEM_getPool2(0, size);
+}
+
+static void *alloc_pool_locked(HostBlock *b, int poolid)
+{
+    uint64_t t0 = now_ns();
+    HostPool *p;
+    HostBuf *buf;
+
+    if (poolid < 0 || poolid >= b->nb_pools || !b->pools[poolid].free_list) {
+        account_alloc(b, t0, 0);
+        return NULL;
+    }
+    p = &b->pools[poolid];
+    buf = p->free_list;
+    p->free_list = buf->next;
+    buf->next = NULL;
+    buf->allocated = 1;
+    buf->refcount = 1;
+
+    if (++b->stats.pool_buffers_used > b->stats.pool_buffers_used_max)
+        b->stats.pool_buffers_used_max = b->stats.pool_buffers_used;
+    account_alloc(b, t0, 1);
+
+    return b->base + buf->offset;
+}
+
+void *CMEM_allocPool2(int blockid, int poolid, CMEM_AllocParams *params)
+{
+    HostBlock *b;
+    void *ptr = NULL;
+
+    pthread_mutex_lock(&host_lock);
+    b = get_block(blockid);
+    if (b)
+        ptr = alloc_pool_locked(b, poolid);
+    pthread_mutex_unlock(&host_lock);
+
+    return ptr;
+}
+
+void *CMEM_allocPool(int poolid, CMEM_AllocParams *params)
+{
+    return CMEM_allocPool2(0, poolid, params);
+}
+
+static void *alloc_heap_locked(HostBlock *b, size_t size, size_t align)
+{
+    uint64_t t0 = now_ns();
+    HeapChunk **pc, *c;
+    HostBuf *buf;
+
+    size = page_align(size ? size : 1);
+    if (align < HOST_PAGE_SIZE)
+        align = HOST_PAGE_SIZE;
+
+    /* first fit, alignment applies to the physical address */
+    for (pc = &b->heap_free; (c = *pc); pc = &c->next) {
+        unsigned long phys = b->phys_start + c->offset;
+        size_t pad = (align - phys % align) % align;
+        HeapChunk *tail;
+
+        if (c->size < pad + size)
+            continue;
+
+        buf = calloc(1, sizeof(*buf));
+        if (!buf)
+            break;
+        buf->offset = c->offset + pad;
+        buf->size = size;
+        buf->pool = -1;
+        buf->allocated = 1;
+        buf->refcount = 1;
+
+        if (c->size > pad + size) {
+            if (pad) {
+                tail = calloc(1, sizeof(*tail));
+                if (!tail) {
+                    free(buf);
+                    break;
+                }
+                tail->offset = buf->offset + size;
+                tail->size = c->size - pad - size;
+                tail->next = c->next;
+                c->next = tail;
+                c->size = pad;
+            } else {
+                c->offset += size;
+                c->size -= size;
+            }
+        } else if (pad) {
+            c->size = pad;
+        } else {
+            *pc = c->next;
+            free(c);
+        }
+
+        buf->next = b->heap_allocs;
+        b->heap_allocs = buf;
+        b->stats.heap_used += size;
+        if (b->stats.heap_used > b->stats.heap_used_max)
+            b->stats.heap_used_max = b->stats.heap_used;
+        account_alloc(b, t0, 1);
+
+        return b->base + buf->offset;
+    }
+
+    account_alloc(b, t0, 0);
+    return NULL;
+}
+
+void *CMEM_alloc2(int blockid, size_t size, CMEM_AllocParams *params)
+{
+    HostBlock *b;
+    void *ptr = NULL;
+
+    if (!params)
+        params = &CMEM_DEFAULTPARAMS;
+
+    pthread_mutex_lock(&host_lock);
+    b = get_block(blockid);
+    if (b) {
+        if (params->type == CMEM_HEAP)
+            ptr = alloc_heap_locked(b, size, params->alignment);
+        else
+            ptr = alloc_pool_locked(b, find_pool(b, size));
+    }
+    pthread_mutex_unlock(&host_lock);
+
+    return ptr;
+}
+
+void *CMEM_alloc(size_t size, CMEM_AllocParams *params)
+{
+    return CMEM_alloc2(0, size, params);
+}
+
+/* find the allocation containing ptr, returns its block too */
+static HostBuf *lookup_locked(const void *ptr, HostBlock **pb)
+{
+    const uint8_t *p = ptr;
+    int i, j;
+
+    for (i = 0; i < nb_blocks; i++) {
+        HostBlock *b = &blocks[i];
+        size_t off;
+        HostBuf *h;
+
+        if (!b->base || p < b->base || p >= b->base + b->size)
+            continue;
+        off = p - b->base;
+        *pb = b;
+
+        if (off < b->heap_offset) {
+            for (j = 0; j < b->nb_pools; j++) {
+                HostPool *pool = &b->pools[j];
+
+                if (off >= pool->offset &&
+                        off < pool->offset + pool->count * pool->size) {
+                    h = &pool->bufs[(off - pool->offset) / pool->size];
+                    return h->allocated ? h : NULL;
+                }
+            }
+            return NULL;
+        }
+        for (h = b->heap_allocs; h; h = h->next) {
+            if (off >= h->offset && off < h->offset + h->size)
+                return h;
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+static void heap_release_locked(HostBlock *b, HostBuf *buf)
+{
+    HeapChunk **pc, *c, *prev = NULL, *n;
+    HostBuf **ph;
+
+    for (ph = &b->heap_allocs; *ph != buf; ph = &(*ph)->next)
+        ;
+    *ph = buf->next;
+
+    /* insert sorted and merge with the neighbours */
+    for (pc = &b->heap_free; (c = *pc) && c->offset < buf->offset;
+            pc = &c->next)
+        prev = c;
+
+    if (prev && prev->offset + prev->size == buf->offset) {
+        prev->size += buf->size;
+        n = prev;
+    } else {
+        n = calloc(1, sizeof(*n));
+        if (!n) {
+            /* leak the range rather than corrupt the heap */
+            fprintf(stderr, "CMEM host: out of memory freeing heap buffer\n");
+            free(buf);
+            return;
+        }
+        n->offset = buf->offset;
+        n->size = buf->size;
+        n->next = c;
+        *pc = n;
+    }
+    if (c && n->offset + n->size == c->offset) {
+        n->size += c->size;
+        n->next = c->next;
+        free(c);
+    }
+
+    b->stats.heap_used -= buf->size;
+    free(buf);
+}
+
+static int release(void *ptr, CMEM_AllocParams *params)
+{
+    HostBlock *b = NULL;
+    HostBuf *buf;
+
+    if (!params)
+        params = &CMEM_DEFAULTPARAMS;
+
+    pthread_mutex_lock(&host_lock);
+    buf = lookup_locked(ptr, &b);
+    if (!buf || (buf->pool < 0) != (params->type == CMEM_HEAP)) {
+        fprintf(stderr, "CMEM host: bad free of %p (%s)\n", ptr,
+                buf ? "wrong params->type" : "not allocated");
+        pthread_mutex_unlock(&host_lock);
+        return -1;
+    }
+
+    if (--buf->refcount == 0) {
+        b->stats.nb_free++;
+        if (buf->pool < 0) {
+            heap_release_locked(b, buf);
+        } else {
+            HostPool *p = &b->pools[buf->pool];
+
+            buf->allocated = 0;
+            buf->next = p->free_list;
+            p->free_list = buf;
+            b->stats.pool_buffers_used--;
+        }
+    }
+    pthread_mutex_unlock(&host_lock);
+
+    return 0;
+}
+
+int CMEM_free(void *ptr, CMEM_AllocParams *params)
+{
+    return release(ptr, params);
+}
+
+int CMEM_unregister(void *ptr, CMEM_AllocParams *params)
+{
+    return release(ptr, params);
+}
+
+void *CMEM_registerAlloc(unsigned long physp)
+{
+    void *ptr = NULL;
+    int i;
+
+    pthread_mutex_lock(&host_lock);
+    for (i = 0; i < nb_blocks; i++) {
+        HostBlock *b = &blocks[i];
+        HostBlock *found;
+        HostBuf *buf;
+
+        if (physp < b->phys_start || physp >= b->phys_end)
+            continue;
+        buf = lookup_locked(b->base + (physp - b->phys_start), &found);
+        if (buf && b->phys_start + buf->offset == physp) {
+            buf->refcount++;
+            ptr = b->base + buf->offset;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&host_lock);
+
+    return ptr;
+}
+
+unsigned long CMEM_getPhys(void *ptr)
+{
+    const uint8_t *p = ptr;
+    unsigned long phys = 0;
+    int i;
+
+    pthread_mutex_lock(&host_lock);
+    for (i = 0; i < nb_blocks; i++) {
+        HostBlock *b = &blocks[i];
+
+        if (b->base && p >= b->base && p < b->base + b->size) {
+            phys = b->phys_start + (p - b->base);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&host_lock);
+
+    return phys;
+}
+
+static int cache_op(void *ptr, size_t size)
+{
+    const uint8_t *p = ptr;
+    int i, ret = -1;
+
+    pthread_mutex_lock(&host_lock);
+    for (i = 0; i < nb_blocks; i++) {
+        HostBlock *b = &blocks[i];
+
+        if (b->base && p >= b->base && p + size <= b->base + b->size) {
+            b->stats.nb_cache_ops++;
+            b->stats.cache_bytes += size;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&host_lock);
+
+    return ret;
+}
+
+int CMEM_cacheWb(void *ptr, size_t size)
+{
+    return cache_op(ptr, size);
+}
+
+int CMEM_cacheInv(void *ptr, size_t size)
+{
+    return cache_op(ptr, size);
+}
+
+int CMEM_cacheWbInv(void *ptr, size_t size)
+{
+    return cache_op(ptr, size);
+}
+
+int CMEM_getVersion(void)
+{
+    return CMEM_VERSION;
+}
+
+int CMEM_getBlockAttrs(int blockid, CMEM_BlockAttrs *pattrs)
+{
+    HostBlock *b = get_block(blockid);
+
+    if (!b)
+        return -1;
+    pattrs->phys_base = b->phys_start;
+    pattrs->size = b->size;
+    return 0;
+}
+
+int CMEM_getBlock(unsigned long *pphys_base, size_t *psize)
+{
+    CMEM_BlockAttrs attrs;
+
+    if (CMEM_getBlockAttrs(0, &attrs) < 0)
+        return -1;
+    *pphys_base = attrs.phys_base;
+    *psize = attrs.size;
+    return 0;
+}
+
+int CMEM_hostGetStats(int blockid, CMEM_HostStats *stats)
+{
+    HostBlock *b;
+    HeapChunk *c;
+
+    pthread_mutex_lock(&host_lock);
+    b = get_block(blockid);
+    if (!b) {
+        pthread_mutex_unlock(&host_lock);
+        return -1;
+    }
+    *stats = b->stats;
+    stats->heap_free_largest = 0;
+    stats->heap_free_chunks = 0;
+    for (c = b->heap_free; c; c = c->next) {
+        stats->heap_free_chunks++;
+        if (c->size > stats->heap_free_largest)
+            stats->heap_free_largest = c->size;
+    }
+    pthread_mutex_unlock(&host_lock);
+
+    return 0;
+}
+
+int CMEM_hostFragmentation(const CMEM_HostStats *stats)
+{
+    size_t free_bytes = stats->heap_size - stats->heap_used;
+
+    if (!free_bytes)
+        return 0;
+    return (int)(100 - (uint64_t)stats->heap_free_largest * 100 / free_bytes);
+}
+
+void CMEM_hostPrintStats(void)
+{
+    CMEM_HostStats s;
+    int i;
+
+    for (i = 0; CMEM_hostGetStats(i, &s) == 0; i++) {
+        printf("CMEM host block %d: %u allocs (%u failed), %u frees, "
+                "alloc %llu ns avg / %llu ns max\n", i, s.nb_alloc,
+                s.nb_alloc_failed, s.nb_free,
+                (unsigned long long)(s.nb_alloc ?
+                        s.alloc_ns_total / s.nb_alloc : 0),
+                (unsigned long long)s.alloc_ns_max);
+        printf("    pools: %d buffers, %d in use, %d max\n", s.pool_buffers,
+                s.pool_buffers_used, s.pool_buffers_used_max);
+        printf("    heap: %zu bytes, %zu used, %zu max, %d free chunks, "
+                "largest %zu, fragmentation %d%%\n", s.heap_size, s.heap_used,
+                s.heap_used_max, s.heap_free_chunks, s.heap_free_largest,
+                CMEM_hostFragmentation(&s));
+        printf("    cache: %u ops, %llu bytes\n", s.nb_cache_ops,
+                (unsigned long long)s.cache_bytes);
+    }
+}
+
+int CMEM_exit(void)
+{
+    int i;
+
+    pthread_mutex_lock(&host_lock);
+    if (!init_count || --init_count) {
+        pthread_mutex_unlock(&host_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&host_lock);
+
+    CMEM_hostPrintStats();
+
+    pthread_mutex_lock(&host_lock);
+    for (i = 0; i < CMEM_HOST_MAX_BLOCKS; i++)
+        free_block(&blocks[i]);
+    nb_blocks = 0;
+    pthread_mutex_unlock(&host_lock);
+
+    return 0;
+}
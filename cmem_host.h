@@ -0,0 +1,77 @@
+/*
+ * CMEM emulation for host builds
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CMEM_HOST_H
+#define CMEM_HOST_H
+
+/*
+ * Host side implementation of the cmem.h API so the CPU side code paths
+ * can be run and profiled without cmemk.ko. The memory layout is taken
+ * from the CMEM_HOST_ARGS environment variable in cmemk insmod syntax:
+ *
+ *   CMEM_HOST_ARGS="pools=4x30000,2x500000 phys_start=0x87000000
+ *                   phys_end=0x88000000 pools_1=4x65536
+ *                   phys_start_1=0x80000000 phys_end_1=0x80010000"
+ *
+ * Pools and heap behave like in the kernel module: pool buffers are
+ * rounded up to a page, the heap is what is left of the block after the
+ * pools, heap allocations are page granular. Physical addresses are fake
+ * but consistent, CMEM_getPhys()/CMEM_registerAlloc() map them back and
+ * forth. Cache operations do nothing but are counted.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CMEM_HOST_MAX_BLOCKS    2
+
+typedef struct CMEM_HostStats {
+    unsigned nb_alloc;          /* successful pool and heap allocations */
+    unsigned nb_alloc_failed;
+    unsigned nb_free;
+    unsigned nb_cache_ops;      /* CMEM_cacheWb/Inv/WbInv calls */
+    uint64_t cache_bytes;
+    uint64_t alloc_ns_total;    /* time spent inside the allocator */
+    uint64_t alloc_ns_max;
+    size_t heap_size;
+    size_t heap_used;
+    size_t heap_used_max;       /* heap high-water mark */
+    size_t heap_free_largest;   /* largest free heap chunk */
+    int heap_free_chunks;
+    int pool_buffers;
+    int pool_buffers_used;
+    int pool_buffers_used_max;
+} CMEM_HostStats;
+
+/* statistics of one memory block, returns -1 for an invalid blockid */
+int CMEM_hostGetStats(int blockid, CMEM_HostStats *stats);
+
+/*
+ * Heap fragmentation in percent: how much of the free heap is not usable
+ * for a single allocation, 0 when the free space is one chunk.
+ */
+int CMEM_hostFragmentation(const CMEM_HostStats *stats);
+
+void CMEM_hostPrintStats(void);
+
+#endif /* CMEM_HOST_H */
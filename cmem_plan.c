@@ -0,0 +1,198 @@
+/*
+ * CMEM pool layout derived from the stream configuration
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cmem.h"
+#include "cmem_plan.h"
+
+static CMEM_AllocParams plan_params = {
+        .type = CMEM_POOL,
+        .flags = CMEM_NONCACHED,
+        .alignment = 0,
+};
+
+void cmem_plan_init(CmemPlan *plan)
+{
+    memset(plan, 0, sizeof(*plan));
+}
+
+int cmem_plan_add(CmemPlan *plan, int blockid, const char *owner,
+        size_t size, int count)
+{
+    CmemPlanEntry *e;
+    int i;
+
+    if (blockid < 0 || blockid >= CMEM_PLAN_MAX_BLOCKS || !size || count <= 0)
+        return -1;
+    size = (size + CMEM_PLAN_PAGE - 1) & ~(size_t)(CMEM_PLAN_PAGE - 1);
+
+    for (i = 0; i < plan->nb_entries; i++) {
+        e = &plan->entries[i];
+        if (e->blockid == blockid && e->size == size) {
+            int len = strlen(e->owner);
+
+            e->count += count;
+            if (!strstr(e->owner, owner))
+                snprintf(e->owner + len, sizeof(e->owner) - len, ", %s",
+                        owner);
+            return 0;
+        }
+    }
+    if (plan->nb_entries == CMEM_PLAN_MAX_ENTRIES)
+        return -1;
+
+    /* kept sorted by block and size, the order cmemk wants them in */
+    for (i = plan->nb_entries; i > 0; i--) {
+        e = &plan->entries[i - 1];
+        if (e->blockid < blockid || (e->blockid == blockid && e->size < size))
+            break;
+        plan->entries[i] = *e;
+    }
+    e = &plan->entries[i];
+    e->blockid = blockid;
+    e->size = size;
+    e->count = count;
+    snprintf(e->owner, sizeof(e->owner), "%s", owner);
+    plan->nb_entries++;
+    return 0;
+}
+
+int cmem_plan_add_frames(CmemPlan *plan, int blockid, const char *owner,
+        enum PixelFormat pix_fmt, int width, int height, int count)
+{
+    int size = avpicture_get_size(pix_fmt, width, height);
+
+    if (size <= 0)
+        return -1;
+    return cmem_plan_add(plan, blockid, owner, size, count);
+}
+
+size_t cmem_plan_total(const CmemPlan *plan, int blockid)
+{
+    size_t total = 0;
+    int i;
+
+    for (i = 0; i < plan->nb_entries; i++) {
+        if (plan->entries[i].blockid == blockid)
+            total += plan->entries[i].size * plan->entries[i].count;
+    }
+    return total;
+}
+
+int cmem_plan_format(const CmemPlan *plan, char *buf, int buf_size)
+{
+    int b, i, len = 0;
+
+    buf[0] = 0;
+    for (b = 0; b < CMEM_PLAN_MAX_BLOCKS; b++) {
+        int first = 1;
+
+        for (i = 0; i < plan->nb_entries; i++) {
+            const CmemPlanEntry *e = &plan->entries[i];
+
+            if (e->blockid != b)
+                continue;
+            if (first)
+                len += snprintf(buf + len, buf_size - len, "%s%s=",
+                        len ? " " : "", b ? "pools_1" : "pools");
+            else
+                len += snprintf(buf + len, buf_size - len, ",");
+            if (len >= buf_size)
+                return -1;
+            len += snprintf(buf + len, buf_size - len, "%dx%zu", e->count,
+                    e->size);
+            if (len >= buf_size)
+                return -1;
+            first = 0;
+        }
+    }
+    return len;
+}
+
+void cmem_plan_print(const CmemPlan *plan)
+{
+    char params[512];
+    int b, i;
+
+    printf("cmem plan:\n");
+    for (i = 0; i < plan->nb_entries; i++) {
+        const CmemPlanEntry *e = &plan->entries[i];
+
+        printf("  block %d: %2d x %8zu bytes  %s\n", e->blockid, e->count,
+                e->size, e->owner);
+    }
+    for (b = 0; b < CMEM_PLAN_MAX_BLOCKS; b++) {
+        size_t total = cmem_plan_total(plan, b);
+
+        if (total)
+            printf("  block %d pools: %zu bytes, the heap gets the rest\n",
+                    b, total);
+    }
+    if (cmem_plan_format(plan, params, sizeof(params)) >= 0)
+        printf("  insmod cmemk.ko %s ...\n", params);
+}
+
+int cmem_plan_validate(const CmemPlan *plan)
+{
+    void **held;
+    int nb_held = 0, missing = 0, total = 0;
+    int i, n;
+
+    for (i = 0; i < plan->nb_entries; i++)
+        total += plan->entries[i].count;
+    held = calloc(total, sizeof(*held));
+    if (!held)
+        return total;
+
+    for (i = 0; i < plan->nb_entries; i++) {
+        const CmemPlanEntry *e = &plan->entries[i];
+        int got = 0;
+
+        for (n = 0; n < e->count; n++) {
+            int poolid = CMEM_getPool2(e->blockid, e->size);
+            void *buf = NULL;
+
+            /* a probe, kept out of the accounting and its peaks */
+            if (poolid >= 0)
+                buf = CMEM_allocPool2(e->blockid, poolid, &plan_params);
+            if (!buf)
+                break;
+            held[nb_held++] = buf;
+            got++;
+        }
+        if (got < e->count) {
+            fprintf(stderr, "cmem plan: block %d has %d of %d pool buffers "
+                    "of %zu bytes (%s)\n", e->blockid, got, e->count,
+                    e->size, e->owner);
+            missing += e->count - got;
+        }
+    }
+
+    while (nb_held--)
+        CMEM_free(held[nb_held], &plan_params);
+    free(held);
+    return missing;
+}
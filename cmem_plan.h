@@ -0,0 +1,85 @@
+/*
+ * CMEM pool layout derived from the stream configuration
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CMEM_PLAN_H
+#define CMEM_PLAN_H
+
+#include <stddef.h>
+#include <libavcodec/avcodec.h>
+
+#include "cmem.h"
+
+/* cmemk rounds pool buffers up to this */
+#define CMEM_PLAN_PAGE          4096
+#define CMEM_PLAN_MAX_ENTRIES   32
+#define CMEM_PLAN_MAX_BLOCKS    2
+
+typedef struct CmemPlanEntry {
+    int blockid;
+    size_t size;                /* page aligned */
+    int count;
+    char owner[48];             /* the first user, others are appended */
+} CmemPlanEntry;
+
+typedef struct CmemPlan {
+    CmemPlanEntry entries[CMEM_PLAN_MAX_ENTRIES];
+    int nb_entries;
+} CmemPlan;
+
+void cmem_plan_init(CmemPlan *plan);
+
+/**
+ * Account count buffers of size bytes in blockid. Sizes are rounded up to
+ * a page like cmemk does, buffers of the same rounded size share a pool.
+ */
+int cmem_plan_add(CmemPlan *plan, int blockid, const char *owner,
+        size_t size, int count);
+
+/* the same for pictures as the frame pools allocate them */
+int cmem_plan_add_frames(CmemPlan *plan, int blockid, const char *owner,
+        enum PixelFormat pix_fmt, int width, int height, int count);
+
+/* bytes the pools of blockid take out of the block */
+size_t cmem_plan_total(const CmemPlan *plan, int blockid);
+
+/**
+ * Write the cmemk parameters, "pools=4x462848,1x3145728" and a
+ * "pools_1=..." when block 1 is used, sizes ascending.
+ */
+int cmem_plan_format(const CmemPlan *plan, char *buf, int buf_size);
+
+/* print the entries and the insmod parameters */
+void cmem_plan_print(const CmemPlan *plan);
+
+/**
+ * Check the running module against the plan: every buffer of every entry
+ * must come from a pool found by CMEM_getPool2(). All buffers are held
+ * until the end of the check, so entries can't satisfy each other with
+ * the same buffer, and freed again. The probe bypasses cmem_acct, so the
+ * peaks it reports are the application's own. CMEM must be initialized.
+ *
+ * @return the number of buffers the module could not provide
+ */
+int cmem_plan_validate(const CmemPlan *plan);
+
+#endif /* CMEM_PLAN_H */
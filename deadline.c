@@ -0,0 +1,168 @@
+/*
+ * Real-time frame deadlines and the drop policy
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "deadline.h"
+#include "timeutil.h"
+
+struct Deadline {
+    DeadlineConfig cfg;
+    AVRational time_base;
+    int64_t start_us;           /* capture time of frame 0, 0 until known */
+    pthread_mutex_t lock;
+    DeadlineStats stats;
+};
+
+int deadline_parse(const char *spec, DeadlineConfig *cfg)
+{
+    int max_ms, degrade_ms, skip_ms, n;
+
+    memset(cfg, 0, sizeof(*cfg));
+    n = sscanf(spec, "%d:%d:%d", &max_ms, &degrade_ms, &skip_ms);
+    if (n == 1) {
+        degrade_ms = max_ms / 2;
+        skip_ms = max_ms * 3 / 4;
+    } else if (n != 3) {
+        return -1;
+    }
+    if (max_ms <= 0 || degrade_ms < 0 || skip_ms < degrade_ms ||
+            max_ms < skip_ms)
+        return -1;
+    cfg->max_latency_us = (int64_t)max_ms * 1000;
+    cfg->degrade_us = (int64_t)degrade_ms * 1000;
+    cfg->skip_us = (int64_t)skip_ms * 1000;
+    return 0;
+}
+
+Deadline *deadline_open(const DeadlineConfig *cfg, AVRational time_base)
+{
+    Deadline *d;
+
+    d = calloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+    d->cfg = *cfg;
+    d->time_base = time_base;
+    pthread_mutex_init(&d->lock, NULL);
+    return d;
+}
+
+/* capture time of frame_number, the clock must have started */
+static int64_t capture_us(Deadline *d, int frame_number)
+{
+    return d->start_us + (int64_t)frame_number * 1000000 *
+        d->time_base.num / d->time_base.den;
+}
+
+void deadline_wait(Deadline *d, int frame_number)
+{
+    struct timespec ts;
+    int64_t t;
+
+    pthread_mutex_lock(&d->lock);
+    if (!d->start_us)
+        d->start_us = time_now_us();
+    t = capture_us(d, frame_number);
+    pthread_mutex_unlock(&d->lock);
+
+    /* an absolute sleep does not accumulate the error of each wakeup */
+    ts.tv_sec = t / 1000000;
+    ts.tv_nsec = (t % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+enum DeadlineAction deadline_check(Deadline *d, int frame_number,
+        int queue_percent)
+{
+    enum DeadlineAction action;
+    int64_t late;
+
+    pthread_mutex_lock(&d->lock);
+    if (!d->start_us)
+        d->start_us = time_now_us();
+    late = time_now_us() - capture_us(d, frame_number);
+
+    d->stats.nb_frames++;
+    if (late >= d->cfg.max_latency_us) {
+        action = DEADLINE_DROP;
+        d->stats.nb_dropped++;
+    } else if (late >= d->cfg.skip_us ||
+            queue_percent >= DEADLINE_QUEUE_SKIP) {
+        action = DEADLINE_SKIP;
+        d->stats.nb_skipped++;
+    } else if (late >= d->cfg.degrade_us ||
+            queue_percent >= DEADLINE_QUEUE_DEGRADE) {
+        action = DEADLINE_DEGRADE;
+        d->stats.nb_degraded++;
+    } else {
+        action = DEADLINE_ENCODE;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return action;
+}
+
+void deadline_done(Deadline *d, int frame_number)
+{
+    int64_t latency;
+
+    pthread_mutex_lock(&d->lock);
+    latency = time_now_us() - capture_us(d, frame_number);
+    if (latency > d->cfg.max_latency_us)
+        d->stats.nb_late++;
+    if (latency > d->stats.latency_max_us)
+        d->stats.latency_max_us = latency;
+    d->stats.latency_total_us += latency;
+    d->stats.nb_muxed++;
+    pthread_mutex_unlock(&d->lock);
+}
+
+void deadline_get_stats(Deadline *d, DeadlineStats *stats)
+{
+    pthread_mutex_lock(&d->lock);
+    *stats = d->stats;
+    pthread_mutex_unlock(&d->lock);
+}
+
+void deadline_close(Deadline *d)
+{
+    DeadlineStats s;
+
+    if (!d)
+        return;
+    s = d->stats;
+    printf("real time: %u frames, %u degraded, %u skipped, %u dropped, "
+            "%u late, latency %lld us avg / %lld us max (limit %lld us)\n",
+            s.nb_frames, s.nb_degraded, s.nb_skipped, s.nb_dropped, s.nb_late,
+            (long long)(s.nb_muxed ? s.latency_total_us / s.nb_muxed : 0),
+            (long long)s.latency_max_us, (long long)d->cfg.max_latency_us);
+    pthread_mutex_destroy(&d->lock);
+    free(d);
+}
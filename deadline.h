@@ -0,0 +1,88 @@
+/*
+ * Real-time frame deadlines and the drop policy
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+/* writer queue fill, percent, at which frames are degraded or skipped */
+#define DEADLINE_QUEUE_DEGRADE  50
+#define DEADLINE_QUEUE_SKIP     75
+
+typedef struct DeadlineConfig {
+    int64_t max_latency_us;     /* capture to mux, a frame older is dropped */
+    int64_t degrade_us;         /* lateness from which frames are degraded */
+    int64_t skip_us;            /* and from which they are not encoded */
+} DeadlineConfig;
+
+enum DeadlineAction {
+    DEADLINE_ENCODE,
+    DEADLINE_DEGRADE,           /* encode coarser or fewer, no side outputs */
+    DEADLINE_SKIP,              /* captured, but not encoded */
+    DEADLINE_DROP,              /* past its deadline already, no work at all */
+};
+
+typedef struct DeadlineStats {
+    unsigned nb_frames;
+    unsigned nb_degraded;
+    unsigned nb_skipped;
+    unsigned nb_dropped;
+    unsigned nb_late;           /* muxed after their deadline */
+    int64_t latency_max_us;     /* capture to mux */
+    int64_t latency_total_us;
+    unsigned nb_muxed;
+} DeadlineStats;
+
+typedef struct Deadline Deadline;
+
+/* parse "max_ms[:degrade_ms:skip_ms]", by default at 1/2 and 3/4 of max */
+int deadline_parse(const char *spec, DeadlineConfig *cfg);
+
+/**
+ * Run a stream of time_base 1/fps in real time: frame n is captured at
+ * n * time_base after the first and must be muxed within max_latency_us.
+ * The producer, encoder and muxer may each run on their own thread.
+ */
+Deadline *deadline_open(const DeadlineConfig *cfg, AVRational time_base);
+
+/* sleep until frame_number is captured, the first call starts the clock */
+void deadline_wait(Deadline *d, int frame_number);
+
+/**
+ * Decide what to do with frame_number from how late it is now and how full
+ * the writer queue is (percent, 0 if there is none), and count it.
+ */
+enum DeadlineAction deadline_check(Deadline *d, int frame_number,
+        int queue_percent);
+
+/* frame_number has been muxed, counts it late if it missed its deadline */
+void deadline_done(Deadline *d, int frame_number);
+
+void deadline_get_stats(Deadline *d, DeadlineStats *stats);
+
+/* print the stats and free d */
+void deadline_close(Deadline *d);
+
+#endif /* DEADLINE_H */
@@ -0,0 +1,122 @@
+/*
+ * Decoding with and without read-ahead
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <libavformat/avformat.h>
+
+#include "demux.h"
+#include "timeutil.h"
+
+/* frames per second decoding filename, -1 on error */
+static double decode_run(const char *filename, int max_packets)
+{
+    AVFormatContext *fctx = NULL;
+    AVCodecContext *avctx = NULL;
+    AVCodec *codec;
+    AVFrame *picture = NULL;
+    DemuxReader *reader = NULL;
+    int64_t start, elapsed;
+    int frames = 0, video_st = -1, i;
+    double fps = -1;
+
+    if (avformat_open_input(&fctx, filename, NULL, NULL) < 0 || !fctx) {
+        fprintf(stderr, "decode bench: could not open '%s'\n", filename);
+        return -1;
+    }
+    av_find_stream_info(fctx);
+    for (i = 0; i < fctx->nb_streams; i++) {
+        if (fctx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+            video_st = i;
+            break;
+        }
+    }
+    if (video_st < 0)
+        goto out;
+
+    avctx = fctx->streams[video_st]->codec;
+    codec = avcodec_find_decoder_by_name("libdm365_h264");
+    if (!codec || avcodec_open(avctx, codec) < 0) {
+        fprintf(stderr, "decode bench: cannot open decoder\n");
+        avctx = NULL;
+        goto out;
+    }
+    picture = avcodec_alloc_frame();
+    if (!picture)
+        goto out;
+
+    start = time_now_us();
+    if (max_packets > 0) {
+        reader = demux_open(fctx, video_st, max_packets, DEMUX_DEFAULT_BYTES);
+        if (!reader)
+            goto out;
+    }
+    for (;;) {
+        AVPacket pkt;
+        int got_pic = 0, ret;
+
+        if ((reader ? demux_read(reader, &pkt) :
+                    demux_read_frame(fctx, &pkt)) < 0)
+            break;
+        if (pkt.stream_index != video_st) {
+            av_free_packet(&pkt);
+            continue;
+        }
+        ret = avcodec_decode_video2(avctx, picture, &got_pic, &pkt);
+        av_free_packet(&pkt);
+        if (ret < 0) {
+            fprintf(stderr, "decode bench: error in decoding\n");
+            break;
+        }
+        frames += got_pic;
+    }
+    elapsed = time_now_us() - start;
+    if (elapsed > 0)
+        fps = frames * 1000000.0 / elapsed;
+    printf("decode %s: %d frames in %lld ms, %.2f fps\n",
+            reader ? "with read-ahead" : "without read-ahead", frames,
+            (long long)(elapsed / 1000), fps);
+
+out:
+    demux_close(reader);
+    av_free(picture);
+    if (avctx)
+        avcodec_close(avctx);
+    av_close_input_file(fctx);
+    return fps;
+}
+
+int decode_benchmark(const char *filename, int max_packets)
+{
+    double direct, ahead;
+
+    direct = decode_run(filename, 0);
+    ahead = decode_run(filename, max_packets);
+    if (direct <= 0 || ahead <= 0)
+        return -1;
+
+    printf("decode: read-ahead of %d packets is %.2fx the direct rate\n",
+            max_packets, ahead / direct);
+    return 0;
+}
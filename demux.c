@@ -0,0 +1,216 @@
+/*
+ * Read-ahead demuxing thread
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "demux.h"
+#include "timeutil.h"
+
+struct DemuxReader {
+    AVFormatContext *fctx;
+    int stream_index;
+    AVPacket *queue;
+    int max_packets, max_bytes;
+    int head, count, bytes;
+    int eof;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    DemuxStats stats;
+};
+
+static int read_delay_us;
+
+void demux_set_read_delay(int us)
+{
+    read_delay_us = us;
+}
+
+int demux_read_frame(AVFormatContext *fctx, AVPacket *pkt)
+{
+    if (read_delay_us)
+        usleep(read_delay_us);
+    return av_read_frame(fctx, pkt);
+}
+
+static void *reader_thread(void *arg)
+{
+    DemuxReader *r = arg;
+
+    for (;;) {
+        AVPacket pkt;
+        int64_t t0 = time_now_us();
+        int ret;
+
+        ret = demux_read_frame(r->fctx, &pkt);
+        /* the demuxer may reuse the data on the next read, keep a copy */
+        if (ret >= 0 && av_dup_packet(&pkt) < 0) {
+            av_free_packet(&pkt);
+            ret = -1;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        r->stats.read_us += time_now_us() - t0;
+        if (ret < 0) {
+            r->eof = 1;
+            pthread_cond_broadcast(&r->cond);
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+        if (pkt.stream_index != r->stream_index) {
+            pthread_mutex_unlock(&r->lock);
+            av_free_packet(&pkt);
+            continue;
+        }
+
+        /* a packet larger than the byte bound still goes into an empty
+           queue, otherwise nothing would ever move */
+        if (!r->stop && (r->count == r->max_packets ||
+                    (r->count && r->bytes + pkt.size > r->max_bytes)))
+            r->stats.nb_full++;
+        while (!r->stop && (r->count == r->max_packets ||
+                    (r->count && r->bytes + pkt.size > r->max_bytes)))
+            pthread_cond_wait(&r->cond, &r->lock);
+        if (r->stop) {
+            pthread_mutex_unlock(&r->lock);
+            av_free_packet(&pkt);
+            break;
+        }
+
+        r->queue[(r->head + r->count) % r->max_packets] = pkt;
+        r->count++;
+        r->bytes += pkt.size;
+        if (r->count > r->stats.max_count)
+            r->stats.max_count = r->count;
+        if (r->bytes > r->stats.max_bytes)
+            r->stats.max_bytes = r->bytes;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    return NULL;
+}
+
+DemuxReader *demux_open(AVFormatContext *fctx, int stream_index,
+        int max_packets, int max_bytes)
+{
+    DemuxReader *r;
+
+    r = calloc(1, sizeof(*r));
+    if (!r)
+        return NULL;
+    r->fctx = fctx;
+    r->stream_index = stream_index;
+    r->max_packets = max_packets;
+    r->max_bytes = max_bytes;
+    r->queue = calloc(max_packets, sizeof(*r->queue));
+    if (!r->queue) {
+        free(r);
+        return NULL;
+    }
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    if (pthread_create(&r->thread, NULL, reader_thread, r)) {
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->lock);
+        free(r->queue);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+int demux_read(DemuxReader *r, AVPacket *pkt)
+{
+    int64_t t0;
+
+    pthread_mutex_lock(&r->lock);
+    if (!r->count && !r->eof) {
+        r->stats.nb_empty++;
+        t0 = time_now_us();
+        while (!r->count && !r->eof)
+            pthread_cond_wait(&r->cond, &r->lock);
+        r->stats.empty_us += time_now_us() - t0;
+    }
+    if (!r->count) {
+        pthread_mutex_unlock(&r->lock);
+        return -1;
+    }
+
+    *pkt = r->queue[r->head];
+    r->head = (r->head + 1) % r->max_packets;
+    r->count--;
+    r->bytes -= pkt->size;
+    r->stats.nb_packets++;
+    r->stats.bytes += pkt->size;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+
+    return 0;
+}
+
+void demux_get_stats(DemuxReader *r, DemuxStats *stats)
+{
+    pthread_mutex_lock(&r->lock);
+    *stats = r->stats;
+    pthread_mutex_unlock(&r->lock);
+}
+
+void demux_close(DemuxReader *r)
+{
+    DemuxStats *s;
+
+    if (!r)
+        return;
+
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+
+    while (r->count) {
+        av_free_packet(&r->queue[r->head]);
+        r->head = (r->head + 1) % r->max_packets;
+        r->count--;
+    }
+
+    s = &r->stats;
+    printf("read-ahead: %u packets, %llu bytes, queue max %d/%d packets "
+            "%d/%d KiB, reader waited %u times, decoder waited %u times "
+            "(%lld us), read %lld us\n", s->nb_packets,
+            (unsigned long long)s->bytes, s->max_count, r->max_packets,
+            s->max_bytes >> 10, r->max_bytes >> 10, s->nb_full, s->nb_empty,
+            (long long)s->empty_us, (long long)s->read_us);
+
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r->queue);
+    free(r);
+}
@@ -0,0 +1,82 @@
+/*
+ * Read-ahead demuxing thread
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef DEMUX_H
+#define DEMUX_H
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+#define DEMUX_DEFAULT_PACKETS   32
+#define DEMUX_DEFAULT_BYTES     (4 * 1024 * 1024)
+
+typedef struct DemuxStats {
+    unsigned nb_packets;        /* handed to the consumer */
+    uint64_t bytes;
+    int max_count;              /* queue high-water marks */
+    int max_bytes;
+    unsigned nb_full;           /* reader waited for the consumer */
+    unsigned nb_empty;          /* consumer waited for the reader */
+    int64_t empty_us;           /* total time the consumer waited */
+    int64_t read_us;            /* time spent in av_read_frame */
+} DemuxStats;
+
+typedef struct DemuxReader DemuxReader;
+
+/**
+ * Start a thread reading packets of stream_index from fctx into a queue
+ * bounded by max_packets and max_bytes. fctx belongs to the thread until
+ * demux_close().
+ */
+DemuxReader *demux_open(AVFormatContext *fctx, int stream_index,
+        int max_packets, int max_bytes);
+
+/**
+ * Take the next packet, waiting for the reader if the queue is empty.
+ * The packet is the caller's, free it with av_free_packet().
+ *
+ * @return 0, or a negative value at the end of the input
+ */
+int demux_read(DemuxReader *r, AVPacket *pkt);
+
+void demux_get_stats(DemuxReader *r, DemuxStats *stats);
+
+/* stop the reader, drop what is queued, print the stats */
+void demux_close(DemuxReader *r);
+
+/**
+ * av_read_frame() slowed down by demux_set_read_delay(), used by the
+ * reader thread and by callers reading directly, so both can be compared
+ * on simulated slow media.
+ */
+int demux_read_frame(AVFormatContext *fctx, AVPacket *pkt);
+void demux_set_read_delay(int us);
+
+/**
+ * Decode all of filename with libdm365_h264 twice, reading packets on the
+ * decoding thread and through a read-ahead queue of max_packets, and
+ * print the frame rate of both.
+ */
+int decode_benchmark(const char *filename, int max_packets);
+
+#endif /* DEMUX_H */
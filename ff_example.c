@@ -28,21 +28,49 @@
 #include <string.h>
 #include <math.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 
-#include <xdc/std.h>
-#include <ti/sdo/ce/CERuntime.h>
-
 #include "cmem.h"
+#include "cmem_acct.h"
+#include "cmem_plan.h"
+#include "ce_session.h"
+#include "frame_pool.h"
+#include "pattern.h"
+#include "scale.h"
+#include "snapshot_sink.h"
+#include "snapshot_enc.h"
+#include "image_dump.h"
+#include "async_io.h"
+#include "segment.h"
+#include "preroll.h"
+#include "demux.h"
+#include "rate_ctl.h"
+#include "deadline.h"
+#include "change_detect.h"
+#include "pipeline.h"
+#include "channel.h"
+#include "transcode.h"
+#include "bench.h"
+#include "stats.h"
+#include "timeutil.h"
 
 #undef exit
 
 /* 5 seconds stream duration */
 #define STREAM_DURATION   2.0
 #define STREAM_FRAME_RATE 5
-#define STREAM_NB_FRAMES  ((int)(STREAM_DURATION * STREAM_FRAME_RATE))
+
+/* frames preallocated for each picture format used by the encoder */
+#define VIDEO_POOL_FRAMES 2
+
+/* encoder output buffer, an upper bound for any encoded picture */
+#define VIDEO_OUTBUF_SIZE (3 * 1024 * 1024)
+
+/* encoded snapshots waiting for the writer thread */
+#define SNAPSHOT_QUEUE_DEPTH 4
 
 
 /**************************************************************/
@@ -50,14 +78,57 @@
 static AVFrame *picture, *tmp_picture;
 static uint8_t *video_outbuf;
 static int frame_count, video_outbuf_size;
+/* CPU time spent preparing pictures, to compare cached/noncached buffers */
+static int64_t video_cpu_us;
+static enum PatternType video_pattern = PATTERN_GRADIENT;
+static enum ScaleMode thumb_scale_mode = SCALE_POINT;
+static SnapshotSink *snapshot_sink;
+static int snapshot_every = 1;
+/* ring depth between the pipeline stages, 0 runs everything serially */
+static int pipeline_depth;
+/* muxer output ring drained by a writer thread, 0 for plain avio_open */
+static int io_ring_size = ASYNC_IO_DEFAULT_RING;
+static int io_flags;
+/* record into segments instead of one file, see segment.h */
+static SegmentConfig segment_cfg;
+static SegmentWriter *segments;
+static double stream_duration = STREAM_DURATION;
+/* keep the stream in memory and write only events, see preroll.h */
+static PrerollConfig preroll_cfg;
+static PrerollBuffer *preroll;
+/* adapt bitrate and quantizer to the encoder and the writer, see rate_ctl.h */
+static RateControlConfig rate_cfg;
+static RateControl *rate_ctl;
+static AVIOContext *writer_pb;
+/* run in real time and shed frames to keep the latency bounded */
+static DeadlineConfig deadline_cfg;
+static Deadline *deadline;
+/* leave out frames that show nothing new, see change_detect.h */
+static ChangeConfig change_cfg;
+static ChangeDetector *changes;
+/* packets read ahead of the decoder, 0 reads on the decoding thread */
+static int readahead_packets = DEMUX_DEFAULT_PACKETS;
+/* decoded frames go into this one file instead of one file each */
+static const char *dump_archive;
 static CMEM_AllocParams alloc_params = {
         .type = CMEM_HEAP,
         .alignment = 32,
         .flags = CMEM_NONCACHED,
 };
 
+/* the stream ff_example() writes to test.avi */
+static const ChannelConfig test_stream = {
+    .codec_id = CODEC_ID_MJPEG,
+    .width = 640,
+    .height = 480,
+    .fps = STREAM_FRAME_RATE,
+    .bit_rate = 100000,
+    .gop_size = 12,
+    .filename = "test.avi",
+};
+
 /* add a video output stream */
-static AVStream *add_video_stream(AVFormatContext *oc, enum CodecID codec_id)
+static AVStream *add_video_stream(AVFormatContext *oc, const ChannelConfig *cfg)
 {
     AVCodecContext *c;
     AVStream *st;
@@ -69,21 +140,21 @@ static AVStream *add_video_stream(AVFormatContext *oc, enum CodecID codec_id)
     }
 
     c = st->codec;
-    c->codec_id = codec_id;
+    c->codec_id = cfg->codec_id;
     c->codec_type = AVMEDIA_TYPE_VIDEO;
 
     /* put sample parameters */
-    c->bit_rate = 100000;
+    c->bit_rate = cfg->bit_rate;
     /* resolution must be a multiple of two */
-    c->width = 640;
-    c->height = 480;
+    c->width = cfg->width;
+    c->height = cfg->height;
     /* time base: this is the fundamental unit of time (in seconds) in terms
        of which frame timestamps are represented. for fixed-fps content,
        timebase should be 1/framerate and timestamp increments should be
        identically 1. */
-    c->time_base.den = 5000;
-    c->time_base.num = 1000;
-    c->gop_size = 12; /* emit one intra frame every twelve frames at most */
+    c->time_base.den = cfg->fps;
+    c->time_base.num = 1;
+    c->gop_size = cfg->gop_size; /* emit one intra frame every gop_size frames at most */
     c->pix_fmt = PIX_FMT_NV12;
     c->mpeg_quant = 20;
 
@@ -94,24 +165,22 @@ static AVStream *add_video_stream(AVFormatContext *oc, enum CodecID codec_id)
     return st;
 }
 
-static AVFrame *alloc_picture(enum PixelFormat pix_fmt, int width, int height)
+/*
+ * Frames in the encoder's pool. open_video() keeps one as picture for
+ * good; the pipeline needs depth + 2 more: a full frames ring, one being
+ * encoded and one being produced.
+ */
+static int video_pool_frames(void)
 {
-    AVFrame *picture;
-    uint8_t *picture_buf;
-    int size;
+    if (pipeline_depth > 0)
+        return VIDEO_POOL_FRAMES + pipeline_depth + 1;
+    return VIDEO_POOL_FRAMES;
+}
 
-    picture = avcodec_alloc_frame();
-    if (!picture)
-        return NULL;
-    size = avpicture_get_size(pix_fmt, width, height);
-    picture_buf = CMEM_alloc(size, &alloc_params);
-    if (!picture_buf) {
-        av_free(picture);
-        return NULL;
-    }
-    avpicture_fill((AVPicture *)picture, picture_buf,
-                   pix_fmt, width, height);
-    return picture;
+/* pictures come from the CMEM frame pools, release them with frame_pool_unref */
+static AVFrame *alloc_picture(enum PixelFormat pix_fmt, int width, int height)
+{
+    return frame_pool_alloc(pix_fmt, width, height);
 }
 
 static void open_video(AVFormatContext *oc, AVStream *st)
@@ -146,8 +215,23 @@ static void open_video(AVFormatContext *oc, AVStream *st)
            as long as they're aligned enough for the architecture, and
            they're freed appropriately (such as using av_free for buffers
            allocated with av_malloc) */
-        video_outbuf_size = 3*1024*1024;
-        video_outbuf = CMEM_alloc(video_outbuf_size, &alloc_params);
+        video_outbuf_size = VIDEO_OUTBUF_SIZE;
+        video_outbuf = cmem_acct_alloc("video outbuf", video_outbuf_size,
+                &alloc_params);
+    }
+
+    /* preallocate the picture buffers once, they are recycled from now on */
+    if (!frame_pool_find(c->pix_fmt, c->width, c->height) &&
+            !frame_pool_create(c->pix_fmt, c->width, c->height,
+                    video_pool_frames())) {
+        fprintf(stderr, "Could not create frame pool\n");
+        exit(1);
+    }
+    if (!pattern_supported(c->pix_fmt) &&
+            !frame_pool_find(PIX_FMT_YUV420P, c->width, c->height) &&
+            !frame_pool_create(PIX_FMT_YUV420P, c->width, c->height, VIDEO_POOL_FRAMES)) {
+        fprintf(stderr, "Could not create frame pool\n");
+        exit(1);
     }
 
     /* allocate the encoded raw picture */
@@ -157,11 +241,11 @@ static void open_video(AVFormatContext *oc, AVStream *st)
         exit(1);
     }
 
-    /* if the output format is not YUV420P, then a temporary YUV420P
-       picture is needed too. It is then converted to the required
-       output format */
+    /* if the test pattern can't be drawn in the output format directly,
+       then a temporary YUV420P picture is needed too. It is then converted
+       to the required output format */
     tmp_picture = NULL;
-    if (c->pix_fmt != PIX_FMT_YUV420P) {
+    if (!pattern_supported(c->pix_fmt)) {
         tmp_picture = alloc_picture(PIX_FMT_YUV420P, c->width, c->height);
         if (!tmp_picture) {
             fprintf(stderr, "Could not allocate temporary picture\n");
@@ -170,38 +254,14 @@ static void open_video(AVFormatContext *oc, AVStream *st)
     }
 }
 
-/* prepare a dummy image */
-static void fill_yuv_image(AVFrame *pict, int frame_index, int width, int height)
+/* draw picture number frame_index in the codec's pixel format */
+static int prepare_picture(AVCodecContext *c, AVFrame *pict, int frame_index)
 {
-    int x, y, i;
-
-    i = frame_index;
-
-    /* Y */
-    for(y=0;y<height;y++) {
-        for(x=0;x<width;x++) {
-            pict->data[0][y * pict->linesize[0] + x] = x + y + i * 3;
-        }
-    }
-
-    /* Cb and Cr */
-    for(y=0;y<height/2;y++) {
-        for(x=0;x<width/2;x++) {
-            pict->data[1][y * pict->linesize[1] + x] = 128 + y + i * 2;
-            pict->data[2][y * pict->linesize[2] + x] = 64 + x + i * 5;
-        }
-    }
-}
-
-static int write_video_frame(AVFormatContext *oc, AVStream *st)
-{
-    int out_size, ret;
-    AVCodecContext *c;
     static struct SwsContext *sctx = NULL;
+    int64_t t0, t1;
 
-    c = st->codec;
-
-    if (c->pix_fmt != PIX_FMT_YUV420P) {
+    t0 = time_now_us();
+    if (tmp_picture) {
         if (sctx == NULL) {
             sctx = sws_getContext(c->width, c->height, PIX_FMT_YUV420P,
                     c->width, c->height, c->pix_fmt,
@@ -210,72 +270,277 @@ static int write_video_frame(AVFormatContext *oc, AVStream *st)
                 return -1;
         }
 
-        fill_yuv_image(tmp_picture, frame_count, c->width, c->height);
+        pattern_fill(tmp_picture, PIX_FMT_YUV420P, c->width, c->height,
+                frame_index, video_pattern);
+        t1 = stats_lap(STATS_PATTERN, t0);
         sws_scale(sctx, (const uint8_t * const *) tmp_picture->data, tmp_picture->linesize,
-                0, c->height, picture->data, picture->linesize);
+                0, c->height, pict->data, pict->linesize);
+        t1 = stats_lap(STATS_SWS, t1);
     } else {
-        fill_yuv_image(picture, frame_count, c->width, c->height);
+        pattern_fill(pict, c->pix_fmt, c->width, c->height,
+                frame_index, video_pattern);
+        t1 = stats_lap(STATS_PATTERN, t0);
     }
+    video_cpu_us += t1 - t0;
 
+    /* hand the picture over to the codec, tmp_picture never leaves the CPU */
+    frame_pool_sync_for_device(pict, FRAME_PLANES_ALL);
 
-    /* encode the image */
-    out_size = avcodec_encode_video(c, video_outbuf, video_outbuf_size, picture);
-    /* if zero size, it means the image was buffered */
-    if (out_size > 0) {
-        AVPacket pkt;
-        FILE *ff = fopen("xx.jpeg", "w+");
+    return 0;
+}
 
-        av_init_packet(&pkt);
+/* the fullest queue between the encoder and the disk, none is size 0 */
+static void writer_queue(const PipelinePacket *pkt, RateControlSample *s)
+{
+    AsyncIOStats as;
+    SegmentStats ss;
+
+    s->queue_fill = 0;
+    s->queue_size = 0;
+    if (writer_pb) {
+        async_io_get_stats(writer_pb, &as);
+        s->queue_fill = as.fill;
+        s->queue_size = as.ring_size;
+        s->stall_us = as.stall_us;
+    } else if (segments || preroll) {
+        if (preroll)
+            preroll_get_segment_stats(preroll, &ss);
+        else
+            segment_get_stats(segments, &ss);
+        s->queue_fill = ss.io_fill;
+        s->queue_size = ss.io_ring_size;
+        s->stall_us = ss.io_stall_us;
+    }
+    /* a slow muxer backs up the pipeline's packet ring first */
+    if (pkt->queue_size && (!s->queue_size || (int64_t)pkt->queued *
+                s->queue_size > (int64_t)s->queue_fill * pkt->queue_size)) {
+        s->queue_fill = pkt->queued;
+        s->queue_size = pkt->queue_size;
+    }
+}
 
-        if (c->coded_frame->pts != AV_NOPTS_VALUE)
-            pkt.pts= av_rescale_q(c->coded_frame->pts, c->time_base, st->time_base);
-        if(c->coded_frame->key_frame)
-            pkt.flags |= AV_PKT_FLAG_KEY;
-        pkt.stream_index= st->index;
-        pkt.data= video_outbuf;
-        pkt.size= out_size;
-
-        /* write the compressed frame in the media file */
-        ret = av_interleaved_write_frame(oc, &pkt);
+/* writer queue fill in percent, 0 when there is no queue to watch */
+static int writer_queue_percent(const PipelinePacket *pkt)
+{
+    RateControlSample s = { 0 };
 
-        fwrite(video_outbuf, out_size, 1, ff);
-        fclose(ff);
-    } else {
-        ret = 0;
+    writer_queue(pkt, &s);
+    return s.queue_size ? (int)((int64_t)s.queue_fill * 100 / s.queue_size) : 0;
+}
+
+/*
+ * What the deadline policy makes of frame_number. A degraded frame is
+ * encoded at qmax when the codec takes a quantizer per frame (-r with
+ * qmin:qmax); without one, every other degraded frame is skipped instead
+ * so that degrading still takes load off the encoder.
+ */
+static enum DeadlineAction deadline_action(AVCodecContext *c,
+        int frame_number, const PipelinePacket *pkt)
+{
+    enum DeadlineAction action;
+
+    action = deadline_check(deadline, frame_number, writer_queue_percent(pkt));
+    if (action == DEADLINE_DEGRADE && !(c->flags & CODEC_FLAG_QSCALE) &&
+            (frame_number & 1))
+        action = DEADLINE_SKIP;
+    return action;
+}
+
+/* encode pict into pkt->data, pkt->size is 0 when the codec buffered it */
+static int encode_picture(AVStream *st, AVFrame *pict, PipelinePacket *pkt)
+{
+    AVCodecContext *c = st->codec;
+    int64_t t0;
+    int out_size;
+
+    if (rate_ctl)
+        rate_ctl_prepare(rate_ctl, pict);
+    /* frames shed before this leave a gap instead of shifting time */
+    if (deadline || changes)
+        pict->pts = pkt->frame_number;
+    if (pkt->degraded && (c->flags & CODEC_FLAG_QSCALE))
+        pict->quality = c->qmax * FF_QP2LAMBDA;
+    t0 = time_now_us();
+    out_size = avcodec_encode_video(c, pkt->data, pkt->buf_size, pict);
+    t0 = stats_lap(STATS_ENCODE, t0) - t0;
+    if (out_size < 0) {
+        fprintf(stderr, "Error while encoding video frame\n");
+        return -1;
+    }
+
+    if (rate_ctl) {
+        RateControlSample s = {
+            .encode_us = t0,
+            .bytes = out_size,
+        };
+
+        writer_queue(pkt, &s);
+        rate_ctl_update(rate_ctl, &s);
+    }
+
+    pkt->size = out_size;
+    if (out_size > 0) {
+        /* the codec wrote the bitstream behind the CPU's back */
+        if (alloc_params.flags == CMEM_CACHED)
+            CMEM_cacheInv(pkt->data, out_size);
+
+        pkt->pts = AV_NOPTS_VALUE;
+        if (c->coded_frame->pts != AV_NOPTS_VALUE)
+            pkt->pts = av_rescale_q(c->coded_frame->pts, c->time_base, st->time_base);
+        pkt->key_frame = c->coded_frame->key_frame;
     }
 
+    return 0;
+}
+
+static int mux_packet(AVFormatContext *oc, AVStream *st, PipelinePacket *ppkt)
+{
+    AVPacket pkt;
+    int64_t t0;
+    int ret;
+
+    av_init_packet(&pkt);
+
+    pkt.pts = ppkt->pts;
+    if (ppkt->key_frame)
+        pkt.flags |= AV_PKT_FLAG_KEY;
+    pkt.stream_index= st->index;
+    pkt.data= ppkt->data;
+    pkt.size= ppkt->size;
+
+    /* write the compressed frame in the media file */
+    t0 = time_now_us();
+    if (preroll)
+        ret = preroll_write(preroll, &pkt);
+    else if (segments)
+        ret = segment_write(segments, &pkt);
+    else
+        ret = av_interleaved_write_frame(oc, &pkt);
+    stats_lap(STATS_MUX, t0);
     if (ret != 0) {
         fprintf(stderr, "Error while writing video frame\n");
         return -1;
     }
 
-    printf("Frame written: %d\n", frame_count);
+    if (deadline)
+        deadline_done(deadline, ppkt->frame_number);
+
+    if (snapshot_sink && !ppkt->degraded)
+        snapshot_sink_push(snapshot_sink, ppkt->data, ppkt->size,
+                ppkt->frame_number);
+
+    printf("Frame written: %d\n", ppkt->frame_number);
+    return 0;
+}
+
+static int write_video_frame(AVFormatContext *oc, AVStream *st)
+{
+    PipelinePacket pkt = {
+        .data = video_outbuf,
+        .buf_size = video_outbuf_size,
+        .frame_number = frame_count,
+    };
+    enum DeadlineAction action = DEADLINE_ENCODE;
+
+    if (deadline) {
+        deadline_wait(deadline, frame_count);
+        action = deadline_action(st->codec, frame_count, &pkt);
+        if (action == DEADLINE_DROP) {
+            frame_count++;
+            return 0;
+        }
+        pkt.degraded = action == DEADLINE_DEGRADE;
+    }
+
+    if (prepare_picture(st->codec, picture, frame_count) < 0)
+        return -1;
+
+    /* the picture was taken, but the encoder has no time for it or the
+       scene did not change; the muxer repeats the previous frame */
+    if (action == DEADLINE_SKIP ||
+            (changes && !change_detect(changes, picture->data[0],
+                                       picture->linesize[0]))) {
+        frame_count++;
+        return 0;
+    }
+
+    /* encode the image */
+    if (encode_picture(st, picture, &pkt) < 0)
+        return -1;
+
+    /* if zero size, it means the image was buffered */
+    if (pkt.size > 0 && mux_packet(oc, st, &pkt) < 0)
+        return -1;
+
     frame_count++;
 
     return 0;
 }
 
+/* pipeline stages, opaque is the output context with a single stream */
+static int pipeline_produce(void *opaque, AVFrame *frame, int frame_number)
+{
+    AVFormatContext *oc = opaque;
+
+    if (deadline)
+        deadline_wait(deadline, frame_number);
+    return prepare_picture(oc->streams[0]->codec, frame, frame_number);
+}
+
+static int pipeline_encode(void *opaque, AVFrame *frame, PipelinePacket *pkt)
+{
+    AVFormatContext *oc = opaque;
+
+    if (deadline) {
+        switch (deadline_action(oc->streams[0]->codec, pkt->frame_number,
+                    pkt)) {
+        case DEADLINE_DROP:
+        case DEADLINE_SKIP:
+            return 0;
+        case DEADLINE_DEGRADE:
+            pkt->degraded = 1;
+            break;
+        default:
+            break;
+        }
+    }
+    if (changes && !change_detect(changes, frame->data[0], frame->linesize[0]))
+        return 0;
+    return encode_picture(oc->streams[0], frame, pkt);
+}
+
+static int pipeline_mux(void *opaque, PipelinePacket *pkt)
+{
+    AVFormatContext *oc = opaque;
+
+    return mux_packet(oc, oc->streams[0], pkt);
+}
+
+static const PipelineOps pipeline_ops = {
+    .produce = pipeline_produce,
+    .encode = pipeline_encode,
+    .mux = pipeline_mux,
+};
+
 static void close_video(AVFormatContext *oc, AVStream *st)
 {
     avcodec_close(st->codec);
-    CMEM_free(picture->data[0], &alloc_params);
-    av_free(picture);
-    if (tmp_picture) {
-        CMEM_free(tmp_picture->data[0], &alloc_params);
-        av_free(tmp_picture);
-    }
-    CMEM_free(video_outbuf, &alloc_params);
+    frame_pool_unref(picture);
+    frame_pool_unref(tmp_picture);
+    cmem_acct_free(video_outbuf);
 }
 
 /**************************************************************/
 /* media file output */
 
-int ff_example(const char *filename, const char *format)
+int ff_example(const ChannelConfig *cfg, const char *format)
 {
+    const char *filename = cfg->filename;
     AVOutputFormat *fmt;
     AVFormatContext *oc;
     AVStream *video_st;
     double video_pts;
+    int nb_frames = (int)(stream_duration * cfg->fps);
     int i;
 
     fmt = av_guess_format(format, NULL, NULL);
@@ -284,7 +549,7 @@ int ff_example(const char *filename, const char *format)
         exit(1);
     }
 
-    fmt->video_codec = CODEC_ID_MJPEG;
+    fmt->video_codec = cfg->codec_id;
 
     /* allocate the output media context */
     oc = avformat_alloc_context();
@@ -297,40 +562,140 @@ int ff_example(const char *filename, const char *format)
 
     video_st = NULL;
     if (fmt->video_codec != CODEC_ID_NONE)
-        video_st = add_video_stream(oc, fmt->video_codec);
+        video_st = add_video_stream(oc, cfg);
 
     av_dump_format(oc, 0, filename, 1);
 
+    if (video_st && rate_cfg.max_bit_rate) {
+        rate_ctl = rate_ctl_open(&rate_cfg, video_st->codec);
+        if (!rate_ctl) {
+            fprintf(stderr, "Could not start rate control\n");
+            exit(1);
+        }
+    }
+
+    if (video_st && deadline_cfg.max_latency_us) {
+        deadline = deadline_open(&deadline_cfg, video_st->codec->time_base);
+        if (!deadline) {
+            fprintf(stderr, "Memory error\n");
+            exit(1);
+        }
+    }
+
+    if (video_st && change_cfg.threshold) {
+        changes = change_open(&change_cfg, cfg->width, cfg->height);
+        if (!changes) {
+            fprintf(stderr, "Could not start change detection\n");
+            exit(1);
+        }
+    }
+
     /* now that all the parameters are set, we can open the audio and
        video codecs and allocate the necessary encode buffers */
     if (video_st)
         open_video(oc, video_st);
 
-    if (avio_open(&oc->pb, filename, URL_WRONLY) < 0) {
-        fprintf(stderr, "Could not open '%s'\n", filename);
-        exit(1);
+    /* a raw picture is the upper bound for a sane encoded one */
+    if (video_st) {
+        AVCodecContext *c = video_st->codec;
+
+        snapshot_sink = snapshot_sink_open("xx.jpeg", snapshot_every,
+                SNAPSHOT_QUEUE_DEPTH,
+                avpicture_get_size(c->pix_fmt, c->width, c->height));
+        if (!snapshot_sink)
+            fprintf(stderr, "Could not start snapshot writer\n");
     }
 
+    if (preroll_cfg.arena_size) {
+        if (io_ring_size > 0)
+            preroll_cfg.io_ring_size = io_ring_size;
+        preroll_cfg.io_flags = io_flags;
+        preroll = preroll_open(&preroll_cfg, oc);
+        if (!preroll) {
+            fprintf(stderr, "Could not allocate the pre-roll buffer\n");
+            exit(1);
+        }
+    } else if (segment_cfg.pattern[0]) {
+        /* oc only describes the stream, the segments are written instead */
+        segment_cfg.io_ring_size = io_ring_size > 0 ? io_ring_size :
+            ASYNC_IO_DEFAULT_RING;
+        segment_cfg.io_flags = io_flags;
+        segments = segment_open(&segment_cfg, oc);
+        if (!segments) {
+            fprintf(stderr, "Could not start recording to '%s'\n",
+                    segment_cfg.pattern);
+            exit(1);
+        }
+    } else {
+        if (io_ring_size > 0)
+            oc->pb = async_io_open(filename, io_ring_size, io_flags);
+        else if (avio_open(&oc->pb, filename, URL_WRONLY) < 0)
+            oc->pb = NULL;
+        if (!oc->pb) {
+            fprintf(stderr, "Could not open '%s'\n", filename);
+            exit(1);
+        }
+        if (io_ring_size > 0)
+            writer_pb = oc->pb;
 
-    /* write the stream header, if any */
-    avformat_write_header(oc, NULL);
+        /* write the stream header, if any */
+        avformat_write_header(oc, NULL);
+    }
 
-    for(;;) {
+    if (pipeline_depth > 0) {
+        PipelineConfig cfg = {
+            .depth = pipeline_depth,
+            .nb_frames = nb_frames + 1,
+            .pool = frame_pool_find(video_st->codec->pix_fmt,
+                    video_st->codec->width, video_st->codec->height),
+            .outbuf_size = video_outbuf_size,
+            .outbuf_params = &alloc_params,
+        };
+        int ret;
+
+        ret = pipeline_run(&cfg, &pipeline_ops, oc);
+        if (ret > 0)
+            frame_count = ret;
+    } else {
+        for(;;) {
 
-        video_pts = (double)video_st->pts.val * video_st->time_base.num / video_st->time_base.den;
-        printf("pts: %f\n", video_pts);
+            video_pts = (double)video_st->pts.val * video_st->time_base.num / video_st->time_base.den;
+            printf("pts: %f\n", video_pts);
 
-        if (frame_count > STREAM_NB_FRAMES)
-            break;
+            if (frame_count > nb_frames)
+                break;
 
-        /* write interleaved audio and video frames */
-        if (write_video_frame(oc, video_st) < 0)
-            break;
+            /* write interleaved audio and video frames */
+            if (write_video_frame(oc, video_st) < 0)
+                break;
+        }
     }
 
     printf("%d frames written\n", frame_count);
 
-    av_write_trailer(oc);
+    snapshot_sink_close(snapshot_sink);
+    snapshot_sink = NULL;
+    rate_ctl_close(rate_ctl);
+    rate_ctl = NULL;
+    deadline_close(deadline);
+    deadline = NULL;
+    change_close(changes);
+    changes = NULL;
+    writer_pb = NULL;
+    if (frame_count)
+        printf("picture preparation: %lld us/frame (%s buffers)\n",
+                (long long)(video_cpu_us / frame_count),
+                alloc_params.flags == CMEM_CACHED ? "cached" : "noncached");
+
+    if (preroll) {
+        preroll_close(preroll);
+        preroll = NULL;
+    } else if (segments) {
+        segment_close(segments);
+        segments = NULL;
+    } else {
+        av_write_trailer(oc);
+    }
 
     /* close each codec */
     if (video_st)
@@ -342,7 +707,12 @@ int ff_example(const char *filename, const char *format)
         av_freep(&oc->streams[i]);
     }
 
-    avio_close(oc->pb);
+    if (oc->pb) {
+        if (io_ring_size > 0)
+            async_io_close(oc->pb);
+        else
+            avio_close(oc->pb);
+    }
 
     /* free the stream */
     av_free(oc);
@@ -350,113 +720,6 @@ int ff_example(const char *filename, const char *format)
     return 0;
 }
 
-static void pgm_save(unsigned char *buf, int wrap, int xsize, int ysize, char *filename)
-{
-    FILE *f;
-    int i;
-
-    f = fopen(filename, "w");
-    fprintf(f, "P5\n%d %d\n%d\n", xsize, ysize, 255);
-    for (i = 0; i < ysize; i++)
-        fwrite(buf + i * wrap, 1, xsize, f);
-    fclose(f);
-}
-
-static int my_scale(const AVPicture *picture, int width, int height,
-        AVPicture *dst_picture, int factor)
-{
-    int i, j;
-
-    for (j = 0; j < height/factor; j++) {
-        uint8_t *src_lineY = picture->data[0] + j*factor * picture->linesize[0];
-        uint8_t *dst_lineY = dst_picture->data[0] + j * dst_picture->linesize[0];
-
-        for (i = 0; i < width/factor; i++) {
-            *(dst_lineY + i) = *(src_lineY + i*factor);
-        }
-    }
-    for (j = 0; j < height/2/factor; j++) {
-        uint8_t *src_lineUV = picture->data[1] + j*factor * picture->linesize[1];
-        uint8_t *dst_lineUV = dst_picture->data[1] + j * dst_picture->linesize[1];
-
-        for (i = 0; i < width/factor; i+=2) {
-            *(dst_lineUV + i) = *(src_lineUV + i*factor);
-            *(dst_lineUV + i+1) = *(src_lineUV + i*factor + 1);
-        }
-    }
-
-    return 0;
-}
-
-static int save_image(const AVPicture *picture, enum PixelFormat pix_fmt,
-        int width, int height, const char *filename)
-{
-    AVCodec *codec;
-    AVCodecContext *avctx;
-    AVFrame *tmp_picture;
-    uint8_t *outbuf;
-    int outbuf_size;
-    int size;
-    FILE *f;
-
-    avctx = avcodec_alloc_context();
-
-    avctx->codec_id = CODEC_ID_BMP;
-    avctx->codec_type = AVMEDIA_TYPE_VIDEO;
-    avctx->width = width;
-    avctx->height = height;
-    avctx->pix_fmt = PIX_FMT_BGR24;
-    avctx->time_base = (AVRational) {1, 1};
-
-    codec = avcodec_find_encoder(avctx->codec_id);
-    if (!codec) {
-        fprintf(stderr, "codec not found\n");
-        return -1;
-    }
-
-    /* open the codec */
-    if (avcodec_open(avctx, codec) < 0) {
-        fprintf(stderr, "could not open codec\n");
-        return -1;
-    }
-
-    if (pix_fmt != PIX_FMT_BGR24) {
-        struct SwsContext *sctx;
-
-        tmp_picture = alloc_picture(PIX_FMT_BGR24, avctx->width, avctx->height);
-        if (!tmp_picture)
-            return -1;
-
-        sctx = sws_getContext(avctx->width, avctx->height, pix_fmt,
-                avctx->width, avctx->height, PIX_FMT_BGR24,
-                SWS_POINT, NULL, NULL, NULL);
-
-        sws_scale(sctx, (const uint8_t * const *) picture->data, picture->linesize,
-                0, avctx->height, tmp_picture->data, tmp_picture->linesize);
-    } else {
-        tmp_picture = (AVFrame *)picture;
-    }
-
-    outbuf_size = 6*1024*1024;
-    outbuf = av_malloc(outbuf_size);
-    if (!outbuf)
-        return AVERROR(ENOMEM);
-
-    f = fopen(filename, "wb");
-    size = avcodec_encode_video(avctx, outbuf, outbuf_size, tmp_picture);
-    fwrite(outbuf, sizeof(uint8_t), size, f);
-    fclose(f);
-
-    if (pix_fmt != PIX_FMT_BGR24) {
-        CMEM_free(tmp_picture->data[0], &alloc_params);
-    }
-    av_free(tmp_picture);
-    av_free(outbuf);
-    av_free(avctx);
-
-    return 0;
-}
-
 static int decode_example(const char *filename)
 {
     AVFormatContext *fctx = NULL;
@@ -464,9 +727,13 @@ static int decode_example(const char *filename)
     AVCodecContext *avctx;
     int video_st = -1;
     int i, got_pic;
-    AVFrame *picture, *tmp_picture;
-    int size;
-    uint8_t *tmp_buf;
+    AVFrame *picture, *tmp_picture = NULL;
+    ScaleContext *sctx = NULL;
+    ImageDump *dump = NULL;
+    DemuxReader *reader = NULL;
+    FramePool *pool;
+    FramePoolStats ps;
+    int factor = 2;
     int ret = 0;
 
     avformat_open_input(&fctx, filename, NULL, NULL);
@@ -483,6 +750,11 @@ static int decode_example(const char *filename)
             break;
         }
     }
+    if (video_st < 0) {
+        fprintf(stderr, "no video stream in '%s'\n", filename);
+        av_close_input_file(fctx);
+        return AVERROR(1);
+    }
 
     avctx = fctx->streams[video_st]->codec;
 
@@ -492,85 +764,427 @@ static int decode_example(const char *filename)
         return AVERROR(1);
     }
 
+    /* decoded pictures land in CMEM and can be handed on without a copy */
+    frame_pool_attach_decoder(avctx);
     if (avcodec_open(avctx, codec) < 0) {
         av_log(avctx, AV_LOG_ERROR, "cannot open codec\n");
         return AVERROR(1);
     }
 
     picture = avcodec_alloc_frame();
-    tmp_picture = avcodec_alloc_frame();
-
-    size = avpicture_get_size(PIX_FMT_YUV420P, avctx->width, avctx->height);
-    tmp_buf = av_malloc(size);
-    if (tmp_buf == NULL) {
+    tmp_picture = frame_pool_alloc(avctx->pix_fmt, avctx->width/factor,
+            avctx->height/factor);
+    if (picture == NULL || tmp_picture == NULL) {
         ret = AVERROR(ENOMEM);
         goto decode_cleanup;
     }
-    avpicture_fill((AVPicture *)tmp_picture, tmp_buf,
-            PIX_FMT_NV12, avctx->width, avctx->height);
+
+    sctx = scale_init(avctx->pix_fmt, avctx->width, avctx->height,
+            avctx->width/factor, avctx->height/factor, thumb_scale_mode);
+    if (sctx == NULL) {
+        av_log(avctx, AV_LOG_ERROR, "cannot scale this picture format\n");
+        ret = AVERROR(EINVAL);
+        goto decode_cleanup;
+    }
+
+    if (readahead_packets > 0) {
+        reader = demux_open(fctx, video_st, readahead_packets,
+                DEMUX_DEFAULT_BYTES);
+        if (reader == NULL) {
+            ret = AVERROR(ENOMEM);
+            goto decode_cleanup;
+        }
+    }
+
+    dump = image_dump_open(dump_archive);
+    if (dump == NULL) {
+        ret = AVERROR(EIO);
+        goto decode_cleanup;
+    }
+
+    /* the BMP snapshot encoder converts into this and keeps it until exit */
+    if (!frame_pool_find(PIX_FMT_BGR24, avctx->width/factor, avctx->height/factor))
+        frame_pool_create(PIX_FMT_BGR24, avctx->width/factor,
+                avctx->height/factor, 1);
 
     for (i = 0; i < 10; i++) {
         AVPacket pkt;
+        int64_t t0;
         int nb;
         char fname[32];
-        int factor = 2;
 
-        if (av_read_frame(fctx, &pkt) < 0)
+        if ((reader ? demux_read(reader, &pkt) :
+                    demux_read_frame(fctx, &pkt)) < 0)
             break;
 
+        t0 = time_now_us();
         nb = avcodec_decode_video2(avctx, picture, &got_pic, &pkt);
+        t0 = stats_lap(STATS_DECODE, t0);
+        av_free_packet(&pkt);
         if (nb < 0) {
             av_log(avctx, AV_LOG_ERROR, "error in decoding\n");
             goto decode_cleanup;
         }
+        if (!got_pic)
+            continue;
         printf("Decoded frame: %d\n", i);
+        if (frame_pool_decoded(picture))
+            frame_pool_sync_for_cpu(frame_pool_decoded(picture),
+                    FRAME_PLANES_ALL);
 
-        my_scale((AVPicture *) picture, avctx->width, avctx->height,
-                (AVPicture *) tmp_picture, factor);
+        scale_picture(sctx, (AVPicture *) picture, (AVPicture *) tmp_picture);
+        stats_lap(STATS_SCALE, t0);
 
         sprintf(fname, "frame%02d.pgm", i+1);
-        pgm_save(picture->data[0], picture->linesize[0],
-                avctx->width, avctx->height, fname);
+        image_dump_pgm(dump, fname, picture->data[0], picture->linesize[0],
+                avctx->width, avctx->height);
 
         sprintf(fname, "frame%02d.bmp", i+1);
-        save_image((AVPicture *)tmp_picture, avctx->pix_fmt,
+        t0 = time_now_us();
+        snapshot_save(dump, (AVPicture *)tmp_picture, avctx->pix_fmt,
                 avctx->width/factor, avctx->height/factor, fname);
+        stats_lap(STATS_SAVE_IMAGE, t0);
     }
 
 decode_cleanup:
+    demux_close(reader);
+    image_dump_close(dump);
+    scale_free(sctx);
     av_free(picture);
-    av_free(tmp_picture->data[0]);
-    av_free(tmp_picture);
-    av_close_input_file(fctx);
+    frame_pool_unref(tmp_picture);
+    /* closing the decoder releases the pictures it still holds */
     avcodec_close(avctx);
+    pool = frame_pool_find(avctx->pix_fmt, avctx->width, avctx->height);
+    av_close_input_file(fctx);
+
+    if (pool) {
+        frame_pool_get_stats(pool, &ps);
+        printf("decoder frames: %d allocated, %u handed out, %u recycled, "
+                "%u fell back to the decoder's own buffers\n", ps.nb_frames,
+                ps.nb_gets, ps.nb_recycled, ps.nb_exhausted);
+    }
     return ret;
 }
 
-#ifdef CE_TEST
-#include <xdc/std.h>
-#include <ti/sdo/ce/CERuntime.h>
-#endif
+/* the CMEM buffers recording test.avi or the channels will take */
+static void plan_cmem(CmemPlan *plan, const ChannelConfig *channels,
+        int nb_channels)
+{
+    const ChannelConfig *cfg = &test_stream;
+    int i, j;
+
+    cmem_plan_init(plan);
+    for (i = 0; i < nb_channels; i++) {
+        cfg = &channels[i];
+        /* channels of one size share a pool of CHANNEL_MAX frames */
+        for (j = 0; j < i; j++) {
+            if (channels[j].width == cfg->width &&
+                    channels[j].height == cfg->height)
+                break;
+        }
+        if (j == i)
+            cmem_plan_add_frames(plan, 0, "channel frames", PIX_FMT_NV12,
+                    cfg->width, cfg->height, CHANNEL_MAX);
+        cmem_plan_add_frames(plan, 0, "channel outbuf", PIX_FMT_NV12,
+                cfg->width, cfg->height, 1);
+    }
+    if (nb_channels)
+        return;
+
+    cmem_plan_add_frames(plan, 0, "video frames", PIX_FMT_NV12, cfg->width,
+            cfg->height, video_pool_frames());
+    cmem_plan_add(plan, 0, "video outbuf", VIDEO_OUTBUF_SIZE, 1);
+    if (pipeline_depth > 0)
+        cmem_plan_add(plan, 0, "pipeline packets", VIDEO_OUTBUF_SIZE,
+                pipeline_depth + 1);
+}
 
-int main()
+static void usage(const char *name)
 {
-    CERuntime_init();
-    CMEM_init();
+    fprintf(stderr, "usage: %s [-c] [-p pattern] [-m mode] [-n N] [-d depth]\n"
+            "       [-W KiB] [-O] [-G segments] [-E preroll]\n"
+            "       [-r rate] [-l latency] [-z change]\n"
+            "       [-i input] [-A archive] [-Q packets] [-L us] [-D]\n"
+            "       [-C channel]... [-t seconds] [-T output [-U substream]]\n"
+            "       [-H file] [-B matrix [-R report]] [-S] [-P]\n"
+            "  -c          use cached CMEM buffers\n"
+            "  -p pattern  static, gradient (default) or noise\n"
+            "  -m mode     thumbnail scaling: point (default), box or bilinear\n"
+            "  -n N        write every Nth encoded frame to xx.jpeg, 0 for none\n"
+            "  -d depth    run produce, encode and mux in threads with rings of\n"
+            "              depth slots between them\n"
+            "  -W KiB      muxer output ring size, 0 writes on the muxing thread\n"
+            "  -O          write the output with O_DIRECT where possible\n"
+            "  -G segments record into pattern:seconds:MiB instead of test.avi,\n"
+            "              e.g. rec%%04d.avi:60:0, rotating at key frames\n"
+            "  -E preroll  keep seconds:post_seconds:KiB[:trigger_file] in memory\n"
+            "              and write event%%04d.avi on SIGUSR2 or a touch of the file\n"
+            "  -r rate     adapt the bitrate within min_kbps:max_kbps[:qmin:qmax]\n"
+            "              to the encode time and the writer queue\n"
+            "  -l latency  run in real time, max_ms[:degrade_ms:skip_ms] from\n"
+            "              capture to mux, degrading, skipping and dropping\n"
+            "              frames to stay within it; degraded frames get qmax\n"
+            "              with -r qmin:qmax, else every other one is skipped\n"
+            "  -z change   encode only frames that changed, given as\n"
+            "              threshold[:min_blocks[:step[:max_skip]]], the mean\n"
+            "              luma difference in 16x16 blocks on every step-th row\n"
+            "  -i input    after encoding, decode input with libdm365_h264\n"
+            "  -A archive  append the decoded frames to archive, indexed in\n"
+            "              archive.idx, instead of a file per frame\n"
+            "  -Q packets  read-ahead queue of the decoder, 0 for none\n"
+            "  -L us       simulate slow media, sleep before every packet read\n"
+            "  -D          benchmark decoding input with and without read-ahead\n"
+            "  -C channel  encode channels concurrently instead of test.avi,\n"
+            "              codec:WxH:fps:bitrate:file, e.g. h264:1280x720:25:2000000:main.avi\n"
+            "  -t seconds  duration of the recording or the channels\n"
+            "  -T output   transcode the -i input instead, codec:bitrate:file,\n"
+            "              e.g. mpeg4:4000000:out.avi\n"
+            "  -U sub      also encode a downscaled substream, WxH:bitrate:file\n"
+            "  -H file     write latency histograms to file (.csv or JSON) at\n"
+            "              exit and on SIGUSR1\n"
+            "  -B matrix   benchmark the encoders over codecs:sizes:bitrates, e.g.\n"
+            "              h264,mpeg4:640x480,1280x720:1000000,4000000\n"
+            "  -R report   write the benchmark results as JSON to report\n"
+            "  -S          benchmark the downscaler against swscale and the\n"
+            "              one pass pyramid against repeated scaling, and exit\n"
+            "  -P          print the cmemk pools= for the streams configured,\n"
+            "              check the running module against it and exit\n",
+            name);
+}
 
-#ifdef CE_TEST
-    CERuntime_init();
-    CERuntime_exit();
-    CERuntime_init();
-    CERuntime_exit();
-#endif
+int main(int argc, char **argv)
+{
+    int opt, ret = 0;
+    int scale_bench = 0;
+    int decode_bench = 0;
+    int print_plan = 0;
+    const char *decode_input = NULL;
+    ChannelConfig channels[CHANNEL_MAX];
+    int nb_channels = 0;
+    double duration = STREAM_DURATION;
+    TranscodeConfig transcode;
+    int do_transcode = 0;
+    BenchConfig bench[BENCH_MAX_CONFIGS];
+    int nb_bench = 0;
+    const char *bench_report = NULL;
+
+    memset(&transcode, 0, sizeof(transcode));
+
+    while ((opt = getopt(argc, argv, "cp:m:n:d:W:OG:E:r:l:z:i:A:Q:L:DC:t:T:U:H:B:R:SP")) != -1) {
+        switch (opt) {
+        case 'c':
+            alloc_params.flags = CMEM_CACHED;
+            frame_pool_set_cached(1);
+            break;
+        case 'p':
+            if (pattern_from_name(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            video_pattern = pattern_from_name(optarg);
+            break;
+        case 'm':
+            if (scale_mode_from_name(optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            thumb_scale_mode = scale_mode_from_name(optarg);
+            break;
+        case 'n':
+            snapshot_every = atoi(optarg);
+            break;
+        case 'd':
+            pipeline_depth = atoi(optarg);
+            break;
+        case 'W':
+            io_ring_size = atoi(optarg) * 1024;
+            break;
+        case 'O':
+            io_flags |= ASYNC_IO_DIRECT;
+            break;
+        case 'G':
+            if (segment_parse(optarg, &segment_cfg) < 0) {
+                fprintf(stderr, "bad segment spec: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'E':
+            if (preroll_parse(optarg, &preroll_cfg) < 0) {
+                fprintf(stderr, "bad pre-roll spec: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            if (rate_ctl_parse(optarg, &rate_cfg) < 0) {
+                fprintf(stderr, "bad rate control spec: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'l':
+            if (deadline_parse(optarg, &deadline_cfg) < 0) {
+                fprintf(stderr, "bad latency spec: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'z':
+            if (change_parse(optarg, &change_cfg) < 0) {
+                fprintf(stderr, "bad change detection spec: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'i':
+            decode_input = optarg;
+            break;
+        case 'A':
+            dump_archive = optarg;
+            break;
+        case 'Q':
+            readahead_packets = atoi(optarg);
+            break;
+        case 'L':
+            demux_set_read_delay(atoi(optarg));
+            break;
+        case 'D':
+            decode_bench = 1;
+            break;
+        case 'C':
+            if (nb_channels == CHANNEL_MAX ||
+                    channel_parse(optarg, &channels[nb_channels]) < 0) {
+                fprintf(stderr, "bad or too many channels: %s\n", optarg);
+                return 1;
+            }
+            nb_channels++;
+            break;
+        case 't':
+            duration = atof(optarg);
+            stream_duration = duration;
+            break;
+        case 'T':
+            if (transcode_parse_output(optarg, &transcode) < 0) {
+                fprintf(stderr, "bad transcode output: %s\n", optarg);
+                return 1;
+            }
+            do_transcode = 1;
+            break;
+        case 'U':
+            if (transcode_parse_sub(optarg, &transcode) < 0) {
+                fprintf(stderr, "bad substream: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'H':
+            if (stats_set_output(optarg) < 0) {
+                fprintf(stderr, "cannot dump latencies to %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'B':
+            nb_bench = bench_parse_matrix(optarg, bench, BENCH_MAX_CONFIGS);
+            if (nb_bench <= 0) {
+                fprintf(stderr, "bad benchmark matrix: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'R':
+            bench_report = optarg;
+            break;
+        case 'S':
+            scale_bench = 1;
+            break;
+        case 'P':
+            print_plan = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* CERuntime and CMEM are set up once for the whole process, the
+       engines stay open between jobs so the codecs never tear CE down */
+    if (ce_session_init() < 0)
+        return 1;
 
     /* initialize libavcodec, and register all codecs and formats */
     av_register_all();
 
-    /* TODO: can't run both yet, some problem with CE init and exit */
-    ff_example("test.avi", "avi");
-//    decode_example("test.mkv");
+    if (scale_bench) {
+        if (scale_benchmark(PIX_FMT_NV12, 1280, 720, 50) < 0)
+            ret = 1;
+        if (scale_benchmark(PIX_FMT_YUV420P, 1280, 720, 50) < 0)
+            ret = 1;
+        scale_pyramid_benchmark(PIX_FMT_NV12, 1280, 720, 50);
+        scale_pyramid_benchmark(PIX_FMT_YUV420P, 1280, 720, 50);
+    } else if (decode_bench) {
+        if (!decode_input) {
+            fprintf(stderr, "-D needs an input given with -i\n");
+            return 1;
+        }
+        if (ce_session_open_engine("decode") < 0)
+            return 1;
+        if (decode_benchmark(decode_input, readahead_packets > 0 ?
+                    readahead_packets : DEMUX_DEFAULT_PACKETS) < 0)
+            ret = 1;
+    } else if (nb_bench) {
+        if (ce_session_open_engine("encode") < 0)
+            return 1;
+        if (bench_run(bench, nb_bench, BENCH_WARMUP_FRAMES, BENCH_FRAMES,
+                    video_pattern, &alloc_params, bench_report) < 0)
+            ret = 1;
+    } else if (do_transcode) {
+        if (!decode_input) {
+            fprintf(stderr, "-T needs an input given with -i\n");
+            return 1;
+        }
+        if (ce_session_open_engine("encode") < 0 ||
+                ce_session_open_engine("decode") < 0)
+            return 1;
+        transcode.input = decode_input;
+        transcode.sub_mode = thumb_scale_mode;
+        transcode.outbuf_params = &alloc_params;
+        if (transcode_run(&transcode) < 0)
+            fprintf(stderr, "transcode of %s failed\n", decode_input);
+    } else {
+        CmemPlan plan;
+        int missing;
+
+        if (ce_session_open_engine("encode") < 0)
+            return 1;
+        if (decode_input && ce_session_open_engine("decode") < 0)
+            return 1;
+
+        /* output buffers move into pools only if the module has them all */
+        plan_cmem(&plan, channels, nb_channels);
+        missing = cmem_plan_validate(&plan);
+        if (print_plan) {
+            cmem_plan_print(&plan);
+            printf("  running module: %d buffers missing\n", missing);
+            return missing ? 1 : 0;
+        }
+        if (!missing)
+            alloc_params.type = CMEM_POOL;
+        else
+            fprintf(stderr, "cmem: %d planned pool buffers missing, output "
+                    "buffers stay on the heap; -P prints the pools=\n",
+                    missing);
+
+        if (nb_channels)
+            channels_run(channels, nb_channels, duration, video_pattern,
+                    &alloc_params);
+        else
+            ff_example(&test_stream, "avi");
+        if (decode_input)
+            decode_example(decode_input);
+    }
 
-    CMEM_exit();
-    CERuntime_exit();
-    return 0;
+    stats_exit();
+    snapshot_encoders_print_stats();
+    snapshot_encoders_free();
+    frame_pool_print_stats();
+    frame_pool_destroy_all();
+    cmem_acct_print_stats();
+
+    ce_session_print_stats();
+    ce_session_exit();
+    return ret;
 }
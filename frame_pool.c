@@ -0,0 +1,440 @@
+/*
+ * Pool of CMEM backed frames
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "cmem.h"
+#include "cmem_acct.h"
+#include "frame_pool.h"
+#include "timeutil.h"
+
+typedef struct FramePoolEntry {
+    FramePool *pool;
+    AVFrame *frame;
+    uint8_t *buf;
+    int heap;               /* buffer came from CMEM_HEAP, not from a pool */
+    int refcount;
+    struct FramePoolEntry *next_free;
+} FramePoolEntry;
+
+struct FramePool {
+    enum PixelFormat pix_fmt;
+    int width, height;
+    int size;
+    int poolid;
+    CMEM_AllocParams pool_params;
+    CMEM_AllocParams heap_params;
+    FramePoolEntry *entries;
+    FramePoolEntry *free_list;
+    pthread_mutex_t lock;
+    FramePoolStats stats;
+    struct FramePool *next;
+};
+
+static FramePool *pools;
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int cmem_flags = CMEM_NONCACHED;
+
+static CMEM_AllocParams pool_params = {
+        .type = CMEM_POOL,
+        .alignment = 0,
+};
+
+static CMEM_AllocParams heap_params = {
+        .type = CMEM_HEAP,
+        .alignment = 32,
+};
+
+void frame_pool_set_cached(int cached)
+{
+    cmem_flags = cached ? CMEM_CACHED : CMEM_NONCACHED;
+}
+
+static void pool_free_buffers(FramePool *pool)
+{
+    int i;
+
+    for (i = 0; i < pool->stats.nb_frames; i++) {
+        FramePoolEntry *e = &pool->entries[i];
+
+        if (e->refcount)
+            fprintf(stderr, "frame pool %dx%d: frame %d still in use\n",
+                    pool->width, pool->height, i);
+        cmem_acct_free(e->buf);
+        av_free(e->frame);
+    }
+}
+
+FramePool *frame_pool_create(enum PixelFormat pix_fmt, int width, int height,
+        int nb_frames)
+{
+    FramePool *pool;
+    int i;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+    pool->entries = calloc(nb_frames, sizeof(*pool->entries));
+    if (!pool->entries) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->pix_fmt = pix_fmt;
+    pool->width = width;
+    pool->height = height;
+    pool->size = avpicture_get_size(pix_fmt, width, height);
+    pool->pool_params = pool_params;
+    pool->pool_params.flags = cmem_flags;
+    pool->heap_params = heap_params;
+    pool->heap_params.flags = cmem_flags;
+    pool->poolid = CMEM_getPool(pool->size);
+    if (pool->poolid < 0)
+        fprintf(stderr, "frame pool %dx%d: no CMEM pool for %d bytes, "
+                "using heap\n", width, height, pool->size);
+    pthread_mutex_init(&pool->lock, NULL);
+
+    for (i = 0; i < nb_frames; i++) {
+        FramePoolEntry *e = &pool->entries[i];
+        int64_t t0, dt;
+
+        t0 = time_now_us();
+        if (pool->poolid >= 0)
+            e->buf = cmem_acct_alloc_pool("frame pool", 0, pool->poolid,
+                    pool->size, &pool->pool_params);
+        if (!e->buf) {
+            e->buf = cmem_acct_alloc("frame pool", pool->size,
+                    &pool->heap_params);
+            e->heap = 1;
+        }
+        dt = time_now_us() - t0;
+
+        e->frame = avcodec_alloc_frame();
+        if (!e->buf || !e->frame) {
+            fprintf(stderr, "frame pool %dx%d: could not allocate frame %d\n",
+                    width, height, i);
+            cmem_acct_free(e->buf);
+            av_free(e->frame);
+            pool_free_buffers(pool);
+            pthread_mutex_destroy(&pool->lock);
+            free(pool->entries);
+            free(pool);
+            return NULL;
+        }
+
+        avpicture_fill((AVPicture *)e->frame, e->buf, pix_fmt, width, height);
+        e->frame->opaque = e;
+        e->pool = pool;
+        e->next_free = pool->free_list;
+        pool->free_list = e;
+
+        pool->stats.nb_frames++;
+        pool->stats.nb_heap += e->heap;
+        pool->stats.alloc_total_us += dt;
+        if (dt > pool->stats.alloc_max_us)
+            pool->stats.alloc_max_us = dt;
+    }
+
+    pthread_mutex_lock(&pools_lock);
+    pool->next = pools;
+    pools = pool;
+    pthread_mutex_unlock(&pools_lock);
+
+    return pool;
+}
+
+FramePool *frame_pool_find(enum PixelFormat pix_fmt, int width, int height)
+{
+    FramePool *pool;
+
+    pthread_mutex_lock(&pools_lock);
+    for (pool = pools; pool; pool = pool->next) {
+        if (pool->pix_fmt == pix_fmt && pool->width == width &&
+                pool->height == height)
+            break;
+    }
+    pthread_mutex_unlock(&pools_lock);
+
+    return pool;
+}
+
+AVFrame *frame_pool_get(FramePool *pool)
+{
+    FramePoolEntry *e;
+    int64_t t0, dt;
+
+    t0 = time_now_us();
+    pthread_mutex_lock(&pool->lock);
+    e = pool->free_list;
+    if (!e) {
+        pool->stats.nb_exhausted++;
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+    pool->free_list = e->next_free;
+    e->next_free = NULL;
+    e->refcount = 1;
+
+    pool->stats.nb_gets++;
+    if (++pool->stats.in_use > pool->stats.max_in_use)
+        pool->stats.max_in_use = pool->stats.in_use;
+    dt = time_now_us() - t0;
+    if (dt > pool->stats.get_max_us)
+        pool->stats.get_max_us = dt;
+    pthread_mutex_unlock(&pool->lock);
+
+    return e->frame;
+}
+
+AVFrame *frame_pool_alloc(enum PixelFormat pix_fmt, int width, int height)
+{
+    FramePool *pool;
+
+    pool = frame_pool_find(pix_fmt, width, height);
+    if (!pool)
+        pool = frame_pool_create(pix_fmt, width, height,
+                FRAME_POOL_DEFAULT_FRAMES);
+    if (!pool)
+        return NULL;
+
+    return frame_pool_get(pool);
+}
+
+AVFrame *frame_pool_ref(AVFrame *frame)
+{
+    FramePoolEntry *e = frame->opaque;
+
+    pthread_mutex_lock(&e->pool->lock);
+    e->refcount++;
+    pthread_mutex_unlock(&e->pool->lock);
+
+    return frame;
+}
+
+void frame_pool_unref(AVFrame *frame)
+{
+    FramePoolEntry *e;
+    FramePool *pool;
+
+    if (!frame)
+        return;
+    e = frame->opaque;
+    pool = e->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    if (--e->refcount == 0) {
+        e->next_free = pool->free_list;
+        pool->free_list = e;
+        pool->stats.in_use--;
+        pool->stats.nb_recycled++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* decoder pictures carry the pool frame behind them in opaque */
+static int decoder_get_buffer(AVCodecContext *avctx, AVFrame *pic)
+{
+    FramePool *pool;
+    AVFrame *frame = NULL;
+    int i;
+
+    pool = frame_pool_find(avctx->pix_fmt, avctx->width, avctx->height);
+    if (!pool)
+        pool = frame_pool_create(avctx->pix_fmt, avctx->width, avctx->height,
+                FRAME_POOL_DECODER_FRAMES);
+    if (pool)
+        frame = frame_pool_get(pool);
+    if (!frame)
+        return avcodec_default_get_buffer(avctx, pic);
+
+    for (i = 0; i < 4; i++) {
+        pic->base[i] = frame->data[i];
+        pic->data[i] = frame->data[i];
+        pic->linesize[i] = frame->linesize[i];
+    }
+    pic->type = FF_BUFFER_TYPE_USER;
+    pic->opaque = frame;
+    pic->age = INT_MAX;
+    pic->reordered_opaque = avctx->reordered_opaque;
+    pic->pkt_pts = avctx->pkt ? avctx->pkt->pts : AV_NOPTS_VALUE;
+
+    return 0;
+}
+
+static void decoder_release_buffer(AVCodecContext *avctx, AVFrame *pic)
+{
+    int i;
+
+    if (pic->type != FF_BUFFER_TYPE_USER) {
+        avcodec_default_release_buffer(avctx, pic);
+        return;
+    }
+    frame_pool_unref(pic->opaque);
+    pic->opaque = NULL;
+    for (i = 0; i < 4; i++)
+        pic->data[i] = NULL;
+}
+
+void frame_pool_attach_decoder(AVCodecContext *avctx)
+{
+    avctx->get_buffer = decoder_get_buffer;
+    avctx->release_buffer = decoder_release_buffer;
+    avctx->reget_buffer = avcodec_default_reget_buffer;
+}
+
+AVFrame *frame_pool_decoded(const AVFrame *pic)
+{
+    if (pic->type != FF_BUFFER_TYPE_USER || !pic->opaque)
+        return NULL;
+    return pic->opaque;
+}
+
+/* size of plane n, planes laid out contiguously by avpicture_fill() */
+static int plane_size(FramePoolEntry *e, int n)
+{
+    AVFrame *f = e->frame;
+
+    if (!f->data[n])
+        return 0;
+    if (n < 3 && f->data[n + 1])
+        return f->data[n + 1] - f->data[n];
+    return e->buf + e->pool->size - f->data[n];
+}
+
+static void sync_planes(AVFrame *frame, unsigned plane_mask, int inv)
+{
+    FramePoolEntry *e = frame->opaque;
+    FramePool *pool = e->pool;
+    unsigned calls = 0;
+    uint64_t bytes = 0;
+    int n;
+
+    if (pool->pool_params.flags != CMEM_CACHED)
+        return;
+
+    for (n = 0; n < 4; n++) {
+        int size;
+
+        if (!(plane_mask & FRAME_PLANE(n)))
+            continue;
+        size = plane_size(e, n);
+        if (!size)
+            continue;
+        if (inv)
+            CMEM_cacheInv(frame->data[n], size);
+        else
+            CMEM_cacheWb(frame->data[n], size);
+        calls++;
+        bytes += size;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (inv)
+        pool->stats.nb_cache_inv += calls;
+    else
+        pool->stats.nb_cache_wb += calls;
+    pool->stats.cache_bytes += bytes;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void frame_pool_sync_for_device(AVFrame *frame, unsigned plane_mask)
+{
+    sync_planes(frame, plane_mask, 0);
+}
+
+void frame_pool_sync_for_cpu(AVFrame *frame, unsigned plane_mask)
+{
+    sync_planes(frame, plane_mask, 1);
+}
+
+void frame_pool_get_stats(FramePool *pool, FramePoolStats *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void frame_pool_print_stats(void)
+{
+    FramePool *pool;
+
+    pthread_mutex_lock(&pools_lock);
+    for (pool = pools; pool; pool = pool->next) {
+        FramePoolStats s;
+
+        frame_pool_get_stats(pool, &s);
+        printf("frame pool %dx%d fmt %d: %d %s frames (%d heap) of %d bytes, "
+                "max in use %d, gets %u, recycled %u, exhausted %u, "
+                "alloc %lld us total / %lld us max, get max %lld us\n",
+                pool->width, pool->height, pool->pix_fmt, s.nb_frames,
+                pool->pool_params.flags == CMEM_CACHED ? "cached" : "noncached",
+                s.nb_heap, pool->size, s.max_in_use, s.nb_gets,
+                s.nb_recycled, s.nb_exhausted, (long long)s.alloc_total_us,
+                (long long)s.alloc_max_us, (long long)s.get_max_us);
+        if (s.nb_cache_wb || s.nb_cache_inv)
+            printf("    cache: %u wb, %u inv, %llu bytes\n", s.nb_cache_wb,
+                    s.nb_cache_inv, (unsigned long long)s.cache_bytes);
+    }
+    pthread_mutex_unlock(&pools_lock);
+}
+
+void frame_pool_destroy(FramePool *pool)
+{
+    FramePool **pp;
+
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pools_lock);
+    for (pp = &pools; *pp; pp = &(*pp)->next) {
+        if (*pp == pool) {
+            *pp = pool->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pools_lock);
+
+    pool_free_buffers(pool);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->entries);
+    free(pool);
+}
+
+void frame_pool_destroy_all(void)
+{
+    FramePool *pool;
+
+    pthread_mutex_lock(&pools_lock);
+    while ((pool = pools)) {
+        pools = pool->next;
+        pool_free_buffers(pool);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->entries);
+        free(pool);
+    }
+    pthread_mutex_unlock(&pools_lock);
+}
@@ -0,0 +1,133 @@
+/*
+ * Pool of CMEM backed frames
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+/* number of frames preallocated when a pool is created on demand */
+#define FRAME_POOL_DEFAULT_FRAMES 2
+
+/* frames in a pool created for a decoder, references plus one in flight */
+#define FRAME_POOL_DECODER_FRAMES 6
+
+typedef struct FramePool FramePool;
+
+typedef struct FramePoolStats {
+    int nb_frames;          /* buffers owned by the pool */
+    int nb_heap;            /* buffers that had to come from CMEM_HEAP */
+    int in_use;             /* buffers handed out right now */
+    int max_in_use;         /* high-water mark of in_use */
+    unsigned nb_gets;       /* successful frame_pool_get() calls */
+    unsigned nb_exhausted;  /* frame_pool_get() calls that found no buffer */
+    unsigned nb_recycled;   /* buffers returned to the pool for reuse */
+    int64_t alloc_total_us; /* time spent in CMEM allocating the buffers */
+    int64_t alloc_max_us;   /* slowest single CMEM allocation */
+    int64_t get_max_us;     /* slowest frame_pool_get() */
+    unsigned nb_cache_wb;   /* CMEM_cacheWb() calls on pool buffers */
+    unsigned nb_cache_inv;  /* CMEM_cacheInv() calls on pool buffers */
+    uint64_t cache_bytes;   /* bytes written back or invalidated */
+} FramePoolStats;
+
+/* plane masks for the cache maintenance functions */
+#define FRAME_PLANE(n)      (1 << (n))
+#define FRAME_PLANES_ALL    0xf
+
+/**
+ * Allocate buffers of pools created from now on as CMEM_CACHED. The CPU
+ * then works on them at full speed, but every handoff between the CPU and
+ * the codec engine has to go through frame_pool_sync_for_device() and
+ * frame_pool_sync_for_cpu().
+ */
+void frame_pool_set_cached(int cached);
+
+/**
+ * Create a pool of nb_frames buffers for pictures of the given format and
+ * size. Buffers are taken from the best fitting CMEM pool (CMEM_getPool()),
+ * CMEM_HEAP is used only when no pool is configured for this size. The pool
+ * is registered and can be found again by frame_pool_find().
+ */
+FramePool *frame_pool_create(enum PixelFormat pix_fmt, int width, int height,
+        int nb_frames);
+
+/* look up a pool created for (pix_fmt, width, height), NULL if none */
+FramePool *frame_pool_find(enum PixelFormat pix_fmt, int width, int height);
+
+/**
+ * Get a free frame from the pool with reference count 1.
+ * Returns NULL and counts the event when all buffers are in use.
+ */
+AVFrame *frame_pool_get(FramePool *pool);
+
+/**
+ * Get a frame from the pool registered for (pix_fmt, width, height),
+ * creating a pool of FRAME_POOL_DEFAULT_FRAMES buffers when none exists yet.
+ */
+AVFrame *frame_pool_alloc(enum PixelFormat pix_fmt, int width, int height);
+
+/* take another reference to a pooled frame */
+AVFrame *frame_pool_ref(AVFrame *frame);
+
+/* drop a reference, the buffer returns to its pool when it reaches zero */
+void frame_pool_unref(AVFrame *frame);
+
+/**
+ * Make the decoder take its pictures from the pool registered for its
+ * (pix_fmt, width, height), created with FRAME_POOL_DECODER_FRAMES buffers
+ * on the first picture. Call before avcodec_open(). Meant for the dm365
+ * decoders, which need no edges around the picture. When the pool is
+ * exhausted the decoder falls back to its own buffers.
+ */
+void frame_pool_attach_decoder(AVCodecContext *avctx);
+
+/**
+ * The pooled frame behind a picture returned by a decoder set up with
+ * frame_pool_attach_decoder(), NULL if it is not pooled. Take a reference
+ * with frame_pool_ref() to keep it past the next decode call.
+ */
+AVFrame *frame_pool_decoded(const AVFrame *pic);
+
+/**
+ * The CPU has written the given planes and the codec is going to read them:
+ * write back exactly those plane ranges. No-op for non-cached pools.
+ */
+void frame_pool_sync_for_device(AVFrame *frame, unsigned plane_mask);
+
+/**
+ * The codec has written the given planes and the CPU is going to read them:
+ * invalidate those plane ranges. No-op for non-cached pools.
+ */
+void frame_pool_sync_for_cpu(AVFrame *frame, unsigned plane_mask);
+
+void frame_pool_get_stats(FramePool *pool, FramePoolStats *stats);
+void frame_pool_print_stats(void);
+
+/* unregister and free one pool, every frame must have been released */
+void frame_pool_destroy(FramePool *pool);
+
+/* free all registered pools, every frame must have been released */
+void frame_pool_destroy_all(void);
+
+#endif /* FRAME_POOL_H */
@@ -0,0 +1,297 @@
+/*
+ * Image dump writer
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "image_dump.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef struct IndexEntry {
+    uint64_t offset;
+    int size;
+    char name[64];
+} IndexEntry;
+
+struct ImageDump {
+    int fd;
+    char name[256];             /* file fd is open on in per file mode */
+    char *archive;
+    uint64_t offset;            /* archive write position */
+    IndexEntry *index;
+    int nb_index, index_size;
+    struct iovec *iov;          /* row batch, grown to the tallest image */
+    int iov_size;
+    char header[32];
+    ImageDumpStats stats;
+};
+
+ImageDump *image_dump_open(const char *archive)
+{
+    ImageDump *d;
+
+    d = calloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+    d->fd = -1;
+
+    if (archive) {
+        d->archive = strdup(archive);
+        d->fd = open(archive, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (!d->archive || d->fd < 0) {
+            fprintf(stderr, "image dump: could not open '%s'\n", archive);
+            free(d->archive);
+            free(d);
+            return NULL;
+        }
+        d->stats.nb_opens++;
+    }
+    return d;
+}
+
+/* writev everything, IOV_MAX entries at a time, resuming short writes */
+static int write_all(ImageDump *d, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t ret = writev(d->fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        d->stats.nb_writev++;
+        while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return 0;
+}
+
+static int add_index(ImageDump *d, const char *name, int size)
+{
+    IndexEntry *e;
+
+    if (d->nb_index == d->index_size) {
+        int n = d->index_size ? d->index_size * 2 : 64;
+        IndexEntry *index = realloc(d->index, n * sizeof(*index));
+
+        if (!index)
+            return -1;
+        d->index = index;
+        d->index_size = n;
+    }
+    e = &d->index[d->nb_index++];
+    e->offset = d->offset;
+    e->size = size;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    return 0;
+}
+
+void image_dump_release(ImageDump *d)
+{
+    if (d->archive || d->fd < 0)
+        return;
+    close(d->fd);
+    d->fd = -1;
+    d->name[0] = 0;
+}
+
+/*
+ * Drop what a failed write left in the archive, so the next image starts
+ * at d->offset again; if that fails too, carry on from where it stopped.
+ */
+static void archive_rewind(ImageDump *d)
+{
+    off_t pos;
+
+    if (ftruncate(d->fd, d->offset) == 0 &&
+            lseek(d->fd, d->offset, SEEK_SET) >= 0)
+        return;
+    pos = lseek(d->fd, 0, SEEK_CUR);
+    if (pos >= 0)
+        d->offset = pos;
+}
+
+int image_dump_writev(ImageDump *d, const char *name, struct iovec *iov,
+        int iovcnt)
+{
+    size_t size = 0;
+    int i, ret;
+
+    for (i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+
+    if (!d->archive) {
+        if (d->fd >= 0 && !strcmp(d->name, name)) {
+            /* same file again, rewrite it in place */
+            if (lseek(d->fd, 0, SEEK_SET) < 0)
+                image_dump_release(d);
+        } else {
+            image_dump_release(d);
+        }
+        if (d->fd < 0) {
+            d->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (d->fd < 0) {
+                fprintf(stderr, "image dump: could not open '%s'\n", name);
+                d->stats.nb_failed++;
+                return -1;
+            }
+            snprintf(d->name, sizeof(d->name), "%s", name);
+            d->stats.nb_opens++;
+        }
+    }
+
+    if (write_all(d, iov, iovcnt) < 0 ||
+            (!d->archive && ftruncate(d->fd, size) < 0)) {
+        fprintf(stderr, "image dump: could not write '%s': %s\n", name,
+                strerror(errno));
+        d->stats.nb_failed++;
+        if (d->archive)
+            archive_rewind(d);
+        image_dump_release(d);
+        return -1;
+    }
+
+    if (d->archive) {
+        /* the bytes are in the archive even if the index has no room */
+        ret = add_index(d, name, size);
+        d->offset += size;
+        if (ret < 0)
+            return -1;
+    }
+    d->stats.nb_images++;
+    d->stats.bytes += size;
+    return 0;
+}
+
+int image_dump_data(ImageDump *d, const char *name, const uint8_t *data,
+        int size)
+{
+    struct iovec iov = { (void *)data, size };
+
+    return image_dump_writev(d, name, &iov, 1);
+}
+
+int image_dump_pgm(ImageDump *d, const char *name, const uint8_t *buf,
+        int wrap, int width, int height)
+{
+    int i, n;
+
+    n = snprintf(d->header, sizeof(d->header), "P5\n%d %d\n%d\n", width,
+            height, 255);
+
+    /* a plane without padding goes out as one buffer */
+    if (wrap == width) {
+        struct iovec iov[2] = {
+            { d->header, n },
+            { (void *)buf, (size_t)width * height },
+        };
+
+        return image_dump_writev(d, name, iov, 2);
+    }
+
+    if (d->iov_size < height + 1) {
+        struct iovec *iov = realloc(d->iov, (height + 1) * sizeof(*iov));
+
+        if (!iov)
+            return -1;
+        d->iov = iov;
+        d->iov_size = height + 1;
+    }
+    d->iov[0].iov_base = d->header;
+    d->iov[0].iov_len = n;
+    for (i = 0; i < height; i++) {
+        d->iov[i + 1].iov_base = (void *)(buf + i * wrap);
+        d->iov[i + 1].iov_len = width;
+    }
+    return image_dump_writev(d, name, d->iov, height + 1);
+}
+
+void image_dump_get_stats(ImageDump *d, ImageDumpStats *stats)
+{
+    *stats = d->stats;
+}
+
+static int write_index(ImageDump *d)
+{
+    char path[300];
+    FILE *f;
+    int i, ok;
+
+    snprintf(path, sizeof(path), "%s.idx", d->archive);
+    f = fopen(path, "w");
+    if (!f)
+        return -1;
+    for (i = 0; i < d->nb_index; i++)
+        fprintf(f, "%llu %d %s\n", (unsigned long long)d->index[i].offset,
+                d->index[i].size, d->index[i].name);
+    ok = !ferror(f);
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+int image_dump_close(ImageDump *d)
+{
+    int ret = 0;
+
+    if (!d)
+        return 0;
+
+    if (d->archive) {
+        if (write_index(d) < 0) {
+            fprintf(stderr, "image dump: could not write the index of '%s'\n",
+                    d->archive);
+            ret = -1;
+        }
+        if (close(d->fd) < 0)
+            ret = -1;
+    } else {
+        image_dump_release(d);
+    }
+
+    printf("image dump%s%s: %u images, %llu bytes, %u writev, %u opens, "
+            "%u failed\n", d->archive ? " " : "",
+            d->archive ? d->archive : "", d->stats.nb_images,
+            (unsigned long long)d->stats.bytes, d->stats.nb_writev,
+            d->stats.nb_opens, d->stats.nb_failed);
+
+    free(d->archive);
+    free(d->index);
+    free(d->iov);
+    free(d);
+    return ret;
+}
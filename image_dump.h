@@ -0,0 +1,74 @@
+/*
+ * Image dump writer
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef IMAGE_DUMP_H
+#define IMAGE_DUMP_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+typedef struct ImageDump ImageDump;
+
+typedef struct ImageDumpStats {
+    unsigned nb_images;
+    uint64_t bytes;
+    unsigned nb_writev;         /* write system calls */
+    unsigned nb_opens;
+    unsigned nb_failed;
+} ImageDumpStats;
+
+/**
+ * Open an image writer. Every image is gathered into writev() batches of
+ * header and rows straight from the picture, never copied into a stdio
+ * buffer.
+ *
+ * @param archive  NULL to write one file per image, otherwise all images
+ *                 are appended to this file and "offset size name" lines
+ *                 are written to archive.idx at image_dump_close()
+ */
+ImageDump *image_dump_open(const char *archive);
+
+/* write iovcnt buffers as the image called name */
+int image_dump_writev(ImageDump *d, const char *name, struct iovec *iov,
+        int iovcnt);
+
+/* write an already encoded image */
+int image_dump_data(ImageDump *d, const char *name, const uint8_t *data,
+        int size);
+
+/* write a plane of width x height bytes, wrap apart, as binary PGM */
+int image_dump_pgm(ImageDump *d, const char *name, const uint8_t *buf,
+        int wrap, int width, int height);
+
+/**
+ * In per file mode the last file stays open and is rewritten in place if
+ * the next image has the same name. Close it now, e.g. before renaming it.
+ */
+void image_dump_release(ImageDump *d);
+
+void image_dump_get_stats(ImageDump *d, ImageDumpStats *stats);
+
+/* write the archive index, close everything, print the stats */
+int image_dump_close(ImageDump *d);
+
+#endif /* IMAGE_DUMP_H */
@@ -0,0 +1,207 @@
+/*
+ * Synthetic test pictures in the encoder's native format
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "pattern.h"
+#include "swar.h"
+
+static const char * const pattern_names[] = {
+    [PATTERN_STATIC]   = "static",
+    [PATTERN_GRADIENT] = "gradient",
+    [PATTERN_NOISE]    = "noise",
+};
+
+int pattern_from_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(pattern_names) / sizeof(pattern_names[0]); i++) {
+        if (!strcmp(name, pattern_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+int pattern_supported(enum PixelFormat pix_fmt)
+{
+    switch (pix_fmt) {
+    case PIX_FMT_YUV420P:
+    case PIX_FMT_YUVJ420P:
+    case PIX_FMT_NV12:
+    case PIX_FMT_UYVY422:
+    case PIX_FMT_YUYV422:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* write len bytes as the word sequence w, w + step, w + 2*step, ... */
+static void fill_row(uint8_t *dst, int len, uint32_t w, uint32_t step)
+{
+    int aligned = swar_aligned(dst);
+    int n;
+
+    for (n = len >> 2; n > 0; n--) {
+        swar_store(dst, w, aligned);
+        dst += 4;
+        w = swar_add8(w, step);
+    }
+    if (len & 3)
+        memcpy(dst, &w, len & 3);
+}
+
+static inline uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void fill_row_noise(uint8_t *dst, int len, uint32_t *state)
+{
+    int aligned = swar_aligned(dst);
+    uint32_t w;
+    int n;
+
+    for (n = len >> 2; n > 0; n--) {
+        swar_store(dst, xorshift32(state), aligned);
+        dst += 4;
+    }
+    if (len & 3) {
+        w = xorshift32(state);
+        memcpy(dst, &w, len & 3);
+    }
+}
+
+static void fill_noise(AVFrame *pict, enum PixelFormat pix_fmt, int width,
+        int height, int frame_index)
+{
+    uint32_t state = 0x9e3779b9u ^ (uint32_t)frame_index * 2654435761u;
+    int y;
+
+    if (!state)
+        state = 1;
+
+    switch (pix_fmt) {
+    case PIX_FMT_YUV420P:
+    case PIX_FMT_YUVJ420P:
+        for (y = 0; y < height; y++)
+            fill_row_noise(pict->data[0] + y * pict->linesize[0], width, &state);
+        for (y = 0; y < height / 2; y++) {
+            fill_row_noise(pict->data[1] + y * pict->linesize[1], width / 2, &state);
+            fill_row_noise(pict->data[2] + y * pict->linesize[2], width / 2, &state);
+        }
+        break;
+    case PIX_FMT_NV12:
+        for (y = 0; y < height; y++)
+            fill_row_noise(pict->data[0] + y * pict->linesize[0], width, &state);
+        for (y = 0; y < height / 2; y++)
+            fill_row_noise(pict->data[1] + y * pict->linesize[1], width, &state);
+        break;
+    default:
+        for (y = 0; y < height; y++)
+            fill_row_noise(pict->data[0] + y * pict->linesize[0], width * 2, &state);
+        break;
+    }
+}
+
+/*
+ * The gradient is the one the example always used:
+ *   Y = x + y + 3i, Cb = 128 + y + 2i, Cr = 64 + x + 5i
+ * with x and y in the plane's own coordinates.
+ */
+int pattern_fill(AVFrame *pict, enum PixelFormat pix_fmt, int width,
+        int height, int frame_index, enum PatternType type)
+{
+    const uint32_t ramp = swar_bytes(0, 1, 2, 3);
+    int i = type == PATTERN_STATIC ? 0 : frame_index;
+    uint8_t cr = 64 + i * 5;
+    int y;
+
+    if (!pattern_supported(pix_fmt))
+        return -1;
+
+    if (type == PATTERN_NOISE) {
+        fill_noise(pict, pix_fmt, width, height, frame_index);
+        return 0;
+    }
+
+    switch (pix_fmt) {
+    case PIX_FMT_YUV420P:
+    case PIX_FMT_YUVJ420P:
+        for (y = 0; y < height; y++)
+            fill_row(pict->data[0] + y * pict->linesize[0], width,
+                    swar_add8(swar_splat8(y + i * 3), ramp), swar_splat8(4));
+        for (y = 0; y < height / 2; y++) {
+            fill_row(pict->data[1] + y * pict->linesize[1], width / 2,
+                    swar_splat8(128 + y + i * 2), 0);
+            fill_row(pict->data[2] + y * pict->linesize[2], width / 2,
+                    swar_add8(swar_splat8(cr), ramp), swar_splat8(4));
+        }
+        break;
+
+    case PIX_FMT_NV12:
+        for (y = 0; y < height; y++)
+            fill_row(pict->data[0] + y * pict->linesize[0], width,
+                    swar_add8(swar_splat8(y + i * 3), ramp), swar_splat8(4));
+        for (y = 0; y < height / 2; y++) {
+            uint8_t cb = 128 + y + i * 2;
+
+            fill_row(pict->data[1] + y * pict->linesize[1], width,
+                    swar_bytes(cb, cr, cb, cr + 1), swar_bytes(0, 2, 0, 2));
+        }
+        break;
+
+    case PIX_FMT_UYVY422:
+        for (y = 0; y < height; y++) {
+            uint8_t luma = y + i * 3;
+            uint8_t cb = 128 + y + i * 2;
+
+            fill_row(pict->data[0] + y * pict->linesize[0], width * 2,
+                    swar_bytes(cb, luma, cr, luma + 1), swar_bytes(0, 2, 1, 2));
+        }
+        break;
+
+    case PIX_FMT_YUYV422:
+        for (y = 0; y < height; y++) {
+            uint8_t luma = y + i * 3;
+            uint8_t cb = 128 + y + i * 2;
+
+            fill_row(pict->data[0] + y * pict->linesize[0], width * 2,
+                    swar_bytes(luma, cb, luma + 1, cr), swar_bytes(2, 0, 2, 1));
+        }
+        break;
+
+    default:
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * Synthetic test pictures in the encoder's native format
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <libavcodec/avcodec.h>
+
+enum PatternType {
+    PATTERN_STATIC,     /* the same picture for every frame */
+    PATTERN_GRADIENT,   /* diagonal gradient moving with the frame index */
+    PATTERN_NOISE,      /* pseudo random, worst case for the encoder */
+};
+
+/* parse "static", "gradient" or "noise", -1 for anything else */
+int pattern_from_name(const char *name);
+
+/* whether pattern_fill() can write pix_fmt directly */
+int pattern_supported(enum PixelFormat pix_fmt);
+
+/**
+ * Draw frame number frame_index of the pattern into pict. Rows are built
+ * a 32-bit word at a time. Width must be even.
+ *
+ * @return 0 on success, -1 if pix_fmt is not supported
+ */
+int pattern_fill(AVFrame *pict, enum PixelFormat pix_fmt, int width,
+        int height, int frame_index, enum PatternType type);
+
+#endif /* PATTERN_H */
@@ -0,0 +1,278 @@
+/*
+ * Threaded produce, encode and mux pipeline
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cmem_acct.h"
+#include "pipeline.h"
+#include "ring.h"
+#include "timeutil.h"
+
+typedef struct StageStats {
+    const char *name;
+    int64_t busy_us;        /* inside the stage callback */
+    int64_t wait_us;        /* blocked on a ring or the frame pool */
+    int64_t wall_us;
+    unsigned nb_items;
+} StageStats;
+
+typedef struct Pipeline {
+    const PipelineConfig *cfg;
+    const PipelineOps *ops;
+    void *opaque;
+    Ring frames;            /* produce -> encode, AVFrame *, NULL ends */
+    Ring packets;           /* encode -> mux, PipelinePacket *, NULL ends */
+    Ring free_packets;      /* mux -> encode */
+    PipelinePacket *slots;
+    volatile int abort;
+    int nb_muxed;
+    StageStats stats[3];
+} Pipeline;
+
+static void *produce_thread(void *arg)
+{
+    Pipeline *p = arg;
+    StageStats *st = &p->stats[0];
+    int64_t start = time_now_us(), t0;
+    int i;
+
+    for (i = 0; i < p->cfg->nb_frames && !p->abort; i++) {
+        AVFrame *frame;
+
+        /* the rings bound the frames in flight to depth + 2, the pool
+           must have that many free (PipelineConfig.pool) */
+        frame = frame_pool_get(p->cfg->pool);
+        if (!frame) {
+            fprintf(stderr, "pipeline: frame pool exhausted\n");
+            p->abort = 1;
+            break;
+        }
+
+        t0 = time_now_us();
+        if (p->ops->produce(p->opaque, frame, i) < 0) {
+            frame_pool_unref(frame);
+            p->abort = 1;
+            break;
+        }
+        st->busy_us += time_now_us() - t0;
+        st->nb_items++;
+
+        t0 = time_now_us();
+        ring_push(&p->frames, frame);
+        st->wait_us += time_now_us() - t0;
+    }
+    ring_push(&p->frames, NULL);
+
+    st->wall_us = time_now_us() - start;
+    return NULL;
+}
+
+static void *encode_thread(void *arg)
+{
+    Pipeline *p = arg;
+    StageStats *st = &p->stats[1];
+    int64_t start = time_now_us(), t0;
+    int frame_number = 0;
+
+    for (;;) {
+        PipelinePacket *pkt;
+        AVFrame *frame;
+        int ret;
+
+        t0 = time_now_us();
+        frame = ring_pop(&p->frames);
+        st->wait_us += time_now_us() - t0;
+        if (!frame)
+            break;
+        if (p->abort) {
+            frame_pool_unref(frame);
+            continue;
+        }
+
+        t0 = time_now_us();
+        pkt = ring_pop(&p->free_packets);
+        st->wait_us += time_now_us() - t0;
+
+        pkt->size = 0;
+        pkt->pts = AV_NOPTS_VALUE;
+        pkt->key_frame = 0;
+        pkt->frame_number = frame_number++;
+        pkt->degraded = 0;
+        pkt->queued = ring_count(&p->packets);
+        pkt->queue_size = p->packets.size;
+
+        t0 = time_now_us();
+        ret = p->ops->encode(p->opaque, frame, pkt);
+        st->busy_us += time_now_us() - t0;
+        st->nb_items++;
+        frame_pool_unref(frame);
+
+        /* only the mux stage returns slots to free_packets, the rings
+           have a single producer; a failed packet goes through empty */
+        if (ret < 0) {
+            p->abort = 1;
+            pkt->size = 0;
+        }
+
+        /* buffered frames still go through so the mux stage counts them */
+        t0 = time_now_us();
+        ring_push(&p->packets, pkt);
+        st->wait_us += time_now_us() - t0;
+    }
+    ring_push(&p->packets, NULL);
+
+    st->wall_us = time_now_us() - start;
+    return NULL;
+}
+
+static void *mux_thread(void *arg)
+{
+    Pipeline *p = arg;
+    StageStats *st = &p->stats[2];
+    int64_t start = time_now_us(), t0;
+
+    for (;;) {
+        PipelinePacket *pkt;
+
+        t0 = time_now_us();
+        pkt = ring_pop(&p->packets);
+        st->wait_us += time_now_us() - t0;
+        if (!pkt)
+            break;
+
+        if (pkt->size > 0 && !p->abort) {
+            t0 = time_now_us();
+            if (p->ops->mux(p->opaque, pkt) < 0)
+                p->abort = 1;
+            else
+                p->nb_muxed++;
+            st->busy_us += time_now_us() - t0;
+            st->nb_items++;
+        }
+
+        ring_push(&p->free_packets, pkt);
+    }
+
+    st->wall_us = time_now_us() - start;
+    return NULL;
+}
+
+static void print_stats(Pipeline *p)
+{
+    Ring *rings[2] = { &p->frames, &p->packets };
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        StageStats *st = &p->stats[i];
+
+        printf("pipeline %-7s: %u items, busy %lld us (%d%%), "
+                "waiting %lld us\n", st->name, st->nb_items,
+                (long long)st->busy_us,
+                st->wall_us ? (int)(st->busy_us * 100 / st->wall_us) : 0,
+                (long long)st->wait_us);
+    }
+    for (i = 0; i < 2; i++) {
+        printf("pipeline %s ring: depth %u, average fill %d%%, max %u\n",
+                i ? "packet" : "frame", rings[i]->size,
+                ring_fill_percent(rings[i]), rings[i]->fill_max);
+    }
+}
+
+int pipeline_run(const PipelineConfig *cfg, const PipelineOps *ops,
+        void *opaque)
+{
+    Pipeline *p;
+    pthread_t threads[2];
+    int nb_slots = cfg->depth + 1;
+    int encode_started = 1;
+    int i, ret;
+
+    p = calloc(1, sizeof(*p));
+    if (!p)
+        return -1;
+    p->cfg = cfg;
+    p->ops = ops;
+    p->opaque = opaque;
+    p->stats[0].name = "produce";
+    p->stats[1].name = "encode";
+    p->stats[2].name = "mux";
+
+    /* one more packet slot than ring entries so encode never waits on mux
+       while mux holds one */
+    p->slots = calloc(nb_slots, sizeof(*p->slots));
+    if (!p->slots || ring_init(&p->frames, cfg->depth) < 0 ||
+            ring_init(&p->packets, cfg->depth) < 0 ||
+            ring_init(&p->free_packets, nb_slots) < 0) {
+        ret = -1;
+        goto out;
+    }
+    for (i = 0; i < nb_slots; i++) {
+        p->slots[i].data = cmem_acct_alloc("pipeline packet",
+                cfg->outbuf_size, cfg->outbuf_params);
+        if (!p->slots[i].data) {
+            fprintf(stderr, "pipeline: could not allocate packet buffer\n");
+            ret = -1;
+            goto out;
+        }
+        p->slots[i].buf_size = cfg->outbuf_size;
+        ring_push(&p->free_packets, &p->slots[i]);
+    }
+
+    if (pthread_create(&threads[0], NULL, produce_thread, p)) {
+        ret = -1;
+        goto out;
+    }
+    if (pthread_create(&threads[1], NULL, encode_thread, p)) {
+        /* drain the producer from here, everything ends on the NULLs */
+        p->abort = 1;
+        encode_thread(p);
+        encode_started = 0;
+    }
+    /* the mux stage runs on the calling thread */
+    mux_thread(p);
+
+    pthread_join(threads[0], NULL);
+    if (encode_started)
+        pthread_join(threads[1], NULL);
+
+    print_stats(p);
+    ret = p->abort ? -1 : p->nb_muxed;
+
+out:
+    if (p->slots) {
+        for (i = 0; i < nb_slots; i++)
+            cmem_acct_free(p->slots[i].data);
+    }
+    if (p->frames.slots)
+        ring_destroy(&p->frames);
+    if (p->packets.slots)
+        ring_destroy(&p->packets);
+    if (p->free_packets.slots)
+        ring_destroy(&p->free_packets);
+    free(p->slots);
+    free(p);
+    return ret;
+}
@@ -0,0 +1,76 @@
+/*
+ * Threaded produce, encode and mux pipeline
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+#include "cmem.h"
+#include "frame_pool.h"
+
+typedef struct PipelinePacket {
+    uint8_t *data;          /* CMEM buffer owned by the pipeline */
+    int buf_size;
+    int size;               /* encoded bytes, 0 if the codec buffered */
+    int64_t pts;
+    int key_frame;
+    int frame_number;
+    int degraded;           /* encoded under deadline pressure */
+    int queued;             /* packets waiting for the mux stage */
+    int queue_size;         /* 0 outside of a pipeline */
+} PipelinePacket;
+
+/*
+ * Stage callbacks, each called from its own thread. A negative return
+ * stops the pipeline.
+ */
+typedef struct PipelineOps {
+    /* draw picture number frame_number into frame */
+    int (*produce)(void *opaque, AVFrame *frame, int frame_number);
+    /* encode frame into pkt->data, set pkt->size and friends */
+    int (*encode)(void *opaque, AVFrame *frame, PipelinePacket *pkt);
+    /* write a packet with pkt->size > 0 */
+    int (*mux)(void *opaque, PipelinePacket *pkt);
+} PipelineOps;
+
+typedef struct PipelineConfig {
+    int depth;              /* slots in each ring between two stages */
+    int nb_frames;
+    FramePool *pool;        /* needs at least depth + 2 free frames */
+    int outbuf_size;        /* encoder output buffer per packet slot */
+    CMEM_AllocParams *outbuf_params;
+} PipelineConfig;
+
+/**
+ * Run nb_frames through produce -> encode -> mux with one thread per
+ * stage, connected by rings of frames and packet slots. Prints the
+ * utilization of every stage and the ring occupancy when done.
+ *
+ * @return number of frames muxed or -1 on setup failure
+ */
+int pipeline_run(const PipelineConfig *cfg, const PipelineOps *ops,
+        void *opaque);
+
+#endif /* PIPELINE_H */
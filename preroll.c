@@ -0,0 +1,391 @@
+/*
+ * Pre-roll buffer of encoded packets for event recording
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "async_io.h"
+#include "preroll.h"
+#include "segment.h"
+#include "timeutil.h"
+
+/* how often the trigger file is looked at */
+#define PREROLL_POLL_US 200000
+/* frame rate assumed when the stream does not tell */
+#define PREROLL_DEFAULT_FPS 60
+/* packet table entries on top of what the frame rate calls for */
+#define PREROLL_PACKETS_MARGIN 16
+
+typedef struct PrerollEntry {
+    int offset;
+    int size;
+    int64_t pts;
+    int key_frame;
+} PrerollEntry;
+
+struct PrerollBuffer {
+    PrerollConfig cfg;
+    AVRational time_base;
+    uint8_t *arena;
+    int fill;                   /* bytes of the arena in use */
+    PrerollEntry *entries;
+    int head, count;
+    int tail;                   /* arena offset for the next packet */
+    int need_key;               /* next packet kept must be a key frame */
+    /* events, each one a segment of a writer that keeps the next ready */
+    volatile sig_atomic_t trigger;
+    SegmentWriter *events;
+    int in_event;
+    int64_t event_end_pts;
+    int64_t last_poll_us;
+    time_t trigger_mtime;
+    PrerollStats stats;
+};
+
+static volatile sig_atomic_t signal_trigger;
+
+static void sigusr2_handler(int sig)
+{
+    (void)sig;
+    signal_trigger = 1;
+}
+
+int preroll_parse(const char *spec, PrerollConfig *cfg)
+{
+    int kib, n = -1;
+
+    memset(cfg, 0, sizeof(*cfg));
+    if (sscanf(spec, "%lf:%lf:%d%n", &cfg->seconds, &cfg->post_seconds,
+                &kib, &n) < 3 || n < 0 || cfg->seconds <= 0 ||
+            cfg->post_seconds < 0 || kib <= 0)
+        return -1;
+    if (spec[n] == ':')
+        snprintf(cfg->trigger_file, sizeof(cfg->trigger_file), "%s",
+                spec + n + 1);
+    else if (spec[n])
+        return -1;
+    cfg->arena_size = kib * 1024;
+    snprintf(cfg->pattern, sizeof(cfg->pattern), "event%%04d.avi");
+    cfg->io_ring_size = ASYNC_IO_DEFAULT_RING;
+    return 0;
+}
+
+/* the pre-roll plus the GOP being aged out, in frames of the stream */
+static int packets_needed(const PrerollConfig *cfg, const AVCodecContext *c)
+{
+    double fps = PREROLL_DEFAULT_FPS;
+    int gop = c->gop_size > 0 ? c->gop_size : 1;
+
+    if (c->time_base.num > 0 && c->time_base.den > 0)
+        fps = (double)c->time_base.den / c->time_base.num;
+    return (int)(cfg->seconds * fps + 0.5) + gop + PREROLL_PACKETS_MARGIN;
+}
+
+PrerollBuffer *preroll_open(const PrerollConfig *cfg, AVFormatContext *tmpl)
+{
+    PrerollBuffer *p;
+    SegmentConfig seg;
+    struct sigaction sa;
+    struct stat st;
+
+    p = calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+    p->cfg = *cfg;
+    p->time_base = tmpl->streams[0]->time_base;
+    if (!p->time_base.num)
+        p->time_base = tmpl->streams[0]->codec->time_base;
+    p->need_key = 1;
+    if (!p->cfg.max_packets)
+        p->cfg.max_packets = packets_needed(cfg, tmpl->streams[0]->codec);
+
+    /* everything the buffer will ever hold, allocated once */
+    p->arena = malloc(cfg->arena_size);
+    p->entries = calloc(p->cfg.max_packets, sizeof(*p->entries));
+    if (!p->arena || !p->entries)
+        goto fail;
+
+    /* event files are created and their headers written on the writer's
+       helper thread, starting or ending one is a pointer swap */
+    memset(&seg, 0, sizeof(seg));
+    snprintf(seg.pattern, sizeof(seg.pattern), "%s", cfg->pattern);
+    seg.io_ring_size = cfg->io_ring_size;
+    seg.io_flags = cfg->io_flags;
+    seg.on_demand = 1;
+    p->events = segment_open(&seg, tmpl);
+    if (!p->events)
+        goto fail;
+
+    if (cfg->trigger_file[0] && stat(cfg->trigger_file, &st) == 0)
+        p->trigger_mtime = st.st_mtime;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigusr2_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa, NULL);
+
+    return p;
+
+fail:
+    free(p->arena);
+    free(p->entries);
+    free(p);
+    return NULL;
+}
+
+void preroll_trigger(PrerollBuffer *p)
+{
+    p->trigger = 1;
+}
+
+static int64_t pts_to_us(PrerollBuffer *p, int64_t pts)
+{
+    return av_rescale_q(pts, p->time_base, (AVRational) {1, 1000000});
+}
+
+static PrerollEntry *entry(PrerollBuffer *p, int i)
+{
+    return &p->entries[(p->head + i) % p->cfg.max_packets];
+}
+
+/* drop the n oldest packets */
+static void drop(PrerollBuffer *p, int n)
+{
+    while (n--) {
+        PrerollEntry *e = entry(p, 0);
+
+        p->fill -= e->size;
+        p->head = (p->head + 1) % p->cfg.max_packets;
+        p->count--;
+    }
+    if (!p->count)
+        p->tail = 0;
+}
+
+/* index of the first key frame after the oldest packet, 0 if none */
+static int second_gop(PrerollBuffer *p)
+{
+    int i;
+
+    for (i = 1; i < p->count; i++) {
+        if (entry(p, i)->key_frame)
+            return i;
+    }
+    return 0;
+}
+
+/* arena offset where size bytes fit contiguously, -1 if they don't */
+static int find_space(PrerollBuffer *p, int size)
+{
+    int head_off;
+
+    if (!p->count)
+        return size <= p->cfg.arena_size ? 0 : -1;
+    if (p->count == p->cfg.max_packets)
+        return -1;
+    head_off = entry(p, 0)->offset;
+    if (p->tail >= head_off) {
+        if (size <= p->cfg.arena_size - p->tail)
+            return p->tail;
+        /* leave the end unused and wrap, strictly below head */
+        return size < head_off ? 0 : -1;
+    }
+    return size < head_off - p->tail ? p->tail : -1;
+}
+
+static void buffer_packet(PrerollBuffer *p, const AVPacket *pkt)
+{
+    int key = !!(pkt->flags & AV_PKT_FLAG_KEY);
+    PrerollEntry *e;
+    int off, gop;
+
+    if (p->need_key && !key) {
+        p->stats.nb_skipped++;
+        return;
+    }
+    p->need_key = 0;
+
+    /* make room a GOP at a time, so the oldest packet stays a key frame */
+    while ((off = find_space(p, pkt->size)) < 0) {
+        if (!p->count) {
+            /* larger than the whole arena */
+            p->stats.nb_overflow++;
+            p->need_key = 1;
+            return;
+        }
+        gop = second_gop(p);
+        if (!gop && key) {
+            /* a new GOP starts, the only complete one can go */
+            gop = p->count;
+        } else if (!gop) {
+            /* the GOP being built does not fit, restart at the next key */
+            p->stats.nb_overflow += p->count + 1;
+            drop(p, p->count);
+            p->need_key = 1;
+            return;
+        }
+        p->stats.nb_evicted += gop;
+        drop(p, gop);
+    }
+
+    memcpy(p->arena + off, pkt->data, pkt->size);
+    e = &p->entries[(p->head + p->count) % p->cfg.max_packets];
+    e->offset = off;
+    e->size = pkt->size;
+    e->pts = pkt->pts;
+    e->key_frame = key;
+    p->count++;
+    p->tail = off + pkt->size;
+    p->fill += pkt->size;
+    if (p->fill > p->stats.fill_max)
+        p->stats.fill_max = p->fill;
+    p->stats.nb_buffered++;
+
+    /* age out whole GOPs while the rest still covers the pre-roll */
+    if (pkt->pts == AV_NOPTS_VALUE)
+        return;
+    while ((gop = second_gop(p)) && entry(p, gop)->pts != AV_NOPTS_VALUE &&
+            pts_to_us(p, pkt->pts - entry(p, gop)->pts) >=
+            p->cfg.seconds * 1000000) {
+        p->stats.nb_evicted += gop;
+        drop(p, gop);
+    }
+}
+
+static int triggered(PrerollBuffer *p)
+{
+    int64_t now;
+    struct stat st;
+    int ret = 0;
+
+    if (p->trigger || signal_trigger) {
+        p->trigger = 0;
+        signal_trigger = 0;
+        ret = 1;
+    }
+    if (!p->cfg.trigger_file[0])
+        return ret;
+
+    now = time_now_us();
+    if (now - p->last_poll_us < PREROLL_POLL_US)
+        return ret;
+    p->last_poll_us = now;
+    if (stat(p->cfg.trigger_file, &st) == 0 && st.st_mtime != p->trigger_mtime) {
+        p->trigger_mtime = st.st_mtime;
+        ret = 1;
+    }
+    return ret;
+}
+
+/* write out the pre-roll to the event file prepared for it */
+static int start_event(PrerollBuffer *p)
+{
+    int i;
+
+    p->in_event = 1;
+    p->stats.nb_events++;
+
+    for (i = 0; i < p->count; i++) {
+        PrerollEntry *e = entry(p, i);
+        AVPacket pkt;
+
+        av_init_packet(&pkt);
+        pkt.data = p->arena + e->offset;
+        pkt.size = e->size;
+        pkt.pts = e->pts;
+        if (e->key_frame)
+            pkt.flags |= AV_PKT_FLAG_KEY;
+        if (segment_write(p->events, &pkt) < 0)
+            return -1;
+        p->stats.nb_flushed++;
+    }
+    drop(p, p->count);
+    p->need_key = 1;
+    return 0;
+}
+
+int preroll_write(PrerollBuffer *p, AVPacket *pkt)
+{
+    if (triggered(p)) {
+        if (!p->in_event && start_event(p) < 0) {
+            fprintf(stderr, "preroll: could not start event %d\n",
+                    p->stats.nb_events - 1);
+            return -1;
+        }
+        p->event_end_pts = AV_NOPTS_VALUE;
+        if (pkt->pts != AV_NOPTS_VALUE)
+            p->event_end_pts = pkt->pts +
+                av_rescale_q(p->cfg.post_seconds * 1000000,
+                        (AVRational) {1, 1000000}, p->time_base);
+    }
+
+    if (!p->in_event) {
+        buffer_packet(p, pkt);
+        return 0;
+    }
+
+    /* end at a key frame, it starts the next pre-roll */
+    if ((pkt->flags & AV_PKT_FLAG_KEY) && pkt->pts != AV_NOPTS_VALUE &&
+            p->event_end_pts != AV_NOPTS_VALUE && pkt->pts >= p->event_end_pts) {
+        p->in_event = 0;
+        buffer_packet(p, pkt);
+        return segment_next(p->events);
+    }
+    return segment_write(p->events, pkt);
+}
+
+void preroll_get_stats(PrerollBuffer *p, PrerollStats *stats)
+{
+    *stats = p->stats;
+}
+
+void preroll_get_segment_stats(PrerollBuffer *p, SegmentStats *stats)
+{
+    segment_get_stats(p->events, stats);
+}
+
+int preroll_close(PrerollBuffer *p)
+{
+    PrerollStats *s;
+    int ret = 0;
+
+    if (!p)
+        return 0;
+    ret = segment_close(p->events);
+
+    s = &p->stats;
+    printf("preroll: %d events, %u packets buffered, %u flushed, "
+            "%u evicted, %u overflowed, %u skipped, arena %d/%d KiB max\n",
+            s->nb_events, s->nb_buffered, s->nb_flushed, s->nb_evicted,
+            s->nb_overflow, s->nb_skipped, s->fill_max >> 10,
+            p->cfg.arena_size >> 10);
+
+    free(p->arena);
+    free(p->entries);
+    free(p);
+    return ret;
+}
@@ -0,0 +1,84 @@
+/*
+ * Pre-roll buffer of encoded packets for event recording
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef PREROLL_H
+#define PREROLL_H
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+#include "segment.h"
+
+typedef struct PrerollConfig {
+    double seconds;             /* pre-roll kept before a trigger */
+    double post_seconds;        /* recorded after the last trigger */
+    int arena_size;             /* bytes of packet data, never exceeded */
+    int max_packets;            /* 0 to size it from seconds and frame rate */
+    char trigger_file[256];     /* touching it triggers, "" for none */
+    char pattern[256];          /* event file names, one %d */
+    int io_ring_size;
+    int io_flags;
+} PrerollConfig;
+
+typedef struct PrerollStats {
+    unsigned nb_buffered;       /* packets that went through the arena */
+    unsigned nb_evicted;        /* aged out, whole GOPs at a time */
+    unsigned nb_overflow;       /* dropped because one GOP did not fit */
+    unsigned nb_skipped;        /* waiting for a key frame to start at */
+    int nb_events;
+    unsigned nb_flushed;        /* pre-roll packets written to events */
+    int fill_max;               /* arena high-water mark in bytes */
+} PrerollStats;
+
+typedef struct PrerollBuffer PrerollBuffer;
+
+/**
+ * Parse "seconds:post_seconds:KiB[:trigger_file]", the KiB being the
+ * arena. Events are written to event%04d.avi.
+ */
+int preroll_parse(const char *spec, PrerollConfig *cfg);
+
+/**
+ * Keep the last cfg->seconds of the stream tmpl describes in memory, in
+ * an arena and packet table allocated here once. The retained packets
+ * always start at a key frame. SIGUSR2, touching cfg->trigger_file or
+ * preroll_trigger() start an event: the pre-roll and then the live stream
+ * are written to a new file until post_seconds after the last trigger.
+ */
+PrerollBuffer *preroll_open(const PrerollConfig *cfg, AVFormatContext *tmpl);
+
+/* feed a packet of stream 0, from the muxing thread */
+int preroll_write(PrerollBuffer *p, AVPacket *pkt);
+
+/* start or extend an event, safe from any thread and signal handlers */
+void preroll_trigger(PrerollBuffer *p);
+
+void preroll_get_stats(PrerollBuffer *p, PrerollStats *stats);
+
+/* stats of the event writer, safe from any thread */
+void preroll_get_segment_stats(PrerollBuffer *p, SegmentStats *stats);
+
+/* finish a running event, print the stats, free everything */
+int preroll_close(PrerollBuffer *p);
+
+#endif /* PREROLL_H */
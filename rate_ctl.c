@@ -0,0 +1,199 @@
+/*
+ * Closed-loop bitrate and quantizer control
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rate_ctl.h"
+
+/* encode time above this share of the frame interval is falling behind */
+#define RATE_CTL_LOAD_HIGH      90
+/* and below this there is room for more bits */
+#define RATE_CTL_LOAD_LOW       70
+/* writer queue fill, percent, with the same meaning */
+#define RATE_CTL_QUEUE_HIGH     50
+#define RATE_CTL_QUEUE_LOW      10
+
+struct RateControl {
+    RateControlConfig cfg;
+    AVCodecContext *c;
+    int64_t frame_us;           /* the real-time budget of one frame */
+    int bit_rate;
+    int q;
+    /* current window */
+    int nb_frames;
+    int64_t encode_us;
+    int64_t bytes;
+    int queue_max;              /* percent */
+    int64_t stall_us;           /* at the start of the window */
+    int frame_number;
+    RateControlStats stats;
+};
+
+int rate_ctl_parse(const char *spec, RateControlConfig *cfg)
+{
+    int min_kbps, max_kbps, n;
+
+    memset(cfg, 0, sizeof(*cfg));
+    n = sscanf(spec, "%d:%d:%d:%d", &min_kbps, &max_kbps, &cfg->min_q,
+            &cfg->max_q);
+    if ((n != 2 && n != 4) || min_kbps <= 0 || max_kbps < min_kbps)
+        return -1;
+    if (n == 4 && (cfg->min_q <= 0 || cfg->max_q < cfg->min_q))
+        return -1;
+    cfg->min_bit_rate = min_kbps * 1000;
+    cfg->max_bit_rate = max_kbps * 1000;
+    cfg->window = RATE_CTL_DEFAULT_WINDOW;
+    return 0;
+}
+
+static int clamp(int v, int lo, int hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+RateControl *rate_ctl_open(const RateControlConfig *cfg, AVCodecContext *c)
+{
+    RateControl *rc;
+
+    rc = calloc(1, sizeof(*rc));
+    if (!rc)
+        return NULL;
+    rc->cfg = *cfg;
+    if (rc->cfg.window <= 0)
+        rc->cfg.window = RATE_CTL_DEFAULT_WINDOW;
+    rc->c = c;
+    rc->frame_us = (int64_t)1000000 * c->time_base.num / c->time_base.den;
+
+    rc->bit_rate = clamp(c->bit_rate, cfg->min_bit_rate, cfg->max_bit_rate);
+    c->bit_rate = rc->bit_rate;
+    if (cfg->min_q) {
+        /* start in the middle, the first windows find the level */
+        rc->q = (cfg->min_q + cfg->max_q) / 2;
+        c->flags |= CODEC_FLAG_QSCALE;
+    }
+    rc->stats.bit_rate = rc->bit_rate;
+    rc->stats.q = rc->q;
+
+    return rc;
+}
+
+void rate_ctl_prepare(RateControl *rc, AVFrame *pict)
+{
+    if (rc->q)
+        pict->quality = rc->q * FF_QP2LAMBDA;
+}
+
+static void decide(RateControl *rc, const RateControlSample *s)
+{
+    int64_t enc = rc->encode_us / rc->nb_frames;
+    int load = rc->frame_us ? (int)(enc * 100 / rc->frame_us) : 0;
+    int64_t stalled = s->stall_us - rc->stall_us;
+    int kbps = (int)(rc->bytes * 8 * 1000 / (rc->frame_us * rc->nb_frames));
+    int bit_rate = rc->bit_rate, q = rc->q;
+    const char *why;
+
+    if (stalled > 0 || rc->queue_max > RATE_CTL_QUEUE_HIGH) {
+        /* storage is behind: back off hard, the queue has to drain */
+        bit_rate -= bit_rate / 4;
+        q += 2;
+        why = "writer behind";
+    } else if (load > RATE_CTL_LOAD_HIGH) {
+        bit_rate -= bit_rate / 8;
+        q++;
+        why = "encoder behind";
+    } else if (load < RATE_CTL_LOAD_LOW &&
+            rc->queue_max < RATE_CTL_QUEUE_LOW) {
+        /* probe upwards gently */
+        bit_rate += bit_rate / 16;
+        q--;
+        why = "headroom";
+    } else {
+        why = "steady";
+    }
+
+    bit_rate = clamp(bit_rate, rc->cfg.min_bit_rate, rc->cfg.max_bit_rate);
+    if (rc->q)
+        q = clamp(q, rc->cfg.min_q, rc->cfg.max_q);
+    else
+        q = 0;
+
+    if (bit_rate < rc->bit_rate || q > rc->q)
+        rc->stats.nb_down++;
+    else if (bit_rate > rc->bit_rate || q < rc->q)
+        rc->stats.nb_up++;
+    else
+        rc->stats.nb_hold++;
+
+    printf("rate: frame %d: encode %lld/%lld us (%d%%), queue %d%%, "
+            "stalled %lld us, %d kbit/s -> bitrate %d -> %d, q %d -> %d (%s)\n",
+            rc->frame_number, (long long)enc, (long long)rc->frame_us, load,
+            rc->queue_max, (long long)stalled, kbps, rc->bit_rate, bit_rate,
+            rc->q, q, why);
+
+    rc->bit_rate = bit_rate;
+    rc->q = q;
+    rc->c->bit_rate = bit_rate;
+    rc->stats.bit_rate = bit_rate;
+    rc->stats.q = q;
+}
+
+void rate_ctl_update(RateControl *rc, const RateControlSample *s)
+{
+    rc->nb_frames++;
+    rc->frame_number++;
+    rc->encode_us += s->encode_us;
+    rc->bytes += s->bytes;
+    if (s->queue_size > 0) {
+        int fill = (int)((int64_t)s->queue_fill * 100 / s->queue_size);
+
+        if (fill > rc->queue_max)
+            rc->queue_max = fill;
+    }
+
+    if (rc->nb_frames < rc->cfg.window)
+        return;
+    decide(rc, s);
+
+    rc->nb_frames = 0;
+    rc->encode_us = 0;
+    rc->bytes = 0;
+    rc->queue_max = 0;
+    rc->stall_us = s->stall_us;
+}
+
+void rate_ctl_get_stats(RateControl *rc, RateControlStats *stats)
+{
+    *stats = rc->stats;
+}
+
+void rate_ctl_close(RateControl *rc)
+{
+    if (!rc)
+        return;
+    printf("rate control: %u up, %u down, %u hold, final bitrate %d, q %d\n",
+            rc->stats.nb_up, rc->stats.nb_down, rc->stats.nb_hold,
+            rc->stats.bit_rate, rc->stats.q);
+    free(rc);
+}
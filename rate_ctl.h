@@ -0,0 +1,87 @@
+/*
+ * Closed-loop bitrate and quantizer control
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef RATE_CTL_H
+#define RATE_CTL_H
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+/* frames between two decisions when the config leaves it 0 */
+#define RATE_CTL_DEFAULT_WINDOW 5
+
+typedef struct RateControlConfig {
+    int min_bit_rate;           /* bits/s */
+    int max_bit_rate;
+    int min_q;                  /* quantizer bounds, 0 leaves it to the codec */
+    int max_q;
+    int window;                 /* frames per decision */
+} RateControlConfig;
+
+/* what happened to one frame, filled in by the encoding thread */
+typedef struct RateControlSample {
+    int64_t encode_us;          /* time in avcodec_encode_video() */
+    int bytes;                  /* encoded size, 0 if buffered */
+    int queue_fill;             /* waiting for the writer, in bytes or packets */
+    int queue_size;             /* same unit, 0 when there is no queue */
+    int64_t stall_us;           /* total time the muxer waited, so far */
+} RateControlSample;
+
+typedef struct RateControlStats {
+    unsigned nb_up;
+    unsigned nb_down;
+    unsigned nb_hold;
+    int bit_rate;               /* current target */
+    int q;                      /* current quantizer, 0 if not controlled */
+} RateControlStats;
+
+typedef struct RateControl RateControl;
+
+/* parse "min_kbps:max_kbps[:qmin:qmax]" */
+int rate_ctl_parse(const char *spec, RateControlConfig *cfg);
+
+/**
+ * Control the encoder c within cfg, starting from c->bit_rate clamped to
+ * the bounds. Call before avcodec_open(): with quantizer bounds the codec
+ * is switched to a fixed quantizer per frame. Every window frames the
+ * controller compares encode time to the frame interval and looks at the
+ * writer queue, steps the targets down when either falls behind and up
+ * when both have headroom, and prints the decision.
+ *
+ * The new bit_rate is written to c; encoders that read it only when they
+ * are opened follow the quantizer alone.
+ */
+RateControl *rate_ctl_open(const RateControlConfig *cfg, AVCodecContext *c);
+
+/* set the quantizer of the next picture to encode */
+void rate_ctl_prepare(RateControl *rc, AVFrame *pict);
+
+/* account one encoded frame, decides at the end of a window */
+void rate_ctl_update(RateControl *rc, const RateControlSample *s);
+
+void rate_ctl_get_stats(RateControl *rc, RateControlStats *stats);
+
+/* print the stats and free rc */
+void rate_ctl_close(RateControl *rc);
+
+#endif /* RATE_CTL_H */
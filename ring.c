@@ -0,0 +1,115 @@
+/*
+ * Single producer, single consumer ring of pointers
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <errno.h>
+
+#include "ring.h"
+
+int ring_init(Ring *ring, unsigned size)
+{
+    ring->slots = calloc(size, sizeof(*ring->slots));
+    if (!ring->slots)
+        return -1;
+    ring->size = size;
+    ring->head = ring->tail = 0;
+    ring->fill_sum = 0;
+    ring->fill_samples = 0;
+    ring->fill_max = 0;
+    sem_init(&ring->items, 0, 0);
+    sem_init(&ring->spaces, 0, size);
+    return 0;
+}
+
+void ring_destroy(Ring *ring)
+{
+    sem_destroy(&ring->items);
+    sem_destroy(&ring->spaces);
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+static void put(Ring *ring, void *item)
+{
+    unsigned fill;
+
+    ring->slots[ring->tail % ring->size] = item;
+    __sync_synchronize();
+    ring->tail++;
+
+    fill = ring_count(ring);
+    ring->fill_sum += fill;
+    ring->fill_samples++;
+    if (fill > ring->fill_max)
+        ring->fill_max = fill;
+
+    sem_post(&ring->items);
+}
+
+static void *get(Ring *ring)
+{
+    void *item;
+
+    item = ring->slots[ring->head % ring->size];
+    __sync_synchronize();
+    ring->head++;
+
+    sem_post(&ring->spaces);
+    return item;
+}
+
+void ring_push(Ring *ring, void *item)
+{
+    while (sem_wait(&ring->spaces) < 0 && errno == EINTR)
+        ;
+    put(ring, item);
+}
+
+void *ring_pop(Ring *ring)
+{
+    while (sem_wait(&ring->items) < 0 && errno == EINTR)
+        ;
+    return get(ring);
+}
+
+int ring_try_push(Ring *ring, void *item)
+{
+    if (sem_trywait(&ring->spaces) < 0)
+        return -1;
+    put(ring, item);
+    return 0;
+}
+
+void *ring_try_pop(Ring *ring)
+{
+    if (sem_trywait(&ring->items) < 0)
+        return NULL;
+    return get(ring);
+}
+
+int ring_fill_percent(const Ring *ring)
+{
+    if (!ring->fill_samples || !ring->size)
+        return 0;
+    return (int)(ring->fill_sum * 100 / ring->fill_samples / ring->size);
+}
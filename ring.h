@@ -0,0 +1,71 @@
+/*
+ * Single producer, single consumer ring of pointers
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef RING_H
+#define RING_H
+
+#include <semaphore.h>
+#include <stdint.h>
+
+/*
+ * The slots and indices are shared without a lock: only the producer
+ * moves tail and only the consumer moves head, with a barrier between
+ * the slot access and the index update. The two semaphores count filled
+ * and free slots so that a stage can sleep instead of spinning, which
+ * matters on the single core ARM926.
+ */
+typedef struct Ring {
+    void **slots;
+    unsigned size;
+    volatile unsigned head;     /* next slot to pop, consumer only */
+    volatile unsigned tail;     /* next slot to push, producer only */
+    sem_t items;
+    sem_t spaces;
+    /* occupancy sampled on every push */
+    uint64_t fill_sum;
+    unsigned fill_samples;
+    unsigned fill_max;
+} Ring;
+
+int ring_init(Ring *ring, unsigned size);
+void ring_destroy(Ring *ring);
+
+/* block while the ring is full */
+void ring_push(Ring *ring, void *item);
+
+/* block while the ring is empty */
+void *ring_pop(Ring *ring);
+
+/* non-blocking variants, return -1 / NULL when full / empty */
+int ring_try_push(Ring *ring, void *item);
+void *ring_try_pop(Ring *ring);
+
+static inline unsigned ring_count(const Ring *ring)
+{
+    return ring->tail - ring->head;
+}
+
+/* average occupancy in percent of the size */
+int ring_fill_percent(const Ring *ring);
+
+#endif /* RING_H */
@@ -0,0 +1,610 @@
+/*
+ * Downscaler for NV12 and YUV420P pictures
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "frame_pool.h"
+#include "scale.h"
+#include "swar.h"
+
+/*
+ * The packed paths keep four bytes in a 32-bit register and split them
+ * into two 16-bit lanes (even and odd bytes) for sums and products. The
+ * ARM926 has no packed byte instructions (those came with ARMv6), so this
+ * is as wide as it gets on the target; PLD is issued for the source rows.
+ * Host builds with SSE2 use 16 byte registers for the 2:1 box filter.
+ * The lane packing assumes a little endian CPU.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#error "scale.c packed paths assume little endian"
+#endif
+
+#define LANES_EVEN(w)   ((w) & 0x00ff00ffu)
+#define LANES_ODD(w)    (((w) >> 8) & 0x00ff00ffu)
+
+#define PREFETCH_AHEAD  32
+
+typedef struct ScaleAxis {
+    int *ofs;           /* first source element */
+    int *frac;          /* weight of the next element, 0..256 */
+} ScaleAxis;
+
+typedef struct ScalePlane {
+    int src_w, src_h;   /* in elements */
+    int dst_w, dst_h;
+    int elem;           /* bytes per element, 2 for the NV12 UV pairs */
+    int box2;           /* exact 2:1 in both directions */
+    ScaleAxis x, y;
+} ScalePlane;
+
+struct ScaleContext {
+    enum PixelFormat pix_fmt;
+    enum ScaleMode mode;
+    int nb_planes;
+    ScalePlane planes[3];
+    uint8_t *tmp;       /* one vertically filtered source row */
+};
+
+static const char * const mode_names[] = {
+    [SCALE_POINT]    = "point",
+    [SCALE_BOX]      = "box",
+    [SCALE_BILINEAR] = "bilinear",
+};
+
+int scale_mode_from_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++) {
+        if (!strcmp(name, mode_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+const char *scale_mode_name(enum ScaleMode mode)
+{
+    return mode_names[mode];
+}
+
+static int setup_axis(ScaleAxis *a, int src, int dst, enum ScaleMode mode)
+{
+    int i;
+
+    a->ofs = malloc(dst * sizeof(*a->ofs));
+    a->frac = malloc(dst * sizeof(*a->frac));
+    if (!a->ofs || !a->frac)
+        return -1;
+
+    for (i = 0; i < dst; i++) {
+        int64_t p;
+
+        switch (mode) {
+        case SCALE_POINT:
+            /* sample at the centre of the destination element */
+            a->ofs[i] = (int)(((int64_t)2 * i + 1) * src / (2 * dst));
+            a->frac[i] = 0;
+            break;
+        case SCALE_BOX:
+            a->ofs[i] = (int)((int64_t)i * src / dst);
+            if (a->ofs[i] > src - 2)
+                a->ofs[i] = src - 2;
+            a->frac[i] = 0;
+            break;
+        case SCALE_BILINEAR:
+            p = ((int64_t)2 * i + 1) * src * 256 / (2 * dst) - 128;
+            if (p < 0)
+                p = 0;
+            a->ofs[i] = (int)(p >> 8);
+            a->frac[i] = (int)(p & 255);
+            if (a->ofs[i] >= src - 1) {
+                a->ofs[i] = src - 2;
+                a->frac[i] = 256;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+static void free_plane(ScalePlane *p)
+{
+    free(p->x.ofs);
+    free(p->x.frac);
+    free(p->y.ofs);
+    free(p->y.frac);
+}
+
+static int setup_plane(ScalePlane *p, int src_w, int src_h, int dst_w,
+        int dst_h, int elem, enum ScaleMode mode)
+{
+    p->src_w = src_w;
+    p->src_h = src_h;
+    p->dst_w = dst_w;
+    p->dst_h = dst_h;
+    p->elem = elem;
+    p->box2 = src_w == 2 * dst_w && src_h == 2 * dst_h;
+
+    if (setup_axis(&p->x, src_w, dst_w, mode) < 0 ||
+            setup_axis(&p->y, src_h, dst_h, mode) < 0)
+        return -1;
+    return 0;
+}
+
+ScaleContext *scale_init(enum PixelFormat pix_fmt, int src_w, int src_h,
+        int dst_w, int dst_h, enum ScaleMode mode)
+{
+    ScaleContext *ctx;
+    int ret;
+
+    if (pix_fmt != PIX_FMT_NV12 && pix_fmt != PIX_FMT_YUV420P)
+        return NULL;
+    if (dst_w > src_w || dst_h > src_h || dst_w < 2 || dst_h < 2 ||
+            (src_w | src_h | dst_w | dst_h) & 1)
+        return NULL;
+    if (mode != SCALE_POINT && mode != SCALE_BOX && mode != SCALE_BILINEAR)
+        return NULL;
+
+    ctx = calloc(1, sizeof(*ctx));
+    if (!ctx)
+        return NULL;
+    ctx->pix_fmt = pix_fmt;
+    ctx->mode = mode;
+
+    ret = setup_plane(&ctx->planes[0], src_w, src_h, dst_w, dst_h, 1, mode);
+    if (pix_fmt == PIX_FMT_NV12) {
+        ctx->nb_planes = 2;
+        ret |= setup_plane(&ctx->planes[1], src_w / 2, src_h / 2,
+                dst_w / 2, dst_h / 2, 2, mode);
+    } else {
+        ctx->nb_planes = 3;
+        ret |= setup_plane(&ctx->planes[1], src_w / 2, src_h / 2,
+                dst_w / 2, dst_h / 2, 1, mode);
+        /* U and V share the tables */
+        ctx->planes[2] = ctx->planes[1];
+    }
+
+    if (mode == SCALE_BILINEAR)
+        ctx->tmp = malloc(src_w + 4);
+
+    if (ret < 0 || (mode == SCALE_BILINEAR && !ctx->tmp)) {
+        scale_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+void scale_free(ScaleContext *ctx)
+{
+    if (!ctx)
+        return;
+    free_plane(&ctx->planes[0]);
+    free_plane(&ctx->planes[1]);
+    free(ctx->tmp);
+    free(ctx);
+}
+
+/* gather elements through the offset table, stored a word at a time */
+static void point_row(uint8_t *dst, const uint8_t *src, const int *ofs,
+        int n, int elem)
+{
+    int aligned = swar_aligned(dst);
+    int x = 0;
+
+    if (elem == 1) {
+        for (; x + 4 <= n; x += 4, dst += 4)
+            swar_store(dst, swar_bytes(src[ofs[x]], src[ofs[x + 1]],
+                    src[ofs[x + 2]], src[ofs[x + 3]]), aligned);
+        for (; x < n; x++)
+            *dst++ = src[ofs[x]];
+    } else {
+        for (; x + 2 <= n; x += 2, dst += 4) {
+            const uint8_t *a = src + 2 * ofs[x];
+            const uint8_t *b = src + 2 * ofs[x + 1];
+
+            swar_store(dst, swar_bytes(a[0], a[1], b[0], b[1]), aligned);
+        }
+        for (; x < n; x++, dst += 2) {
+            dst[0] = src[2 * ofs[x]];
+            dst[1] = src[2 * ofs[x] + 1];
+        }
+    }
+}
+
+/*
+ * 2x2 average at arbitrary positions. A word load from each row holds the
+ * two source elements in its low bytes, or both UV pairs; the lanes give
+ * the horizontal sums. Bytes are loaded at an element offset, so never
+ * as aligned words.
+ */
+static void box_row(uint8_t *dst, const uint8_t *r0, const uint8_t *r1,
+        const int *ofs, int n, int elem, int src_w)
+{
+    int aligned = swar_aligned(dst);
+    int x = 0, c;
+
+    if (elem == 1) {
+        /* the word reaches two bytes past the pair, keep it in the row */
+        for (; x + 4 <= n && ofs[x + 3] + 4 <= src_w; x += 4, dst += 4) {
+            uint8_t b[4];
+
+            __builtin_prefetch(r0 + ofs[x] + PREFETCH_AHEAD);
+            __builtin_prefetch(r1 + ofs[x] + PREFETCH_AHEAD);
+            for (c = 0; c < 4; c++) {
+                uint32_t a = swar_load(r0 + ofs[x + c], 0);
+                uint32_t d = swar_load(r1 + ofs[x + c], 0);
+                uint32_t s = LANES_EVEN(a) + LANES_ODD(a) +
+                             LANES_EVEN(d) + LANES_ODD(d);
+
+                b[c] = ((s & 0xffff) + 2) >> 2;
+            }
+            swar_store(dst, swar_bytes(b[0], b[1], b[2], b[3]), aligned);
+        }
+    } else {
+        for (; x + 2 <= n; x += 2, dst += 4) {
+            uint32_t w[2];
+
+            __builtin_prefetch(r0 + 2 * ofs[x] + PREFETCH_AHEAD);
+            __builtin_prefetch(r1 + 2 * ofs[x] + PREFETCH_AHEAD);
+            for (c = 0; c < 2; c++) {
+                uint32_t a = swar_load(r0 + 2 * ofs[x + c], 0);
+                uint32_t d = swar_load(r1 + 2 * ofs[x + c], 0);
+                uint32_t u = LANES_EVEN(a) + LANES_EVEN(d);
+                uint32_t v = LANES_ODD(a) + LANES_ODD(d);
+
+                u = (((u & 0xffff) + (u >> 16) + 2) >> 2) & 0xff;
+                v = (((v & 0xffff) + (v >> 16) + 2) >> 2) & 0xff;
+                w[c] = u | (v << 8);
+            }
+            swar_store(dst, w[0] | (w[1] << 16), aligned);
+        }
+    }
+
+    for (; x < n; x++) {
+        int s = ofs[x] * elem;
+
+        for (c = 0; c < elem; c++)
+            *dst++ = (r0[s + c] + r0[s + elem + c] +
+                      r1[s + c] + r1[s + elem + c] + 2) >> 2;
+    }
+}
+
+/*
+ * Exact 2:1 box filter on bytes, 8 source bytes of each row in, 4 bytes
+ * out. Even and odd bytes are summed in separate 16-bit lanes.
+ */
+static inline uint32_t box2_pack8(uint32_t a0, uint32_t a1, uint32_t b0,
+        uint32_t b1)
+{
+    uint32_t s0, s1;
+
+    s0 = LANES_EVEN(a0) + LANES_ODD(a0) + LANES_EVEN(b0) + LANES_ODD(b0);
+    s1 = LANES_EVEN(a1) + LANES_ODD(a1) + LANES_EVEN(b1) + LANES_ODD(b1);
+    s0 = ((s0 + 0x00020002u) >> 2) & 0x00ff00ffu;
+    s1 = ((s1 + 0x00020002u) >> 2) & 0x00ff00ffu;
+
+    return (s0 & 0xff) | ((s0 >> 8) & 0xff00) |
+           ((s1 & 0xff) << 16) | ((s1 << 8) & 0xff000000u);
+}
+
+/* the same for interleaved UV pairs: [U0 V0 U1 V1] -> [U V] */
+static inline uint32_t box2_pack16(uint32_t a0, uint32_t a1, uint32_t b0,
+        uint32_t b1)
+{
+    uint32_t u0 = LANES_EVEN(a0) + LANES_EVEN(b0);
+    uint32_t v0 = LANES_ODD(a0) + LANES_ODD(b0);
+    uint32_t u1 = LANES_EVEN(a1) + LANES_EVEN(b1);
+    uint32_t v1 = LANES_ODD(a1) + LANES_ODD(b1);
+
+    u0 = (((u0 & 0xffff) + (u0 >> 16) + 2) >> 2) & 0xff;
+    v0 = (((v0 & 0xffff) + (v0 >> 16) + 2) >> 2) & 0xff;
+    u1 = (((u1 & 0xffff) + (u1 >> 16) + 2) >> 2) & 0xff;
+    v1 = (((v1 & 0xffff) + (v1 >> 16) + 2) >> 2) & 0xff;
+
+    return u0 | (v0 << 8) | (u1 << 16) | (v1 << 24);
+}
+
+static void box2_row(uint8_t *dst, const uint8_t *r0, const uint8_t *r1,
+        int n, int elem)
+{
+    int aligned = swar_aligned(dst) && swar_aligned(r0) && swar_aligned(r1);
+    int bytes = n * elem;
+    int i = 0;
+
+#ifdef __SSE2__
+    if (elem == 1) {
+        const __m128i mask = _mm_set1_epi16(0xff);
+        const __m128i two = _mm_set1_epi16(2);
+
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i a0 = _mm_loadu_si128((const __m128i *)(r0 + 2 * i));
+            __m128i a1 = _mm_loadu_si128((const __m128i *)(r0 + 2 * i + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i *)(r1 + 2 * i));
+            __m128i b1 = _mm_loadu_si128((const __m128i *)(r1 + 2 * i + 16));
+            __m128i s0, s1;
+
+            s0 = _mm_add_epi16(_mm_and_si128(a0, mask), _mm_srli_epi16(a0, 8));
+            s0 = _mm_add_epi16(s0, _mm_and_si128(b0, mask));
+            s0 = _mm_add_epi16(s0, _mm_srli_epi16(b0, 8));
+            s1 = _mm_add_epi16(_mm_and_si128(a1, mask), _mm_srli_epi16(a1, 8));
+            s1 = _mm_add_epi16(s1, _mm_and_si128(b1, mask));
+            s1 = _mm_add_epi16(s1, _mm_srli_epi16(b1, 8));
+            s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+            s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(s0, s1));
+        }
+    }
+#endif
+
+    for (; i + 4 <= bytes; i += 4) {
+        const uint8_t *a = r0 + 2 * i;
+        const uint8_t *b = r1 + 2 * i;
+        uint32_t a0, a1, b0, b1;
+
+        __builtin_prefetch(a + PREFETCH_AHEAD);
+        __builtin_prefetch(b + PREFETCH_AHEAD);
+        a0 = swar_load(a, aligned);
+        a1 = swar_load(a + 4, aligned);
+        b0 = swar_load(b, aligned);
+        b1 = swar_load(b + 4, aligned);
+        swar_store(dst + i, elem == 1 ? box2_pack8(a0, a1, b0, b1) :
+                box2_pack16(a0, a1, b0, b1), aligned);
+    }
+
+    /* 2 or fewer elements left */
+    for (; i < bytes; i += elem) {
+        int c, s = 2 * i;
+
+        for (c = 0; c < elem; c++)
+            dst[i + c] = (r0[s + c] + r0[s + elem + c] +
+                          r1[s + c] + r1[s + elem + c] + 2) >> 2;
+    }
+}
+
+/* dst = a + (b - a) * f / 256 on len bytes, two lanes per multiply */
+static void blend_rows(uint8_t *dst, const uint8_t *a, const uint8_t *b,
+        int len, int f)
+{
+    int aligned = swar_aligned(a) && swar_aligned(b);
+    int g = 256 - f;
+    int i;
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        uint32_t wa, wb, e, o;
+
+        __builtin_prefetch(a + i + PREFETCH_AHEAD);
+        __builtin_prefetch(b + i + PREFETCH_AHEAD);
+        wa = swar_load(a + i, aligned);
+        wb = swar_load(b + i, aligned);
+        e = ((LANES_EVEN(wa) * g + LANES_EVEN(wb) * f + 0x00800080u) >> 8) &
+            0x00ff00ffu;
+        o = (LANES_ODD(wa) * g + LANES_ODD(wb) * f + 0x00800080u) &
+            0xff00ff00u;
+        *(uint32_t *)(dst + i) = e | o;
+    }
+    for (; i < len; i++)
+        dst[i] = (a[i] * g + b[i] * f + 128) >> 8;
+}
+
+static void lerp_row(uint8_t *dst, const uint8_t *src, const int *ofs,
+        const int *frac, int n, int elem)
+{
+    int aligned = swar_aligned(dst);
+    int x = 0, c;
+
+#define LERP(s, e, f) ((src[s] * (256 - (f)) + src[(s) + (e)] * (f) + 128) >> 8)
+    if (elem == 1) {
+        for (; x + 4 <= n; x += 4, dst += 4)
+            swar_store(dst, swar_bytes(LERP(ofs[x], 1, frac[x]),
+                    LERP(ofs[x + 1], 1, frac[x + 1]),
+                    LERP(ofs[x + 2], 1, frac[x + 2]),
+                    LERP(ofs[x + 3], 1, frac[x + 3])), aligned);
+    } else {
+        for (; x + 2 <= n; x += 2, dst += 4) {
+            int s0 = 2 * ofs[x], s1 = 2 * ofs[x + 1];
+
+            swar_store(dst, swar_bytes(LERP(s0, 2, frac[x]),
+                    LERP(s0 + 1, 2, frac[x]), LERP(s1, 2, frac[x + 1]),
+                    LERP(s1 + 1, 2, frac[x + 1])), aligned);
+        }
+    }
+    for (; x < n; x++) {
+        for (c = 0; c < elem; c++)
+            *dst++ = LERP(ofs[x] * elem + c, elem, frac[x]);
+    }
+#undef LERP
+}
+
+static void scale_plane(ScaleContext *ctx, const ScalePlane *p,
+        const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride)
+{
+    int y;
+
+    for (y = 0; y < p->dst_h; y++, dst += dst_stride) {
+        const uint8_t *r0 = src + p->y.ofs[y] * src_stride;
+        const uint8_t *r1 = r0 + src_stride;
+
+        switch (ctx->mode) {
+        case SCALE_POINT:
+            point_row(dst, r0, p->x.ofs, p->dst_w, p->elem);
+            break;
+        case SCALE_BOX:
+            if (p->box2)
+                box2_row(dst, r0, r1, p->dst_w, p->elem);
+            else
+                box_row(dst, r0, r1, p->x.ofs, p->dst_w, p->elem, p->src_w);
+            break;
+        case SCALE_BILINEAR:
+            if (p->y.frac[y] == 0) {
+                lerp_row(dst, r0, p->x.ofs, p->x.frac, p->dst_w, p->elem);
+            } else {
+                blend_rows(ctx->tmp, r0, r1, p->src_w * p->elem, p->y.frac[y]);
+                lerp_row(dst, ctx->tmp, p->x.ofs, p->x.frac, p->dst_w, p->elem);
+            }
+            break;
+        }
+    }
+}
+
+void scale_picture(ScaleContext *ctx, const AVPicture *src, AVPicture *dst)
+{
+    int i;
+
+    for (i = 0; i < ctx->nb_planes; i++)
+        scale_plane(ctx, &ctx->planes[i], src->data[i], src->linesize[i],
+                dst->data[i], dst->linesize[i]);
+}
+
+/*
+ * The pyramid works on bands of 4 source rows. Each is copied once into a
+ * cached row buffer, which is a burst read even from noncached CMEM, and
+ * the full level, the two 1/2 rows and the 1/4 row are made from there.
+ */
+struct ScalePyramid {
+    enum PixelFormat pix_fmt;
+    int width, height;
+    unsigned mask;
+    uint8_t *rows[4];
+    uint8_t *half[2];
+};
+
+ScalePyramid *scale_pyramid_init(enum PixelFormat pix_fmt, int width,
+        int height, unsigned level_mask)
+{
+    ScalePyramid *p;
+    int i;
+
+    if ((pix_fmt != PIX_FMT_NV12 && pix_fmt != PIX_FMT_YUV420P) ||
+            width <= 0 || height <= 0 || width % 8 || height % 8 ||
+            !(level_mask & (SCALE_LEVEL(SCALE_LEVELS) - 1)))
+        return NULL;
+
+    p = calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+    p->pix_fmt = pix_fmt;
+    p->width = width;
+    p->height = height;
+    p->mask = level_mask;
+    /* the widest row is luma, NV12 chroma rows are as wide */
+    for (i = 0; i < 4; i++)
+        p->rows[i] = malloc(width);
+    for (i = 0; i < 2; i++)
+        p->half[i] = malloc(width / 2);
+    for (i = 0; i < 4; i++) {
+        if (!p->rows[i] || (i < 2 && !p->half[i])) {
+            scale_pyramid_free(p);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+void scale_pyramid_free(ScalePyramid *p)
+{
+    int i;
+
+    if (!p)
+        return;
+    for (i = 0; i < 4; i++)
+        free(p->rows[i]);
+    for (i = 0; i < 2; i++)
+        free(p->half[i]);
+    free(p);
+}
+
+/* one plane of n elements of elem bytes by h rows, h a multiple of 4 */
+static void pyramid_plane(ScalePyramid *p, const uint8_t *src, int src_stride,
+        int n, int elem, int h, uint8_t *dst[SCALE_LEVELS],
+        const int stride[SCALE_LEVELS])
+{
+    int bytes = n * elem;
+    int y, i;
+
+    for (y = 0; y < h; y += 4) {
+        for (i = 0; i < 4; i++) {
+            memcpy(p->rows[i], src + (y + i) * src_stride, bytes);
+            if (dst[0])
+                memcpy(dst[0] + (y + i) * stride[0], p->rows[i], bytes);
+        }
+        if (!dst[1] && !dst[2])
+            continue;
+
+        box2_row(p->half[0], p->rows[0], p->rows[1], n / 2, elem);
+        box2_row(p->half[1], p->rows[2], p->rows[3], n / 2, elem);
+        if (dst[1]) {
+            memcpy(dst[1] + (y / 2) * stride[1], p->half[0], bytes / 2);
+            memcpy(dst[1] + (y / 2 + 1) * stride[1], p->half[1], bytes / 2);
+        }
+        if (dst[2])
+            box2_row(dst[2] + (y / 4) * stride[2], p->half[0], p->half[1],
+                    n / 4, elem);
+    }
+}
+
+int scale_pyramid_build(ScalePyramid *p, const AVPicture *src,
+        AVFrame *levels[SCALE_LEVELS])
+{
+    int nv12 = p->pix_fmt == PIX_FMT_NV12;
+    int i, plane;
+
+    for (i = 0; i < SCALE_LEVELS; i++) {
+        levels[i] = NULL;
+        if (!(p->mask & SCALE_LEVEL(i)))
+            continue;
+        levels[i] = frame_pool_alloc(p->pix_fmt, p->width >> i,
+                p->height >> i);
+        if (!levels[i]) {
+            while (i--)
+                frame_pool_unref(levels[i]);
+            return -1;
+        }
+    }
+
+    for (plane = 0; plane < (nv12 ? 2 : 3); plane++) {
+        uint8_t *dst[SCALE_LEVELS];
+        int stride[SCALE_LEVELS];
+        int n = plane && !nv12 ? p->width / 2 : p->width;
+
+        for (i = 0; i < SCALE_LEVELS; i++) {
+            dst[i] = levels[i] ? levels[i]->data[plane] : NULL;
+            stride[i] = levels[i] ? levels[i]->linesize[plane] : 0;
+        }
+        pyramid_plane(p, src->data[plane], src->linesize[plane],
+                plane && nv12 ? n / 2 : n, plane && nv12 ? 2 : 1,
+                plane ? p->height / 2 : p->height, dst, stride);
+    }
+
+    for (i = 0; i < SCALE_LEVELS; i++) {
+        if (levels[i])
+            frame_pool_sync_for_device(levels[i], FRAME_PLANES_ALL);
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Downscaler for NV12 and YUV420P pictures
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef SCALE_H
+#define SCALE_H
+
+#include <libavcodec/avcodec.h>
+
+enum ScaleMode {
+    SCALE_POINT,        /* nearest neighbour */
+    SCALE_BOX,          /* average of the 2x2 block at the source position */
+    SCALE_BILINEAR,
+};
+
+typedef struct ScaleContext ScaleContext;
+
+/* parse "point", "box" or "bilinear", -1 for anything else */
+int scale_mode_from_name(const char *name);
+const char *scale_mode_name(enum ScaleMode mode);
+
+/**
+ * Prepare scaling of src_w x src_h pictures to dst_w x dst_h. Only
+ * downscaling of NV12 and YUV420P is supported, the ratio need not be an
+ * integer. All sizes must be even.
+ *
+ * @return the context or NULL if the parameters are not supported
+ */
+ScaleContext *scale_init(enum PixelFormat pix_fmt, int src_w, int src_h,
+        int dst_w, int dst_h, enum ScaleMode mode);
+
+/* scale a whole picture, src and dst must not overlap */
+void scale_picture(ScaleContext *ctx, const AVPicture *src, AVPicture *dst);
+
+void scale_free(ScaleContext *ctx);
+
+/* pyramid levels: full size, 1/2 and 1/4 in each direction */
+#define SCALE_LEVELS        3
+#define SCALE_LEVEL(n)      (1 << (n))
+
+typedef struct ScalePyramid ScalePyramid;
+
+/**
+ * Prepare building the levels in level_mask of width x height NV12 or
+ * YUV420P pictures, both multiples of 8. The smaller levels are exact 2:1
+ * box filters of the level above, so 1/4 is the average of 4x4 pixels.
+ */
+ScalePyramid *scale_pyramid_init(enum PixelFormat pix_fmt, int width,
+        int height, unsigned level_mask);
+
+/**
+ * Build all levels in one pass over src: every source row is read once,
+ * into a cached row buffer, and each level is written from there. The
+ * levels are taken from the frame pools and written back for the device;
+ * levels[n] is NULL for a level not in the mask.
+ *
+ * @return 0, or -1 if a pool had no frame; nothing is held then
+ */
+int scale_pyramid_build(ScalePyramid *p, const AVPicture *src,
+        AVFrame *levels[SCALE_LEVELS]);
+
+void scale_pyramid_free(ScalePyramid *p);
+
+/**
+ * Time every mode at a set of ratios on CMEM pictures of the given size,
+ * compare each result against swscale and print Mpix/s and the difference.
+ *
+ * @return -1 if a mode differs from swscale beyond its tolerance
+ */
+int scale_benchmark(enum PixelFormat pix_fmt, int width, int height,
+        int iterations);
+
+/**
+ * Time building all pyramid levels in one pass against a copy and two
+ * scale_picture() calls from the source, and print the source traffic of
+ * each.
+ */
+int scale_pyramid_benchmark(enum PixelFormat pix_fmt, int width, int height,
+        int iterations);
+
+#endif /* SCALE_H */
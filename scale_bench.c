@@ -0,0 +1,355 @@
+/*
+ * Downscaler benchmark and comparison against swscale
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libswscale/swscale.h>
+
+#include "frame_pool.h"
+#include "pattern.h"
+#include "scale.h"
+#include "timeutil.h"
+
+static const int sws_flags[] = {
+    [SCALE_POINT]    = SWS_POINT,
+    [SCALE_BOX]      = SWS_AREA,
+    [SCALE_BILINEAR] = SWS_BILINEAR,
+};
+
+/*
+ * Largest difference to the reference still taken as the same filter:
+ * the rounding and the sample positions differ a little from swscale for
+ * point and bilinear. Box is compared with SWS_AREA at 2:1 only, other
+ * ratios average a 2x2 block and not the whole footprint like SWS_AREA,
+ * so they are checked against box_reference() and must match it.
+ */
+static const struct {
+    double mean;
+    int max;
+} tolerance[] = {
+    [SCALE_POINT]    = { 2.0, 32 },
+    [SCALE_BOX]      = { 1.0, 8 },
+    [SCALE_BILINEAR] = { 2.0, 24 },
+};
+
+/*
+ * A ramp over each plane that stays within 0..255, unlike the pattern
+ * gradient which wraps around: near a wrap, any difference in the sample
+ * positions shows up as a difference of almost 255.
+ */
+static void fill_ramp(AVFrame *pict, enum PixelFormat pix_fmt, int width,
+        int height)
+{
+    int p, x, y;
+
+    for (p = 0; p < (pix_fmt == PIX_FMT_NV12 ? 2 : 3); p++) {
+        int w = p ? width / 2 : width;
+        int h = p ? height / 2 : height;
+
+        for (y = 0; y < h; y++) {
+            uint8_t *row = pict->data[p] + y * pict->linesize[p];
+
+            for (x = 0; x < w; x++) {
+                if (p == 0) {
+                    row[x] = (x + y) * 255 / (w + h - 2);
+                } else if (pix_fmt == PIX_FMT_NV12) {
+                    row[2 * x] = x * 255 / (w - 1);
+                    row[2 * x + 1] = y * 255 / (h - 1);
+                } else {
+                    row[x] = (p == 1 ? x * 255 / (w - 1) : y * 255 / (h - 1));
+                }
+            }
+        }
+    }
+}
+
+/* 2x2 average at the offsets SCALE_BOX samples, element by element */
+static void box_reference(const AVFrame *src, AVFrame *dst,
+        enum PixelFormat pix_fmt, int width, int height, int dst_w, int dst_h)
+{
+    int nv12 = pix_fmt == PIX_FMT_NV12;
+    int p, x, y, c;
+
+    for (p = 0; p < (nv12 ? 2 : 3); p++) {
+        int sw = p ? width / 2 : width, sh = p ? height / 2 : height;
+        int dw = p ? dst_w / 2 : dst_w, dh = p ? dst_h / 2 : dst_h;
+        int elem = p && nv12 ? 2 : 1;
+
+        for (y = 0; y < dh; y++) {
+            int sy = (int)((int64_t)y * sh / dh);
+            const uint8_t *r0, *r1;
+            uint8_t *d = dst->data[p] + y * dst->linesize[p];
+
+            if (sy > sh - 2)
+                sy = sh - 2;
+            r0 = src->data[p] + sy * src->linesize[p];
+            r1 = r0 + src->linesize[p];
+            for (x = 0; x < dw; x++) {
+                int sx = (int)((int64_t)x * sw / dw);
+
+                if (sx > sw - 2)
+                    sx = sw - 2;
+                for (c = 0; c < elem; c++) {
+                    int s = sx * elem + c;
+
+                    d[x * elem + c] = (r0[s] + r0[s + elem] +
+                            r1[s] + r1[s + elem] + 2) >> 2;
+                }
+            }
+        }
+    }
+}
+
+/* mean and max absolute difference over all planes */
+static void compare(const AVFrame *a, const AVFrame *b,
+        enum PixelFormat pix_fmt, int width, int height,
+        double *mean, int *max)
+{
+    int64_t sum = 0, count = 0;
+    int p, x, y;
+
+    *max = 0;
+    for (p = 0; p < (pix_fmt == PIX_FMT_NV12 ? 2 : 3); p++) {
+        int w = p == 0 || pix_fmt == PIX_FMT_NV12 ? width : width / 2;
+        int h = p ? height / 2 : height;
+
+        for (y = 0; y < h; y++) {
+            const uint8_t *ra = a->data[p] + y * a->linesize[p];
+            const uint8_t *rb = b->data[p] + y * b->linesize[p];
+
+            for (x = 0; x < w; x++) {
+                int d = abs(ra[x] - rb[x]);
+
+                sum += d;
+                if (d > *max)
+                    *max = d;
+            }
+        }
+        count += (int64_t)w * h;
+    }
+    *mean = count ? (double)sum / count : 0;
+}
+
+int scale_benchmark(enum PixelFormat pix_fmt, int width, int height,
+        int iterations)
+{
+    /* destination size as a fraction of the source */
+    static const int ratios[][2] = { { 1, 2 }, { 2, 3 }, { 1, 3 }, { 1, 4 } };
+    AVFrame *src;
+    int r, mode, i, nb_failed = 0;
+
+    src = frame_pool_alloc(pix_fmt, width, height);
+    if (!src) {
+        fprintf(stderr, "scale benchmark: could not allocate source\n");
+        return -1;
+    }
+    fill_ramp(src, pix_fmt, width, height);
+
+    printf("downscaler, %s %dx%d, %d iterations, Mpix/s of source\n",
+            pix_fmt == PIX_FMT_NV12 ? "nv12" : "yuv420p", width, height,
+            iterations);
+
+    for (r = 0; r < sizeof(ratios) / sizeof(ratios[0]); r++) {
+        int dst_w = width * ratios[r][0] / ratios[r][1] & ~1;
+        int dst_h = height * ratios[r][0] / ratios[r][1] & ~1;
+        int box2 = width == 2 * dst_w && height == 2 * dst_h;
+        AVFrame *dst, *ref;
+
+        dst = frame_pool_alloc(pix_fmt, dst_w, dst_h);
+        ref = frame_pool_alloc(pix_fmt, dst_w, dst_h);
+        if (!dst || !ref) {
+            fprintf(stderr, "scale benchmark: could not allocate %dx%d\n",
+                    dst_w, dst_h);
+            frame_pool_unref(dst);
+            frame_pool_unref(ref);
+            break;
+        }
+
+        for (mode = SCALE_POINT; mode <= SCALE_BILINEAR; mode++) {
+            struct SwsContext *sctx;
+            ScaleContext *ctx;
+            int64_t t0, t_own, t_sws;
+            double mpix, mean;
+            int max, failed;
+
+            ctx = scale_init(pix_fmt, width, height, dst_w, dst_h, mode);
+            sctx = sws_getContext(width, height, pix_fmt, dst_w, dst_h,
+                    pix_fmt, sws_flags[mode], NULL, NULL, NULL);
+            if (!ctx || !sctx) {
+                fprintf(stderr, "scale benchmark: %s %dx%d not supported\n",
+                        scale_mode_name(mode), dst_w, dst_h);
+                scale_free(ctx);
+                if (sctx)
+                    sws_freeContext(sctx);
+                continue;
+            }
+
+            t0 = time_now_us();
+            for (i = 0; i < iterations; i++)
+                scale_picture(ctx, (AVPicture *)src, (AVPicture *)dst);
+            t_own = time_now_us() - t0;
+
+            t0 = time_now_us();
+            for (i = 0; i < iterations; i++)
+                sws_scale(sctx, (const uint8_t * const *)src->data,
+                        src->linesize, 0, height, ref->data, ref->linesize);
+            t_sws = time_now_us() - t0;
+
+            if (mode == SCALE_BOX && !box2)
+                box_reference(src, ref, pix_fmt, width, height, dst_w, dst_h);
+            compare(dst, ref, pix_fmt, dst_w, dst_h, &mean, &max);
+            failed = mean > tolerance[mode].mean || max > tolerance[mode].max;
+            nb_failed += failed;
+            mpix = (double)width * height * iterations;
+            printf("  %-8s -> %4dx%-4d %7.1f Mpix/s (swscale %7.1f), "
+                    "diff mean %.2f max %d%s%s\n", scale_mode_name(mode),
+                    dst_w, dst_h, t_own ? mpix / t_own : 0,
+                    t_sws ? mpix / t_sws : 0, mean, max,
+                    mode == SCALE_BOX && !box2 ? " (vs 2x2 box)" : "",
+                    failed ? " FAILED" : "");
+
+            sws_freeContext(sctx);
+            scale_free(ctx);
+        }
+
+        frame_pool_unref(dst);
+        frame_pool_unref(ref);
+    }
+
+    frame_pool_unref(src);
+    if (nb_failed) {
+        fprintf(stderr, "scale benchmark: %d results off swscale beyond "
+                "tolerance\n", nb_failed);
+        return -1;
+    }
+    return 0;
+}
+
+/* make sure nb frames of this size can be taken from the registered pool */
+static int reserve_frames(enum PixelFormat pix_fmt, int width, int height,
+        int nb)
+{
+    FramePool *pool = frame_pool_find(pix_fmt, width, height);
+    FramePoolStats s;
+
+    if (pool) {
+        frame_pool_get_stats(pool, &s);
+        if (s.nb_frames - s.in_use >= nb)
+            return 0;
+    }
+    /* a new pool shadows the old one in frame_pool_find() */
+    return frame_pool_create(pix_fmt, width, height, nb) ? 0 : -1;
+}
+
+int scale_pyramid_benchmark(enum PixelFormat pix_fmt, int width, int height,
+        int iterations)
+{
+    ScalePyramid *pyr;
+    ScaleContext *ctx[2];
+    AVFrame *src, *levels[SCALE_LEVELS], *ref[SCALE_LEVELS];
+    int64_t t0, t_fused, t_sep;
+    int64_t size = avpicture_get_size(pix_fmt, width, height);
+    int i, n, ret = -1;
+
+    /* the source, the reference and the pyramid level at full size */
+    for (i = 0; i < SCALE_LEVELS; i++) {
+        if (reserve_frames(pix_fmt, width >> i, height >> i, i ? 2 : 3) < 0) {
+            fprintf(stderr, "pyramid benchmark: could not allocate %dx%d\n",
+                    width >> i, height >> i);
+            return -1;
+        }
+    }
+
+    src = frame_pool_alloc(pix_fmt, width, height);
+    pyr = scale_pyramid_init(pix_fmt, width, height,
+            SCALE_LEVEL(0) | SCALE_LEVEL(1) | SCALE_LEVEL(2));
+    ctx[0] = scale_init(pix_fmt, width, height, width / 2, height / 2,
+            SCALE_BOX);
+    ctx[1] = scale_init(pix_fmt, width, height, width / 4, height / 4,
+            SCALE_BOX);
+    for (i = 0; i < SCALE_LEVELS; i++)
+        ref[i] = frame_pool_alloc(pix_fmt, width >> i, height >> i);
+    if (!src || !pyr || !ctx[0] || !ctx[1] || !ref[0] || !ref[1] || !ref[2]) {
+        fprintf(stderr, "pyramid benchmark: %dx%d not supported\n",
+                width, height);
+        goto out;
+    }
+    pattern_fill(src, pix_fmt, width, height, 0, PATTERN_NOISE);
+
+    t0 = time_now_us();
+    for (n = 0; n < iterations; n++) {
+        if (scale_pyramid_build(pyr, (AVPicture *)src, levels) < 0)
+            goto out;
+        if (n + 1 < iterations) {
+            for (i = 0; i < SCALE_LEVELS; i++)
+                frame_pool_unref(levels[i]);
+        }
+    }
+    t_fused = time_now_us() - t0;
+
+    t0 = time_now_us();
+    for (n = 0; n < iterations; n++) {
+        av_picture_copy((AVPicture *)ref[0], (const AVPicture *)src,
+                pix_fmt, width, height);
+        scale_picture(ctx[0], (AVPicture *)src, (AVPicture *)ref[1]);
+        scale_picture(ctx[1], (AVPicture *)src, (AVPicture *)ref[2]);
+    }
+    t_sep = time_now_us() - t0;
+
+    /*
+     * Source bytes read per frame: the copy reads it all, the 2:1 box all
+     * rows, the 1/4 box two rows out of four. The pyramid reads it once.
+     */
+    printf("pyramid, %s %dx%d, %d iterations\n",
+            pix_fmt == PIX_FMT_NV12 ? "nv12" : "yuv420p", width, height,
+            iterations);
+    printf("  fused     %7.2f ms/frame, %6.1f MB/s source, %lld bytes read\n",
+            t_fused / 1000.0 / iterations,
+            t_fused ? (double)size * iterations / t_fused : 0,
+            (long long)size);
+    printf("  separate  %7.2f ms/frame, %6.1f MB/s source, %lld bytes read\n",
+            t_sep / 1000.0 / iterations,
+            t_sep ? (double)size * iterations / t_sep : 0,
+            (long long)(size * 5 / 2));
+    for (i = 0; i < SCALE_LEVELS; i++) {
+        double mean;
+        int max;
+
+        compare(levels[i], ref[i], pix_fmt, width >> i, height >> i,
+                &mean, &max);
+        printf("  level %d   %4dx%-4d diff mean %.2f max %d\n", i,
+                width >> i, height >> i, mean, max);
+        frame_pool_unref(levels[i]);
+    }
+    ret = 0;
+
+out:
+    for (i = 0; i < SCALE_LEVELS; i++)
+        frame_pool_unref(ref[i]);
+    scale_free(ctx[0]);
+    scale_free(ctx[1]);
+    scale_pyramid_free(pyr);
+    frame_pool_unref(src);
+    return ret;
+}
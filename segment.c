@@ -0,0 +1,438 @@
+/*
+ * Segmented recording into preallocated files
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#define _GNU_SOURCE     /* fallocate */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "async_io.h"
+#include "segment.h"
+#include "timeutil.h"
+
+/* segments waiting for their trailer */
+#define SEGMENT_FINISH_QUEUE 4
+
+typedef struct Segment {
+    int index;
+    char filename[300];
+    int fd;
+    AVFormatContext *oc;
+} Segment;
+
+struct SegmentWriter {
+    SegmentConfig cfg;
+    AVFormatContext *tmpl;
+    AVRational time_base;       /* of the packets coming in */
+    /* muxing thread */
+    Segment *cur;
+    int64_t start_pts;
+    int64_t bytes;
+    int64_t stall_done_us;      /* of the segments handed to the helper */
+    /* shared with the helper */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    Segment *next;              /* prepared, header written */
+    int prepare_index;          /* next segment to prepare, -1 for none */
+    Segment *finish[SEGMENT_FINISH_QUEUE];
+    int nb_finish;
+    int stop;
+    int error;
+    SegmentStats stats;
+};
+
+/*
+ * The pattern goes to snprintf() with the index, so it may hold exactly
+ * one %d, with flags and a width of up to two digits as in %04d, and %%
+ * otherwise.
+ */
+static int pattern_valid(const char *pattern)
+{
+    const char *p;
+    size_t width;
+    int nb_int = 0;
+
+    for (p = pattern; (p = strchr(p, '%')); p++) {
+        if (p[1] == '%') {
+            p++;
+            continue;
+        }
+        p++;
+        p += strspn(p, "-+ #0");
+        width = strspn(p, "0123456789");
+        p += width;
+        if (width > 2 || *p != 'd')
+            return 0;
+        nb_int++;
+    }
+    return nb_int == 1;
+}
+
+int segment_parse(const char *spec, SegmentConfig *cfg)
+{
+    const char *p;
+    double mib;
+
+    memset(cfg, 0, sizeof(*cfg));
+    p = strchr(spec, ':');
+    if (!p || p - spec >= sizeof(cfg->pattern))
+        return -1;
+    memcpy(cfg->pattern, spec, p - spec);
+    if (!pattern_valid(cfg->pattern) ||
+            sscanf(p + 1, "%lf:%lf", &cfg->max_duration, &mib) != 2 ||
+            cfg->max_duration < 0 || mib < 0)
+        return -1;
+    cfg->max_size = (int64_t)(mib * 1024 * 1024);
+    cfg->io_ring_size = ASYNC_IO_DEFAULT_RING;
+    return 0;
+}
+
+static void segment_free(Segment *seg)
+{
+    unsigned i;
+
+    if (seg->oc) {
+        for (i = 0; i < seg->oc->nb_streams; i++) {
+            av_freep(&seg->oc->streams[i]->codec->extradata);
+            av_freep(&seg->oc->streams[i]->codec);
+            av_freep(&seg->oc->streams[i]);
+        }
+        av_free(seg->oc);
+    }
+    if (seg->fd >= 0)
+        close(seg->fd);
+    free(seg);
+}
+
+/* what a segment is expected to grow to, 0 when there is no telling */
+static int64_t segment_expected_size(const SegmentConfig *cfg,
+        const AVCodecContext *c)
+{
+    int64_t size;
+
+    if (cfg->max_duration <= 0 || c->bit_rate <= 0)
+        return cfg->max_size;
+    /* the rate is only an average, leave room for container overhead too */
+    size = (int64_t)(c->bit_rate / 8 * cfg->max_duration);
+    size += size / 8;
+    if (cfg->max_size && size > cfg->max_size)
+        size = cfg->max_size;
+    return size;
+}
+
+/* helper thread: create the file, reserve its blocks, write the header */
+static Segment *segment_prepare(SegmentWriter *w, int index)
+{
+    Segment *seg;
+    AVStream *st;
+    int64_t prealloc = w->cfg.prealloc;
+
+    seg = calloc(1, sizeof(*seg));
+    if (!seg)
+        return NULL;
+    seg->index = index;
+    snprintf(seg->filename, sizeof(seg->filename), w->cfg.pattern, index);
+
+    seg->fd = open(seg->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (seg->fd < 0) {
+        fprintf(stderr, "segment: could not open '%s'\n", seg->filename);
+        free(seg);
+        return NULL;
+    }
+    /* one extent up front instead of growing it packet by packet; the
+       size stays 0 so a crash leaves a file of what was written */
+    if (prealloc > 0 &&
+            fallocate(seg->fd, FALLOC_FL_KEEP_SIZE, 0, prealloc) < 0) {
+        pthread_mutex_lock(&w->lock);
+        w->stats.nb_prealloc_failed++;
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    seg->oc = avformat_alloc_context();
+    if (!seg->oc)
+        goto fail;
+    seg->oc->oformat = w->tmpl->oformat;
+    snprintf(seg->oc->filename, sizeof(seg->oc->filename), "%s",
+            seg->filename);
+    st = av_new_stream(seg->oc, 0);
+    if (!st || avcodec_copy_context(st->codec, w->tmpl->streams[0]->codec) < 0)
+        goto fail;
+
+    seg->oc->pb = async_io_open_fd(seg->fd, w->cfg.io_ring_size,
+            w->cfg.io_flags);
+    if (!seg->oc->pb)
+        goto fail;
+    if (avformat_write_header(seg->oc, NULL) < 0) {
+        async_io_close(seg->oc->pb);
+        goto fail;
+    }
+    return seg;
+
+fail:
+    fprintf(stderr, "segment: could not set up '%s'\n", seg->filename);
+    segment_free(seg);
+    return NULL;
+}
+
+/* helper thread: trailer, then give back what was reserved and not used */
+static void segment_finish(Segment *seg, int discard)
+{
+    struct stat st;
+
+    if (!discard)
+        av_write_trailer(seg->oc);
+    async_io_close(seg->oc->pb);
+    if (discard)
+        unlink(seg->filename);
+    else if (fstat(seg->fd, &st) < 0 || ftruncate(seg->fd, st.st_size) < 0)
+        fprintf(stderr, "segment: could not trim '%s'\n", seg->filename);
+    segment_free(seg);
+}
+
+static void *segment_thread(void *arg)
+{
+    SegmentWriter *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->stop && !w->nb_finish &&
+                (w->prepare_index < 0 || w->next))
+            pthread_cond_wait(&w->cond, &w->lock);
+
+        if (w->nb_finish) {
+            Segment *seg = w->finish[0];
+
+            w->nb_finish--;
+            memmove(w->finish, w->finish + 1, w->nb_finish * sizeof(*w->finish));
+            pthread_cond_broadcast(&w->cond);
+            pthread_mutex_unlock(&w->lock);
+            segment_finish(seg, 0);
+            pthread_mutex_lock(&w->lock);
+            continue;
+        }
+        if (w->stop)
+            break;
+
+        if (w->prepare_index >= 0 && !w->next) {
+            int index = w->prepare_index;
+            Segment *seg;
+
+            pthread_mutex_unlock(&w->lock);
+            seg = segment_prepare(w, index);
+            pthread_mutex_lock(&w->lock);
+            w->next = seg;
+            w->prepare_index = -1;
+            if (!seg)
+                w->error = 1;
+            pthread_cond_broadcast(&w->cond);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+SegmentWriter *segment_open(const SegmentConfig *cfg, AVFormatContext *tmpl)
+{
+    SegmentWriter *w;
+
+    if (!pattern_valid(cfg->pattern)) {
+        fprintf(stderr, "segment: '%s' needs exactly one %%d\n", cfg->pattern);
+        return NULL;
+    }
+    w = calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+    w->cfg = *cfg;
+    w->tmpl = tmpl;
+    /* tmpl never had its header written, its stream may lack a time base */
+    w->time_base = tmpl->streams[0]->time_base;
+    if (!w->time_base.num)
+        w->time_base = tmpl->streams[0]->codec->time_base;
+    w->start_pts = AV_NOPTS_VALUE;
+    if (!w->cfg.prealloc)
+        w->cfg.prealloc = segment_expected_size(cfg, tmpl->streams[0]->codec);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    /* the first segment is needed right away */
+    w->cur = segment_prepare(w, cfg->first_index);
+    if (!w->cur) {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        free(w);
+        return NULL;
+    }
+    w->stats.nb_segments = 1;
+    /* without limits there never is a next one, unless asked for */
+    w->prepare_index = -1;
+    if (cfg->max_duration > 0 || cfg->max_size > 0 || cfg->on_demand)
+        w->prepare_index = cfg->first_index + 1;
+
+    if (pthread_create(&w->thread, NULL, segment_thread, w)) {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        segment_finish(w->cur, 0);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+static int segment_full(SegmentWriter *w, const AVPacket *pkt)
+{
+    if (w->cfg.max_size && w->bytes >= w->cfg.max_size)
+        return 1;
+    return w->cfg.max_duration > 0 && pkt->pts != AV_NOPTS_VALUE &&
+        w->start_pts != AV_NOPTS_VALUE &&
+        (pkt->pts - w->start_pts) * av_q2d(w->time_base) >= w->cfg.max_duration;
+}
+
+static int segment_switch(SegmentWriter *w)
+{
+    Segment *seg;
+    AsyncIOStats as;
+    int64_t t0 = time_now_us(), dt;
+
+    async_io_get_stats(w->cur->oc->pb, &as);
+    pthread_mutex_lock(&w->lock);
+    if (!w->next && !w->error)
+        w->stats.nb_late++;
+    while ((!w->next || w->nb_finish == SEGMENT_FINISH_QUEUE) && !w->error)
+        pthread_cond_wait(&w->cond, &w->lock);
+    if (w->error) {
+        pthread_mutex_unlock(&w->lock);
+        return -1;
+    }
+    seg = w->next;
+    w->next = NULL;
+    w->stall_done_us += as.stall_us;
+    w->finish[w->nb_finish++] = w->cur;
+    w->prepare_index = seg->index + 1;
+    pthread_cond_broadcast(&w->cond);
+
+    dt = time_now_us() - t0;
+    w->stats.nb_segments++;
+    w->stats.switch_total_us += dt;
+    if (dt > w->stats.switch_max_us)
+        w->stats.switch_max_us = dt;
+    pthread_mutex_unlock(&w->lock);
+
+    w->cur = seg;
+    w->start_pts = AV_NOPTS_VALUE;
+    w->bytes = 0;
+    return 0;
+}
+
+int segment_write(SegmentWriter *w, AVPacket *pkt)
+{
+    AsyncIOStats as;
+    int size = pkt->size;
+
+    if ((pkt->flags & AV_PKT_FLAG_KEY) && segment_full(w, pkt) &&
+            segment_switch(w) < 0) {
+        fprintf(stderr, "segment: no next segment to switch to\n");
+        return -1;
+    }
+
+    if (w->start_pts == AV_NOPTS_VALUE)
+        w->start_pts = pkt->pts;
+    if (pkt->pts != AV_NOPTS_VALUE && w->start_pts != AV_NOPTS_VALUE)
+        pkt->pts = av_rescale_q(pkt->pts - w->start_pts, w->time_base,
+                w->cur->oc->streams[0]->time_base);
+    if (pkt->dts != AV_NOPTS_VALUE && w->start_pts != AV_NOPTS_VALUE)
+        pkt->dts = av_rescale_q(pkt->dts - w->start_pts, w->time_base,
+                w->cur->oc->streams[0]->time_base);
+    pkt->stream_index = 0;
+
+    if (av_interleaved_write_frame(w->cur->oc, pkt) != 0)
+        return -1;
+    w->bytes += size;
+
+    /* for the rate controller on the encoding thread */
+    async_io_get_stats(w->cur->oc->pb, &as);
+    pthread_mutex_lock(&w->lock);
+    w->stats.io_fill = as.fill;
+    w->stats.io_ring_size = as.ring_size;
+    w->stats.io_stall_us = w->stall_done_us + as.stall_us;
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+int segment_next(SegmentWriter *w)
+{
+    if (segment_switch(w) < 0) {
+        fprintf(stderr, "segment: no next segment to switch to\n");
+        return -1;
+    }
+    return 0;
+}
+
+void segment_get_stats(SegmentWriter *w, SegmentStats *stats)
+{
+    pthread_mutex_lock(&w->lock);
+    *stats = w->stats;
+    pthread_mutex_unlock(&w->lock);
+}
+
+int segment_close(SegmentWriter *w)
+{
+    SegmentStats s;
+    int unused, ret;
+
+    if (!w)
+        return 0;
+
+    /* the helper empties the finish queue before it stops */
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    unused = !w->bytes && (w->cfg.on_demand || w->stats.nb_segments > 1);
+    segment_finish(w->cur, unused);
+    if (unused)
+        w->stats.nb_segments--;
+    if (w->next)
+        segment_finish(w->next, 1);
+    ret = w->error ? -1 : 0;
+
+    s = w->stats;
+    printf("segments: %d written, switch %lld us avg / %lld us max, "
+            "%d late, %d without preallocation\n", s.nb_segments,
+            (long long)(s.nb_segments > 1 ?
+                    s.switch_total_us / (s.nb_segments - 1) : 0),
+            (long long)s.switch_max_us, s.nb_late, s.nb_prealloc_failed);
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+    return ret;
+}
@@ -0,0 +1,89 @@
+/*
+ * Segmented recording into preallocated files
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+typedef struct SegmentConfig {
+    char pattern[256];          /* file name with one %d, e.g. rec%04d.avi */
+    double max_duration;        /* seconds per segment, 0 for no limit */
+    int64_t max_size;           /* bytes per segment, 0 for no limit */
+    int64_t prealloc;           /* fallocate()d up front, 0 to derive it
+                                   from the bit rate and the limits */
+    int first_index;            /* number of the first file */
+    int io_ring_size;           /* async_io ring of each segment */
+    int io_flags;
+    int on_demand;              /* keep a next file ready for segment_next() */
+} SegmentConfig;
+
+typedef struct SegmentStats {
+    int nb_segments;
+    int nb_late;                /* switches that waited for the next file */
+    int nb_prealloc_failed;
+    int64_t switch_total_us;
+    int64_t switch_max_us;
+    /* async_io ring of the current segment, after the last packet */
+    int io_fill;
+    int io_ring_size;
+    int64_t io_stall_us;        /* over all segments so far */
+} SegmentStats;
+
+typedef struct SegmentWriter SegmentWriter;
+
+/* parse "pattern:seconds:MiB", a 0 disables that limit */
+int segment_parse(const char *spec, SegmentConfig *cfg);
+
+/**
+ * Record the stream st describes into a series of files. A helper thread
+ * creates and preallocates the next segment and writes its header ahead of
+ * time, and writes the trailer of the previous one, so a switch on the
+ * muxing thread is only a pointer swap.
+ */
+SegmentWriter *segment_open(const SegmentConfig *cfg, AVFormatContext *tmpl);
+
+/**
+ * Mux a packet of stream 0. Before a key frame, a segment that reached its
+ * duration or size is closed and the packet starts the next one, with
+ * timestamps starting from 0 again.
+ */
+int segment_write(SegmentWriter *w, AVPacket *pkt);
+
+/**
+ * Finish the current segment now and make the prepared one current, needs
+ * cfg->on_demand without limits. Only a pointer swap on the calling thread.
+ */
+int segment_next(SegmentWriter *w);
+
+void segment_get_stats(SegmentWriter *w, SegmentStats *stats);
+
+/**
+ * Finish the current segment, remove the unused next one, print the stats.
+ * A current segment that segment_next() opened and nothing was written to
+ * is removed as well.
+ */
+int segment_close(SegmentWriter *w);
+
+#endif /* SEGMENT_H */
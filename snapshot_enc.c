@@ -0,0 +1,287 @@
+/*
+ * Persistent still image encoders
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include <libswscale/swscale.h>
+
+#include "frame_pool.h"
+#include "snapshot_enc.h"
+#include "timeutil.h"
+
+struct SnapshotEncoder {
+    enum SnapshotFormat format;
+    enum PixelFormat src_fmt;
+    int width, height;
+    AVCodecContext *avctx;
+    struct SwsContext *sws;     /* NULL when the codec takes src_fmt */
+    AVFrame *picture;           /* converted picture, from a frame pool */
+    uint8_t *outbuf;            /* written by the CPU only, so plain memory */
+    int outbuf_size;
+    /* stats */
+    unsigned nb_encoded;
+    int64_t encode_us;
+    struct SnapshotEncoder *next;
+};
+
+static const struct {
+    const char *ext;
+    enum SnapshotFormat format;
+    enum CodecID codec_id;
+    enum PixelFormat pix_fmt;   /* used unless the codec insists on another */
+} snapshot_formats[] = {
+    { "bmp",  SNAPSHOT_BMP,  CODEC_ID_BMP,   PIX_FMT_BGR24 },
+    { "png",  SNAPSHOT_PNG,  CODEC_ID_PNG,   PIX_FMT_RGB24 },
+    { "jpg",  SNAPSHOT_JPEG, CODEC_ID_MJPEG, PIX_FMT_YUVJ420P },
+    { "jpeg", SNAPSHOT_JPEG, CODEC_ID_MJPEG, PIX_FMT_YUVJ420P },
+    { "pgm",  SNAPSHOT_PGM,  CODEC_ID_PGM,   PIX_FMT_GRAY8 },
+};
+
+#define NB_FORMATS (sizeof(snapshot_formats) / sizeof(snapshot_formats[0]))
+
+static SnapshotEncoder *encoders;
+static pthread_mutex_t encoders_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *format_names[] = {
+    [SNAPSHOT_BMP]  = "bmp",
+    [SNAPSHOT_PNG]  = "png",
+    [SNAPSHOT_JPEG] = "jpeg",
+    [SNAPSHOT_PGM]  = "pgm",
+};
+
+int snapshot_format_from_filename(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+    int i;
+
+    if (!ext)
+        return -1;
+    for (i = 0; i < NB_FORMATS; i++) {
+        if (!strcasecmp(ext + 1, snapshot_formats[i].ext))
+            return snapshot_formats[i].format;
+    }
+    return -1;
+}
+
+static int codec_takes(const AVCodec *codec, enum PixelFormat pix_fmt)
+{
+    const enum PixelFormat *p;
+
+    if (!codec->pix_fmts)
+        return 1;
+    for (p = codec->pix_fmts; *p != -1; p++) {
+        if (*p == pix_fmt)
+            return 1;
+    }
+    return 0;
+}
+
+static void encoder_free(SnapshotEncoder *enc)
+{
+    if (enc->avctx) {
+        if (enc->avctx->codec)
+            avcodec_close(enc->avctx);
+        av_free(enc->avctx);
+    }
+    sws_freeContext(enc->sws);
+    frame_pool_unref(enc->picture);
+    av_free(enc->outbuf);
+    free(enc);
+}
+
+static SnapshotEncoder *encoder_create(enum SnapshotFormat format,
+        enum PixelFormat src_fmt, int width, int height)
+{
+    SnapshotEncoder *enc;
+    AVCodecContext *c;
+    AVCodec *codec;
+    enum PixelFormat pix_fmt;
+    int i, raw_size;
+
+    for (i = 0; i < NB_FORMATS; i++) {
+        if (snapshot_formats[i].format == format)
+            break;
+    }
+    if (i == NB_FORMATS)
+        return NULL;
+
+    codec = avcodec_find_encoder(snapshot_formats[i].codec_id);
+    if (!codec) {
+        fprintf(stderr, "snapshot: no %s encoder\n", format_names[format]);
+        return NULL;
+    }
+    pix_fmt = snapshot_formats[i].pix_fmt;
+    if (!codec_takes(codec, pix_fmt))
+        pix_fmt = codec->pix_fmts[0];
+
+    enc = calloc(1, sizeof(*enc));
+    if (!enc)
+        return NULL;
+    enc->format = format;
+    enc->src_fmt = src_fmt;
+    enc->width = width;
+    enc->height = height;
+
+    enc->avctx = c = avcodec_alloc_context();
+    if (!c)
+        goto fail;
+    c->codec_id = codec->id;
+    c->codec_type = AVMEDIA_TYPE_VIDEO;
+    c->width = width;
+    c->height = height;
+    c->pix_fmt = pix_fmt;
+    c->time_base = (AVRational) {1, 1};
+    if (avcodec_open(c, codec) < 0) {
+        fprintf(stderr, "snapshot: could not open %s encoder\n",
+                format_names[format]);
+        goto fail;
+    }
+
+    if (pix_fmt != src_fmt) {
+        enc->sws = sws_getContext(width, height, src_fmt, width, height,
+                pix_fmt, SWS_POINT, NULL, NULL, NULL);
+        enc->picture = frame_pool_alloc(pix_fmt, width, height);
+        if (!enc->sws || !enc->picture)
+            goto fail;
+    }
+
+    /* room for compression that does not compress and container overhead */
+    raw_size = avpicture_get_size(pix_fmt, width, height);
+    enc->outbuf_size = raw_size + raw_size / 8 + FF_MIN_BUFFER_SIZE;
+    enc->outbuf = av_malloc(enc->outbuf_size);
+    if (!enc->outbuf)
+        goto fail;
+
+    return enc;
+
+fail:
+    encoder_free(enc);
+    return NULL;
+}
+
+SnapshotEncoder *snapshot_encoder_get(enum SnapshotFormat format,
+        enum PixelFormat pix_fmt, int width, int height)
+{
+    SnapshotEncoder *enc;
+
+    pthread_mutex_lock(&encoders_lock);
+    for (enc = encoders; enc; enc = enc->next) {
+        if (enc->format == format && enc->src_fmt == pix_fmt &&
+                enc->width == width && enc->height == height)
+            break;
+    }
+    if (!enc) {
+        enc = encoder_create(format, pix_fmt, width, height);
+        if (enc) {
+            enc->next = encoders;
+            encoders = enc;
+        }
+    }
+    pthread_mutex_unlock(&encoders_lock);
+    return enc;
+}
+
+int snapshot_encode(SnapshotEncoder *enc, const AVPicture *pict,
+        const uint8_t **data)
+{
+    const AVFrame *src = (const AVFrame *)pict;
+    int64_t t0 = time_now_us();
+    int size;
+
+    if (enc->sws) {
+        sws_scale(enc->sws, (const uint8_t * const *)pict->data,
+                pict->linesize, 0, enc->height, enc->picture->data,
+                enc->picture->linesize);
+        frame_pool_sync_for_device(enc->picture, FRAME_PLANES_ALL);
+        src = enc->picture;
+    }
+
+    size = avcodec_encode_video(enc->avctx, enc->outbuf, enc->outbuf_size,
+            src);
+    if (size < 0)
+        return size;
+
+    enc->nb_encoded++;
+    enc->encode_us += time_now_us() - t0;
+    *data = enc->outbuf;
+    return size;
+}
+
+int snapshot_save(ImageDump *dump, const AVPicture *pict,
+        enum PixelFormat pix_fmt, int width, int height, const char *filename)
+{
+    SnapshotEncoder *enc;
+    const uint8_t *data;
+    int format, size;
+
+    format = snapshot_format_from_filename(filename);
+    if (format < 0) {
+        fprintf(stderr, "snapshot: unknown image format '%s'\n", filename);
+        return -1;
+    }
+    enc = snapshot_encoder_get(format, pix_fmt, width, height);
+    if (!enc)
+        return -1;
+    size = snapshot_encode(enc, pict, &data);
+    if (size < 0) {
+        fprintf(stderr, "snapshot: encoding '%s' failed\n", filename);
+        return -1;
+    }
+
+    return image_dump_data(dump, filename, data, size);
+}
+
+void snapshot_encoders_print_stats(void)
+{
+    SnapshotEncoder *enc;
+
+    pthread_mutex_lock(&encoders_lock);
+    for (enc = encoders; enc; enc = enc->next) {
+        printf("snapshot encoder %s %dx%d fmt %d%s: %u images",
+                format_names[enc->format], enc->width, enc->height,
+                enc->src_fmt, enc->sws ? " (converted)" : "",
+                enc->nb_encoded);
+        if (enc->nb_encoded)
+            printf(", %lld us each",
+                    (long long)(enc->encode_us / enc->nb_encoded));
+        printf("\n");
+    }
+    pthread_mutex_unlock(&encoders_lock);
+}
+
+void snapshot_encoders_free(void)
+{
+    SnapshotEncoder *enc, *next;
+
+    pthread_mutex_lock(&encoders_lock);
+    for (enc = encoders; enc; enc = next) {
+        next = enc->next;
+        encoder_free(enc);
+    }
+    encoders = NULL;
+    pthread_mutex_unlock(&encoders_lock);
+}
@@ -0,0 +1,73 @@
+/*
+ * Persistent still image encoders
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef SNAPSHOT_ENC_H
+#define SNAPSHOT_ENC_H
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+#include "image_dump.h"
+
+enum SnapshotFormat {
+    SNAPSHOT_BMP,
+    SNAPSHOT_PNG,
+    SNAPSHOT_JPEG,
+    SNAPSHOT_PGM,           /* the luma plane only */
+};
+
+typedef struct SnapshotEncoder SnapshotEncoder;
+
+/* format from a file name's extension, -1 if it is none of the above */
+int snapshot_format_from_filename(const char *filename);
+
+/**
+ * Get the encoder for pictures of (pix_fmt, width, height) into format.
+ * Encoders are created on first use and keep their codec, converter,
+ * picture and output buffer until snapshot_encoders_free(), so a batch of
+ * snapshots of the same size costs one codec open. An encoder must be
+ * used by one thread at a time.
+ */
+SnapshotEncoder *snapshot_encoder_get(enum SnapshotFormat format,
+        enum PixelFormat pix_fmt, int width, int height);
+
+/**
+ * Encode pict. On success *data points to the image in the encoder's
+ * buffer, valid until the next call on the same encoder.
+ *
+ * @return the image size or a negative value on error
+ */
+int snapshot_encode(SnapshotEncoder *enc, const AVPicture *pict,
+        const uint8_t **data);
+
+/* encode pict and write it through dump as filename, in the format the
+   name implies */
+int snapshot_save(ImageDump *dump, const AVPicture *pict,
+        enum PixelFormat pix_fmt, int width, int height, const char *filename);
+
+void snapshot_encoders_print_stats(void);
+
+/* close every encoder and release its buffers */
+void snapshot_encoders_free(void);
+
+#endif /* SNAPSHOT_ENC_H */
@@ -0,0 +1,255 @@
+/*
+ * Asynchronous writer for encoded snapshots
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "image_dump.h"
+#include "snapshot_sink.h"
+#include "stats.h"
+#include "timeutil.h"
+
+typedef struct SnapshotSlot {
+    uint8_t *data;
+    int size;
+    int frame_number;
+} SnapshotSlot;
+
+struct SnapshotSink {
+    char filename[256];
+    int numbered;               /* filename has a %d for the frame number */
+    int every_n;
+    int max_size;
+    int depth;
+    SnapshotSlot *slots;
+    ImageDump *dump;
+    int head, count;            /* ring of filled slots */
+    int requested;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    SnapshotSinkStats stats;
+};
+
+static int write_snapshot(SnapshotSink *sink, SnapshotSlot *slot)
+{
+    char name[300], tmp[310];
+    int ret;
+
+    if (sink->numbered)
+        snprintf(name, sizeof(name), sink->filename, slot->frame_number);
+    else
+        snprintf(name, sizeof(name), "%s", sink->filename);
+
+    /* readers of a fixed name never see a half written file */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    ret = image_dump_data(sink->dump, tmp, slot->data, slot->size);
+    image_dump_release(sink->dump);
+    if (ret < 0 || rename(tmp, name) < 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+    SnapshotSink *sink = arg;
+
+    pthread_mutex_lock(&sink->lock);
+    for (;;) {
+        SnapshotSlot *slot;
+        int64_t t0, dt;
+        int ret;
+
+        while (!sink->count && !sink->stop)
+            pthread_cond_wait(&sink->cond, &sink->lock);
+        if (!sink->count)
+            break;
+        slot = &sink->slots[sink->head];
+        pthread_mutex_unlock(&sink->lock);
+
+        /* the slot stays ours until head moves on */
+        t0 = time_now_us();
+        ret = write_snapshot(sink, slot);
+        dt = time_now_us() - t0;
+        stats_record(STATS_SNAPSHOT, dt);
+
+        pthread_mutex_lock(&sink->lock);
+        sink->head = (sink->head + 1) % sink->depth;
+        sink->count--;
+        if (ret < 0)
+            sink->stats.nb_failed++;
+        else
+            sink->stats.nb_written++;
+        sink->stats.write_total_us += dt;
+        if (dt > sink->stats.write_max_us)
+            sink->stats.write_max_us = dt;
+    }
+    pthread_mutex_unlock(&sink->lock);
+
+    return NULL;
+}
+
+SnapshotSink *snapshot_sink_open(const char *filename, int every_n,
+        int depth, int max_size)
+{
+    SnapshotSink *sink;
+    int i;
+
+    sink = calloc(1, sizeof(*sink));
+    if (!sink)
+        return NULL;
+    snprintf(sink->filename, sizeof(sink->filename), "%s", filename);
+    sink->numbered = strchr(filename, '%') != NULL;
+    sink->every_n = every_n;
+    sink->max_size = max_size;
+    sink->depth = depth;
+
+    sink->dump = image_dump_open(NULL);
+    sink->slots = calloc(depth, sizeof(*sink->slots));
+    if (!sink->dump || !sink->slots)
+        goto fail;
+    for (i = 0; i < depth; i++) {
+        sink->slots[i].data = malloc(max_size);
+        if (!sink->slots[i].data)
+            goto fail;
+    }
+
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->cond, NULL);
+    if (pthread_create(&sink->thread, NULL, writer_thread, sink)) {
+        pthread_cond_destroy(&sink->cond);
+        pthread_mutex_destroy(&sink->lock);
+        goto fail;
+    }
+
+    return sink;
+
+fail:
+    if (sink->slots) {
+        for (i = 0; i < depth; i++)
+            free(sink->slots[i].data);
+    }
+    free(sink->slots);
+    image_dump_close(sink->dump);
+    free(sink);
+    return NULL;
+}
+
+void snapshot_sink_request(SnapshotSink *sink)
+{
+    pthread_mutex_lock(&sink->lock);
+    sink->requested = 1;
+    pthread_mutex_unlock(&sink->lock);
+}
+
+int snapshot_sink_push(SnapshotSink *sink, const uint8_t *data, int size,
+        int frame_number)
+{
+    SnapshotSlot *slot;
+    int64_t t0, dt;
+    int ret;
+
+    t0 = time_now_us();
+    pthread_mutex_lock(&sink->lock);
+    if (!sink->requested &&
+            (sink->every_n <= 0 || frame_number % sink->every_n)) {
+        pthread_mutex_unlock(&sink->lock);
+        return 0;
+    }
+    sink->requested = 0;
+
+    if (size > sink->max_size) {
+        sink->stats.nb_too_big++;
+        ret = -1;
+    } else if (sink->count == sink->depth) {
+        sink->stats.nb_dropped++;
+        ret = -1;
+    } else {
+        /* nobody else touches a free slot, copy without the lock */
+        slot = &sink->slots[(sink->head + sink->count) % sink->depth];
+        pthread_mutex_unlock(&sink->lock);
+        memcpy(slot->data, data, size);
+        slot->size = size;
+        slot->frame_number = frame_number;
+        pthread_mutex_lock(&sink->lock);
+
+        sink->count++;
+        sink->stats.nb_queued++;
+        if (sink->count > sink->stats.max_queued)
+            sink->stats.max_queued = sink->count;
+        pthread_cond_signal(&sink->cond);
+        ret = 1;
+    }
+
+    dt = time_now_us() - t0;
+    if (dt > sink->stats.push_max_us)
+        sink->stats.push_max_us = dt;
+    pthread_mutex_unlock(&sink->lock);
+
+    return ret;
+}
+
+void snapshot_sink_get_stats(SnapshotSink *sink, SnapshotSinkStats *stats)
+{
+    pthread_mutex_lock(&sink->lock);
+    *stats = sink->stats;
+    pthread_mutex_unlock(&sink->lock);
+}
+
+void snapshot_sink_close(SnapshotSink *sink)
+{
+    SnapshotSinkStats s;
+    int i;
+
+    if (!sink)
+        return;
+
+    pthread_mutex_lock(&sink->lock);
+    sink->stop = 1;
+    pthread_cond_signal(&sink->cond);
+    pthread_mutex_unlock(&sink->lock);
+    pthread_join(sink->thread, NULL);
+
+    s = sink->stats;
+    printf("snapshots: %u queued, %u written, %u dropped, %u too big, "
+            "%u failed, max queued %d/%d, push max %lld us, "
+            "write %lld us avg / %lld us max\n", s.nb_queued, s.nb_written,
+            s.nb_dropped, s.nb_too_big, s.nb_failed, s.max_queued,
+            sink->depth, (long long)s.push_max_us,
+            (long long)(s.nb_written + s.nb_failed ?
+                    s.write_total_us / (s.nb_written + s.nb_failed) : 0),
+            (long long)s.write_max_us);
+
+    pthread_cond_destroy(&sink->cond);
+    pthread_mutex_destroy(&sink->lock);
+    for (i = 0; i < sink->depth; i++)
+        free(sink->slots[i].data);
+    free(sink->slots);
+    image_dump_close(sink->dump);
+    free(sink);
+}
@@ -0,0 +1,72 @@
+/*
+ * Asynchronous writer for encoded snapshots
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef SNAPSHOT_SINK_H
+#define SNAPSHOT_SINK_H
+
+#include <stdint.h>
+
+typedef struct SnapshotSink SnapshotSink;
+
+typedef struct SnapshotSinkStats {
+    unsigned nb_queued;         /* packets copied into the queue */
+    unsigned nb_written;
+    unsigned nb_dropped;        /* queue full, packet not taken */
+    unsigned nb_too_big;        /* larger than a queue slot */
+    unsigned nb_failed;         /* write errors */
+    int max_queued;             /* queue high-water mark */
+    int64_t push_max_us;        /* worst time spent on the encode thread */
+    int64_t write_max_us;       /* worst open/write/close on the writer */
+    int64_t write_total_us;
+} SnapshotSinkStats;
+
+/**
+ * Start a snapshot writer thread with a queue of depth slots of max_size
+ * bytes each, allocated once here.
+ *
+ * @param filename  output name; a printf pattern with one %d gets the frame
+ *                  number, otherwise the file is replaced on every snapshot
+ * @param every_n   take every Nth packet, 0 for on demand only
+ */
+SnapshotSink *snapshot_sink_open(const char *filename, int every_n,
+        int depth, int max_size);
+
+/* take the next packet pushed, regardless of every_n */
+void snapshot_sink_request(SnapshotSink *sink);
+
+/**
+ * Offer an encoded packet, from a single producer thread. Never blocks on
+ * storage: if the packet is
+ * selected it is copied into a free slot, if there is none it is dropped.
+ *
+ * @return 1 if queued, 0 if not selected, -1 if dropped
+ */
+int snapshot_sink_push(SnapshotSink *sink, const uint8_t *data, int size,
+        int frame_number);
+
+void snapshot_sink_get_stats(SnapshotSink *sink, SnapshotSinkStats *stats);
+
+/* write out what is queued, stop the thread and print the stats */
+void snapshot_sink_close(SnapshotSink *sink);
+
+#endif /* SNAPSHOT_SINK_H */
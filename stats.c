@@ -0,0 +1,290 @@
+/*
+ * Per stage latency histograms
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+#define SUB_BITS STATS_SUB_BITS
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NB_BUCKETS STATS_NB_BUCKETS
+
+static StatsHistogram histograms[STATS_NB_STAGES];
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+static const char *stage_names[STATS_NB_STAGES] = {
+    [STATS_PATTERN]     = "pattern",
+    [STATS_SWS]         = "sws_scale",
+    [STATS_ENCODE]      = "encode",
+    [STATS_MUX]         = "mux",
+    [STATS_SNAPSHOT]    = "snapshot",
+    [STATS_DECODE]      = "decode",
+    [STATS_SCALE]       = "scale",
+    [STATS_SAVE_IMAGE]  = "save_image",
+};
+
+static char *output_path;
+static volatile sig_atomic_t dump_pending;
+
+static void stats_init(void)
+{
+    int i;
+
+    for (i = 0; i < STATS_NB_STAGES; i++)
+        stats_histogram_init(&histograms[i]);
+}
+
+void stats_histogram_init(StatsHistogram *h)
+{
+    memset(h, 0, sizeof(*h));
+    pthread_mutex_init(&h->lock, NULL);
+}
+
+void stats_histogram_destroy(StatsHistogram *h)
+{
+    pthread_mutex_destroy(&h->lock);
+}
+
+static int bucket_index(uint32_t v)
+{
+    int msb, shift;
+
+    if (v < SUB_BUCKETS)
+        return v;
+    msb = 31 - __builtin_clz(v);
+    shift = msb - SUB_BITS;
+    return ((shift + 1) << SUB_BITS) + ((v >> shift) & (SUB_BUCKETS - 1));
+}
+
+/* largest value that lands in bucket i */
+static int64_t bucket_upper(int i)
+{
+    int shift;
+
+    if (i < SUB_BUCKETS)
+        return i;
+    shift = (i >> SUB_BITS) - 1;
+    return ((int64_t)(SUB_BUCKETS + (i & (SUB_BUCKETS - 1))) << shift) +
+        ((int64_t)1 << shift) - 1;
+}
+
+static void write_output(void);
+
+void stats_histogram_record(StatsHistogram *h, int64_t us)
+{
+    if (us < 0)
+        us = 0;
+    else if (us > UINT32_MAX)
+        us = UINT32_MAX;
+
+    pthread_mutex_lock(&h->lock);
+    h->buckets[bucket_index(us)]++;
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us)
+        h->max_us = us;
+    pthread_mutex_unlock(&h->lock);
+}
+
+void stats_record(enum StatsStage stage, int64_t us)
+{
+    pthread_once(&stats_once, stats_init);
+    stats_histogram_record(&histograms[stage], us);
+
+    /* SIGUSR1 only raises the flag, whoever records next does the dump */
+    if (dump_pending) {
+        dump_pending = 0;
+        write_output();
+    }
+}
+
+const char *stats_stage_name(enum StatsStage stage)
+{
+    return stage_names[stage];
+}
+
+/* the bucket holding the sample of rank ceil(p * count) */
+static int64_t percentile(const StatsHistogram *h, double p)
+{
+    unsigned rank = (unsigned)(p * h->count + 0.999999), seen = 0;
+    int i;
+
+    if (!rank)
+        rank = 1;
+    for (i = 0; i < NB_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return bucket_upper(i) < h->max_us ? bucket_upper(i) : h->max_us;
+    }
+    return h->max_us;
+}
+
+static void summarize(const StatsHistogram *h, StatsSummary *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->count = h->count;
+    if (!h->count)
+        return;
+    s->mean_us = h->sum_us / h->count;
+    s->p50_us = percentile(h, 0.50);
+    s->p95_us = percentile(h, 0.95);
+    s->p99_us = percentile(h, 0.99);
+    s->max_us = h->max_us;
+}
+
+void stats_histogram_summary(StatsHistogram *h, StatsSummary *s)
+{
+    pthread_mutex_lock(&h->lock);
+    summarize(h, s);
+    pthread_mutex_unlock(&h->lock);
+}
+
+void stats_get_summary(enum StatsStage stage, StatsSummary *s)
+{
+    pthread_once(&stats_once, stats_init);
+    stats_histogram_summary(&histograms[stage], s);
+}
+
+int stats_dump(FILE *f, enum StatsFormat format)
+{
+    int i, b, first;
+
+    pthread_once(&stats_once, stats_init);
+    if (format == STATS_CSV)
+        fprintf(f, "stage,count,mean_us,p50_us,p95_us,p99_us,max_us\n");
+    else
+        fprintf(f, "{\n  \"stages\": [");
+
+    for (i = 0; i < STATS_NB_STAGES; i++) {
+        StatsHistogram *h = &histograms[i];
+        StatsHistogram copy;
+        StatsSummary s;
+
+        /* take a consistent copy so the stage is never held during I/O */
+        pthread_mutex_lock(&h->lock);
+        copy = *h;
+        pthread_mutex_unlock(&h->lock);
+        summarize(&copy, &s);
+
+        if (format == STATS_CSV) {
+            fprintf(f, "%s,%u,%lld,%lld,%lld,%lld,%lld\n", stage_names[i],
+                    s.count, (long long)s.mean_us, (long long)s.p50_us,
+                    (long long)s.p95_us, (long long)s.p99_us,
+                    (long long)s.max_us);
+            continue;
+        }
+
+        fprintf(f, "%s\n    { \"stage\": \"%s\", \"count\": %u, "
+                "\"mean_us\": %lld, \"p50_us\": %lld, \"p95_us\": %lld, "
+                "\"p99_us\": %lld, \"max_us\": %lld,\n      \"buckets\": [",
+                i ? "," : "", stage_names[i], s.count, (long long)s.mean_us,
+                (long long)s.p50_us, (long long)s.p95_us,
+                (long long)s.p99_us, (long long)s.max_us);
+        /* only the populated buckets, as [upper bound, count] */
+        first = 1;
+        for (b = 0; b < NB_BUCKETS; b++) {
+            if (!copy.buckets[b])
+                continue;
+            fprintf(f, "%s[%lld, %u]", first ? "" : ", ",
+                    (long long)bucket_upper(b), copy.buckets[b]);
+            first = 0;
+        }
+        fprintf(f, "] }");
+    }
+
+    if (format != STATS_CSV)
+        fprintf(f, "\n  ]\n}\n");
+    return ferror(f) ? -1 : 0;
+}
+
+static void write_output(void)
+{
+    char tmp[4096];
+    size_t len;
+    FILE *f;
+
+    if (!output_path)
+        return;
+    len = strlen(output_path);
+
+    /* readers of the file never see a half written dump */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", output_path);
+    f = fopen(tmp, "w");
+    if (!f) {
+        fprintf(stderr, "stats: could not open '%s'\n", tmp);
+        return;
+    }
+    stats_dump(f, len > 4 && !strcmp(output_path + len - 4, ".csv") ?
+            STATS_CSV : STATS_JSON);
+    if (fclose(f) != 0 || rename(tmp, output_path) < 0) {
+        fprintf(stderr, "stats: could not write '%s'\n", output_path);
+        remove(tmp);
+    }
+}
+
+static void sigusr1_handler(int sig)
+{
+    (void)sig;
+    dump_pending = 1;
+}
+
+int stats_set_output(const char *path)
+{
+    struct sigaction sa;
+
+    free(output_path);
+    output_path = strdup(path);
+    if (!output_path)
+        return -1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigusr1_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    return sigaction(SIGUSR1, &sa, NULL);
+}
+
+void stats_exit(void)
+{
+    StatsSummary s;
+    int i;
+
+    for (i = 0; i < STATS_NB_STAGES; i++) {
+        stats_get_summary(i, &s);
+        if (!s.count)
+            continue;
+        printf("latency %-10s: %6u samples, mean %lld us, p50 %lld, "
+                "p95 %lld, p99 %lld, max %lld us\n", stage_names[i],
+                s.count, (long long)s.mean_us, (long long)s.p50_us,
+                (long long)s.p95_us, (long long)s.p99_us,
+                (long long)s.max_us);
+    }
+
+    write_output();
+    free(output_path);
+    output_path = NULL;
+}
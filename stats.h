@@ -0,0 +1,105 @@
+/*
+ * Per stage latency histograms
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "timeutil.h"
+
+enum StatsStage {
+    STATS_PATTERN,          /* pattern_fill() */
+    STATS_SWS,              /* sws_scale() to the codec's format */
+    STATS_ENCODE,           /* avcodec_encode_video() */
+    STATS_MUX,              /* av_interleaved_write_frame() */
+    STATS_SNAPSHOT,         /* snapshot file write */
+    STATS_DECODE,           /* avcodec_decode_video2() */
+    STATS_SCALE,            /* scale_picture() */
+    STATS_SAVE_IMAGE,       /* save_image() */
+    STATS_NB_STAGES
+};
+
+enum StatsFormat {
+    STATS_JSON,
+    STATS_CSV,
+};
+
+/*
+ * Latencies go into log-linear buckets, 8 per power of two, so a
+ * percentile is off by at most 1/8 of its value. Recording is a bucket
+ * increment under a per stage lock and never allocates.
+ */
+#define STATS_SUB_BITS      3
+/* enough buckets for any 32 bit number of microseconds */
+#define STATS_NB_BUCKETS    ((32 - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+
+typedef struct StatsHistogram {
+    pthread_mutex_t lock;
+    unsigned count;
+    int64_t sum_us;
+    int64_t max_us;
+    unsigned buckets[STATS_NB_BUCKETS];
+} StatsHistogram;
+
+typedef struct StatsSummary {
+    unsigned count;
+    int64_t mean_us;
+    int64_t p50_us, p95_us, p99_us;
+    int64_t max_us;
+} StatsSummary;
+
+/* histograms of their own, for measurements that are not a stage */
+void stats_histogram_init(StatsHistogram *h);
+void stats_histogram_destroy(StatsHistogram *h);
+void stats_histogram_record(StatsHistogram *h, int64_t us);
+void stats_histogram_summary(StatsHistogram *h, StatsSummary *s);
+
+void stats_record(enum StatsStage stage, int64_t us);
+
+/* record the time since t0 and return now, to time stages back to back */
+static inline int64_t stats_lap(enum StatsStage stage, int64_t t0)
+{
+    int64_t now = time_now_us();
+
+    stats_record(stage, now - t0);
+    return now;
+}
+
+const char *stats_stage_name(enum StatsStage stage);
+void stats_get_summary(enum StatsStage stage, StatsSummary *s);
+
+int stats_dump(FILE *f, enum StatsFormat format);
+
+/**
+ * Dump the histograms to path at stats_exit() and whenever SIGUSR1
+ * arrives. Paths ending in .csv are written as CSV, anything else as JSON.
+ */
+int stats_set_output(const char *path);
+
+/* print a summary of every stage that saw samples, write the output file */
+void stats_exit(void);
+
+#endif /* STATS_H */
@@ -0,0 +1,79 @@
+/*
+ * Packed byte arithmetic in 32-bit words
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef SWAR_H
+#define SWAR_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* the same byte in all four lanes */
+static inline uint32_t swar_splat8(uint8_t b)
+{
+    return b * 0x01010101u;
+}
+
+/* four bytes in memory order, independent of endianness */
+static inline uint32_t swar_bytes(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3)
+{
+    uint8_t b[4] = { b0, b1, b2, b3 };
+    uint32_t w;
+
+    memcpy(&w, b, 4);
+    return w;
+}
+
+/* per lane a + b modulo 256, no carries between lanes */
+static inline uint32_t swar_add8(uint32_t a, uint32_t b)
+{
+    return ((a & 0x7f7f7f7fu) + (b & 0x7f7f7f7fu)) ^ ((a ^ b) & 0x80808080u);
+}
+
+/*
+ * Word loads and stores. ARMv5 can't access unaligned words, so callers
+ * check the alignment once per row and pass it in.
+ */
+static inline uint32_t swar_load(const uint8_t *src, int aligned)
+{
+    uint32_t w;
+
+    if (aligned)
+        return *(const uint32_t *)src;
+    memcpy(&w, src, 4);
+    return w;
+}
+
+static inline void swar_store(uint8_t *dst, uint32_t w, int aligned)
+{
+    if (aligned)
+        *(uint32_t *)dst = w;
+    else
+        memcpy(dst, &w, 4);
+}
+
+static inline int swar_aligned(const void *p)
+{
+    return !((uintptr_t)p & 3);
+}
+
+#endif /* SWAR_H */
@@ -0,0 +1,457 @@
+/*
+ * Decode to encode transcoding without copying pictures
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libavformat/avformat.h>
+
+#include "accel_sched.h"
+#include "channel.h"
+#include "cmem_acct.h"
+#include "frame_pool.h"
+#include "stats.h"
+#include "timeutil.h"
+#include "transcode.h"
+
+/* xdc.cfg puts the decoders and encoders in the same group */
+#define HDVICP_GROUP 1
+
+#define TRANSCODE_POOL_FRAMES 2
+
+typedef struct Output {
+    AVFormatContext *oc;
+    AVStream *st;
+    uint8_t *outbuf;
+    int outbuf_size;
+    CMEM_AllocParams *outbuf_params;
+    int64_t bytes;
+    int frames;
+} Output;
+
+typedef struct TranscodeStats {
+    int decoded;
+    int zero_copy;          /* pictures passed to the encoder as decoded */
+    int copied;             /* pictures copied into a CMEM frame first */
+    int64_t bytes_not_copied;
+    int64_t decode_us;
+    int64_t encode_us;
+    int64_t scale_us;
+    int64_t copy_us;
+} TranscodeStats;
+
+int transcode_parse_output(const char *spec, TranscodeConfig *cfg)
+{
+    char codec[16];
+    int n = -1;
+
+    if (sscanf(spec, "%15[^:]:%d:%n", codec, &cfg->bit_rate, &n) < 2 ||
+            n < 0 || !spec[n])
+        return -1;
+    cfg->codec_id = channel_codec_from_name(codec);
+    if (cfg->codec_id != CODEC_ID_H264 && cfg->codec_id != CODEC_ID_MPEG4)
+        return -1;
+    snprintf(cfg->output, sizeof(cfg->output), "%s", spec + n);
+    return 0;
+}
+
+int transcode_parse_sub(const char *spec, TranscodeConfig *cfg)
+{
+    int n = -1;
+
+    if (sscanf(spec, "%dx%d:%d:%n", &cfg->sub_width, &cfg->sub_height,
+                &cfg->sub_bit_rate, &n) < 3 || n < 0 || !spec[n] ||
+            cfg->sub_width <= 0 || cfg->sub_height <= 0 ||
+            (cfg->sub_width | cfg->sub_height) & 1)
+        return -1;
+    snprintf(cfg->sub_output, sizeof(cfg->sub_output), "%s", spec + n);
+    return 0;
+}
+
+static int output_open(Output *out, const char *filename, enum CodecID id,
+        int width, int height, int bit_rate, AVRational time_base)
+{
+    AVOutputFormat *fmt;
+    AVCodecContext *c;
+    AVCodec *codec;
+
+    fmt = av_guess_format(NULL, filename, NULL);
+    if (!fmt) {
+        fprintf(stderr, "transcode: no format for '%s'\n", filename);
+        return -1;
+    }
+    out->oc = avformat_alloc_context();
+    if (!out->oc)
+        return -1;
+    out->oc->oformat = fmt;
+    snprintf(out->oc->filename, sizeof(out->oc->filename), "%s", filename);
+
+    out->st = av_new_stream(out->oc, 0);
+    if (!out->st)
+        return -1;
+    c = out->st->codec;
+    c->codec_id = id;
+    c->codec_type = AVMEDIA_TYPE_VIDEO;
+    c->bit_rate = bit_rate;
+    c->width = width;
+    c->height = height;
+    c->time_base = time_base;
+    c->gop_size = 12;
+    if (fmt->flags & AVFMT_GLOBALHEADER)
+        c->flags |= CODEC_FLAG_GLOBAL_HEADER;
+
+    codec = avcodec_find_encoder(id);
+    if (!codec) {
+        fprintf(stderr, "transcode: encoder not found\n");
+        return -1;
+    }
+    c->pix_fmt = PIX_FMT_NV12;
+    if (codec->pix_fmts && codec->pix_fmts[0] != -1)
+        c->pix_fmt = codec->pix_fmts[0];
+    if (avcodec_open(c, codec) < 0) {
+        fprintf(stderr, "transcode: could not open encoder\n");
+        return -1;
+    }
+
+    out->outbuf_size = avpicture_get_size(c->pix_fmt, width, height);
+    out->outbuf = cmem_acct_alloc("transcode outbuf", out->outbuf_size,
+            out->outbuf_params);
+    if (!out->outbuf)
+        return -1;
+
+    if (avio_open(&out->oc->pb, filename, URL_WRONLY) < 0) {
+        fprintf(stderr, "transcode: could not open '%s'\n", filename);
+        return -1;
+    }
+    avformat_write_header(out->oc, NULL);
+    return 0;
+}
+
+static void output_close(Output *out)
+{
+    unsigned i;
+
+    if (!out->oc)
+        return;
+    if (out->oc->pb) {
+        av_write_trailer(out->oc);
+        avio_close(out->oc->pb);
+    }
+    if (out->st && out->st->codec->codec)
+        avcodec_close(out->st->codec);
+    cmem_acct_free(out->outbuf);
+    for (i = 0; i < out->oc->nb_streams; i++) {
+        av_freep(&out->oc->streams[i]->codec);
+        av_freep(&out->oc->streams[i]);
+    }
+    av_free(out->oc);
+    out->oc = NULL;
+}
+
+static int output_encode(Output *out, AVFrame *pict, TranscodeStats *stats)
+{
+    AVCodecContext *c = out->st->codec;
+    int64_t acquired;
+    int out_size;
+
+    acquired = accel_acquire(HDVICP_GROUP);
+    out_size = avcodec_encode_video(c, out->outbuf, out->outbuf_size, pict);
+    accel_release(HDVICP_GROUP, acquired);
+    stats->encode_us += stats_lap(STATS_ENCODE, acquired) - acquired;
+
+    if (out_size < 0)
+        return -1;
+    if (out_size > 0) {
+        AVPacket pkt;
+
+        if (out->outbuf_params->flags == CMEM_CACHED)
+            CMEM_cacheInv(out->outbuf, out_size);
+
+        av_init_packet(&pkt);
+        if (c->coded_frame->pts != AV_NOPTS_VALUE)
+            pkt.pts = av_rescale_q(c->coded_frame->pts, c->time_base,
+                    out->st->time_base);
+        if (c->coded_frame->key_frame)
+            pkt.flags |= AV_PKT_FLAG_KEY;
+        pkt.stream_index = out->st->index;
+        pkt.data = out->outbuf;
+        pkt.size = out_size;
+        if (av_interleaved_write_frame(out->oc, &pkt) != 0)
+            return -1;
+        out->bytes += out_size;
+    }
+    out->frames++;
+    return 0;
+}
+
+/* every plane of the picture is in CMEM, so the codec can DMA from it */
+static int picture_in_cmem(const AVFrame *pict, enum PixelFormat pix_fmt)
+{
+    int planes = pix_fmt == PIX_FMT_NV12 ? 2 : 3;
+    int i;
+
+    for (i = 0; i < planes; i++) {
+        if (!pict->data[i] || !CMEM_getPhys(pict->data[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/* the decoder wrote the picture behind the CPU's back, its pool may be cached */
+static void decoded_for_cpu(const AVFrame *decoded)
+{
+    AVFrame *pooled = frame_pool_decoded(decoded);
+
+    if (pooled)
+        frame_pool_sync_for_cpu(pooled, FRAME_PLANES_ALL);
+}
+
+int transcode_run(const TranscodeConfig *cfg)
+{
+    AVFormatContext *fctx = NULL;
+    AVCodecContext *dctx = NULL;
+    AVCodec *decoder;
+    AVFrame *decoded = NULL, *wrapped = NULL;
+    ScaleContext *sctx = NULL;
+    ScalePyramid *pyr = NULL;
+    int pyr_level = 0;
+    Output main_out, sub_out;
+    TranscodeStats stats;
+    AVRational time_base = { 1, 25 };
+    AVStream *in_st = NULL;
+    int64_t start, elapsed;
+    unsigned i;
+    int ret = -1;
+
+    memset(&main_out, 0, sizeof(main_out));
+    memset(&sub_out, 0, sizeof(sub_out));
+    memset(&stats, 0, sizeof(stats));
+    main_out.outbuf_params = cfg->outbuf_params;
+    sub_out.outbuf_params = cfg->outbuf_params;
+
+    if (avformat_open_input(&fctx, cfg->input, NULL, NULL) < 0 || !fctx) {
+        fprintf(stderr, "transcode: could not open '%s'\n", cfg->input);
+        return -1;
+    }
+    av_find_stream_info(fctx);
+    for (i = 0; i < fctx->nb_streams; i++) {
+        if (fctx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+            in_st = fctx->streams[i];
+            break;
+        }
+    }
+    if (!in_st) {
+        fprintf(stderr, "transcode: no video stream in '%s'\n", cfg->input);
+        goto out;
+    }
+    dctx = in_st->codec;
+    if (in_st->r_frame_rate.num && in_st->r_frame_rate.den) {
+        time_base.num = in_st->r_frame_rate.den;
+        time_base.den = in_st->r_frame_rate.num;
+    }
+
+    decoder = avcodec_find_decoder_by_name("libdm365_h264");
+    frame_pool_attach_decoder(dctx);
+    if (!decoder || avcodec_open(dctx, decoder) < 0) {
+        fprintf(stderr, "transcode: cannot open decoder\n");
+        dctx = NULL;
+        goto out;
+    }
+
+    if (output_open(&main_out, cfg->output, cfg->codec_id, dctx->width,
+                dctx->height, cfg->bit_rate, time_base) < 0)
+        goto out;
+    if (cfg->sub_width) {
+        if (output_open(&sub_out, cfg->sub_output, cfg->codec_id,
+                    cfg->sub_width, cfg->sub_height, cfg->sub_bit_rate,
+                    time_base) < 0)
+            goto out;
+        if (sub_out.st->codec->pix_fmt != dctx->pix_fmt) {
+            fprintf(stderr, "transcode: substream needs the decoder format\n");
+            goto out;
+        }
+        /* a 2:1 or 4:1 box is a pyramid level, built from bursts of whole
+           rows instead of reading the decoder's noncached output in place */
+        if (cfg->sub_mode == SCALE_BOX) {
+            for (pyr_level = 1; pyr_level < SCALE_LEVELS; pyr_level++) {
+                if (cfg->sub_width == dctx->width >> pyr_level &&
+                        cfg->sub_height == dctx->height >> pyr_level)
+                    break;
+            }
+            if (pyr_level < SCALE_LEVELS)
+                pyr = scale_pyramid_init(dctx->pix_fmt, dctx->width,
+                        dctx->height, SCALE_LEVEL(pyr_level));
+        }
+        if (!pyr)
+            sctx = scale_init(dctx->pix_fmt, dctx->width, dctx->height,
+                    cfg->sub_width, cfg->sub_height, cfg->sub_mode);
+        if (!pyr && !sctx) {
+            fprintf(stderr, "transcode: can't scale %dx%d to %dx%d\n",
+                    dctx->width, dctx->height, cfg->sub_width,
+                    cfg->sub_height);
+            goto out;
+        }
+        if (!frame_pool_find(sub_out.st->codec->pix_fmt, cfg->sub_width,
+                    cfg->sub_height))
+            frame_pool_create(sub_out.st->codec->pix_fmt, cfg->sub_width,
+                    cfg->sub_height, TRANSCODE_POOL_FRAMES);
+    }
+
+    decoded = avcodec_alloc_frame();
+    wrapped = avcodec_alloc_frame();
+    if (!decoded || !wrapped)
+        goto out;
+
+    start = time_now_us();
+    for (;;) {
+        AVCodecContext *ec = main_out.st->codec;
+        AVFrame *pict, *small = NULL;
+        int synced = 0;
+        AVPacket pkt;
+        int64_t t0, acquired;
+        int got_pic = 0, nb;
+
+        if (cfg->max_frames && stats.decoded >= cfg->max_frames)
+            break;
+        if (av_read_frame(fctx, &pkt) < 0)
+            break;
+        if (pkt.stream_index != in_st->index) {
+            av_free_packet(&pkt);
+            continue;
+        }
+
+        acquired = accel_acquire(HDVICP_GROUP);
+        nb = avcodec_decode_video2(dctx, decoded, &got_pic, &pkt);
+        accel_release(HDVICP_GROUP, acquired);
+        stats.decode_us += stats_lap(STATS_DECODE, acquired) - acquired;
+        av_free_packet(&pkt);
+        if (nb < 0) {
+            fprintf(stderr, "transcode: error in decoding\n");
+            goto out;
+        }
+        if (!got_pic)
+            continue;
+        stats.decoded++;
+
+        if (dctx->pix_fmt == ec->pix_fmt && picture_in_cmem(decoded, ec->pix_fmt)) {
+            /* hand over the decoder's buffers, only the pointers move */
+            avcodec_get_frame_defaults(wrapped);
+            for (i = 0; i < 4; i++) {
+                wrapped->data[i] = decoded->data[i];
+                wrapped->linesize[i] = decoded->linesize[i];
+            }
+            pict = wrapped;
+            stats.zero_copy++;
+            stats.bytes_not_copied += avpicture_get_size(ec->pix_fmt,
+                    ec->width, ec->height);
+        } else {
+            pict = frame_pool_alloc(ec->pix_fmt, ec->width, ec->height);
+            if (!pict || dctx->pix_fmt != ec->pix_fmt) {
+                fprintf(stderr, "transcode: can't convert decoded picture\n");
+                frame_pool_unref(pict);
+                goto out;
+            }
+            t0 = time_now_us();
+            decoded_for_cpu(decoded);
+            synced = 1;
+            av_picture_copy((AVPicture *)pict, (const AVPicture *)decoded,
+                    ec->pix_fmt, ec->width, ec->height);
+            frame_pool_sync_for_device(pict, FRAME_PLANES_ALL);
+            stats.copy_us += time_now_us() - t0;
+            stats.copied++;
+        }
+        pict->pts = stats.decoded - 1;
+
+        nb = output_encode(&main_out, pict, &stats);
+        if (pict != wrapped)
+            frame_pool_unref(pict);
+        if (nb < 0) {
+            fprintf(stderr, "transcode: error in encoding\n");
+            goto out;
+        }
+
+        if ((pyr || sctx) && !synced)
+            decoded_for_cpu(decoded);
+        if (pyr) {
+            AVFrame *levels[SCALE_LEVELS];
+
+            t0 = time_now_us();
+            if (scale_pyramid_build(pyr, (AVPicture *)decoded, levels) < 0)
+                goto out;
+            stats.scale_us += stats_lap(STATS_SCALE, t0) - t0;
+            small = levels[pyr_level];
+        } else if (sctx) {
+            AVCodecContext *sc = sub_out.st->codec;
+
+            small = frame_pool_alloc(sc->pix_fmt, sc->width, sc->height);
+            if (!small)
+                goto out;
+            t0 = time_now_us();
+            scale_picture(sctx, (AVPicture *)decoded, (AVPicture *)small);
+            stats.scale_us += stats_lap(STATS_SCALE, t0) - t0;
+            frame_pool_sync_for_device(small, FRAME_PLANES_ALL);
+        }
+        if (small) {
+            small->pts = stats.decoded - 1;
+            nb = output_encode(&sub_out, small, &stats);
+            frame_pool_unref(small);
+            if (nb < 0) {
+                fprintf(stderr, "transcode: error in encoding substream\n");
+                goto out;
+            }
+        }
+    }
+    elapsed = time_now_us() - start;
+    ret = 0;
+
+    printf("transcode: %d frames in %lld ms, %.2f fps\n", stats.decoded,
+            (long long)(elapsed / 1000),
+            elapsed ? stats.decoded * 1000000.0 / elapsed : 0);
+    printf("transcode: %d zero-copy, %d copied (%lld us), %lld MB not copied\n",
+            stats.zero_copy, stats.copied, (long long)stats.copy_us,
+            (long long)(stats.bytes_not_copied >> 20));
+    if (stats.decoded)
+        printf("transcode: decode %lld us, encode %lld us, scale %lld us "
+                "per frame\n", (long long)(stats.decode_us / stats.decoded),
+                (long long)(stats.encode_us / stats.decoded),
+                (long long)(stats.scale_us / stats.decoded));
+    printf("transcode: main %d frames %lld bytes", main_out.frames,
+            (long long)main_out.bytes);
+    if (sub_out.oc)
+        printf(", sub %d frames %lld bytes", sub_out.frames,
+                (long long)sub_out.bytes);
+    printf("\n");
+
+out:
+    scale_free(sctx);
+    scale_pyramid_free(pyr);
+    output_close(&sub_out);
+    output_close(&main_out);
+    av_free(wrapped);
+    av_free(decoded);
+    if (dctx)
+        avcodec_close(dctx);
+    av_close_input_file(fctx);
+    return ret;
+}
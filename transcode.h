@@ -0,0 +1,60 @@
+/*
+ * Decode to encode transcoding without copying pictures
+ *
+ * Copyright (c) 2012 Jan Pohanka
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef TRANSCODE_H
+#define TRANSCODE_H
+
+#include <libavcodec/avcodec.h>
+
+#include "cmem.h"
+#include "scale.h"
+
+typedef struct TranscodeConfig {
+    const char *input;
+    enum CodecID codec_id;          /* h264 or mpeg4 */
+    int bit_rate;
+    char output[256];
+    /* optional downscaled substream, sub_width 0 for none */
+    int sub_width, sub_height;
+    int sub_bit_rate;
+    char sub_output[256];
+    enum ScaleMode sub_mode;
+    int max_frames;                 /* 0 for the whole input */
+    CMEM_AllocParams *outbuf_params;
+} TranscodeConfig;
+
+/* parse "codec:bitrate:file" for the main output */
+int transcode_parse_output(const char *spec, TranscodeConfig *cfg);
+
+/* parse "WIDTHxHEIGHT:bitrate:file" for the substream */
+int transcode_parse_sub(const char *spec, TranscodeConfig *cfg);
+
+/**
+ * Decode cfg->input with libdm365_h264 and encode every picture again.
+ * Decoded pictures that already live in CMEM in the encoder's format are
+ * handed to the encoder as they are, others are copied into a pooled
+ * frame first. Prints copies made and avoided and the transcode fps.
+ */
+int transcode_run(const TranscodeConfig *cfg);
+
+#endif /* TRANSCODE_H */